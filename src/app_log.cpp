@@ -0,0 +1,106 @@
+/**
+ * Asynchronous logger
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "app_log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+LogRing ring;
+uint32_t (*logClock)() = NULL;
+void (*logWake)() = NULL;
+
+const char levelNames[] = {'-', 'E', 'W', 'I', 'D'};
+
+}
+
+LogRing::LogRing() : writePosition(0), readPosition(0), droppedLines(0) {
+	for (uint32_t index = 0; index < LOG_SLOTS; index++) {
+		slots[index].sequence.store(index, std::memory_order_relaxed);
+	}
+}
+
+bool LogRing::push(uint32_t time, uint8_t level, const char *text, size_t length) {
+	uint32_t position = writePosition.load(std::memory_order_relaxed);
+	Slot *slot;
+	while (true) {
+		slot = &slots[position % LOG_SLOTS];
+		int32_t state = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+		if (state == 0) {
+			// Free for this position, claim it
+			if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (state < 0) {
+			// Still holds the line of the previous round
+			droppedLines.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		} else {
+			// Another writer claimed it first
+			position = writePosition.load(std::memory_order_relaxed);
+		}
+	}
+	if (length > LOG_LINE_SIZE) {
+		length = LOG_LINE_SIZE;
+	}
+	slot->line.time = time;
+	slot->line.level = level;
+	slot->line.length = length;
+	memcpy(slot->line.text, text, length);
+	slot->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool LogRing::pop(LogLine &line) {
+	Slot &slot = slots[readPosition % LOG_SLOTS];
+	if (slot.sequence.load(std::memory_order_acquire) != readPosition + 1) {
+		return false;
+	}
+	line = slot.line;
+	// Free for the writer of the next round
+	slot.sequence.store(readPosition + LOG_SLOTS, std::memory_order_release);
+	readPosition++;
+	return true;
+}
+
+void appLogBegin(uint32_t (*clock)(), void (*wake)()) {
+	logClock = clock;
+	logWake = wake;
+}
+
+void appLog(uint8_t level, const char *format, ...) {
+	char text[LOG_LINE_SIZE + 1];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (length < 0) {
+		return;
+	}
+	if (ring.push(logClock != NULL ? logClock() : 0, level, text, length) && logWake != NULL) {
+		logWake();
+	}
+}
+
+size_t appLogNext(char *out, size_t size) {
+	LogLine line;
+	if (size == 0 || !ring.pop(line)) {
+		return 0;
+	}
+	char level = line.level < sizeof(levelNames) ? levelNames[line.level] : '?';
+	int length = snprintf(out, size, "%lu %c %.*s\n", (unsigned long)line.time, level, (int)line.length, line.text);
+	if (length < 0) {
+		return 0;
+	}
+	return (size_t)length < size ? length : size - 1;
+}
+
+uint32_t appLogDropped() {
+	return ring.dropped();
+}
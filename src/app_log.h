@@ -0,0 +1,123 @@
+/**
+ * Asynchronous logger
+ *
+ * Log calls format the line on the caller's stack and queue it in a
+ * lock-free ring of fixed size slots, a drain task writes the lines out
+ * later. Callers never wait for the serial port and never allocate; if the
+ * ring is full the line is dropped and counted.
+ *
+ * Levels above APP_LOG_LEVEL compile to nothing, arguments included, so
+ * e.g. -DAPP_LOG_LEVEL=LOG_LEVEL_ERROR strips all but the error lines.
+ * Stripped calls are still type checked, in dead code the compiler drops.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef APP_LOG_H
+#define APP_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef APP_LOG_LEVEL
+#define APP_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/** Longest message, longer ones are truncated */
+#define LOG_LINE_SIZE 96
+/** Number of queued lines, a power of 2 */
+#define LOG_SLOTS 32
+/** Largest line returned by appLogNext(), time stamp and level added */
+#define LOG_OUTPUT_SIZE (LOG_LINE_SIZE + 16)
+
+#if APP_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) appLog(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do { if (0) appLog(LOG_LEVEL_NONE, __VA_ARGS__); } while (0)
+#endif
+#if APP_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) appLog(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do { if (0) appLog(LOG_LEVEL_NONE, __VA_ARGS__); } while (0)
+#endif
+#if APP_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) appLog(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do { if (0) appLog(LOG_LEVEL_NONE, __VA_ARGS__); } while (0)
+#endif
+#if APP_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) appLog(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { if (0) appLog(LOG_LEVEL_NONE, __VA_ARGS__); } while (0)
+#endif
+
+/** Queued line */
+struct LogLine {
+	uint32_t time;
+	uint8_t level;
+	uint8_t length;
+	char text[LOG_LINE_SIZE];
+};
+
+/**
+ * LogRing
+ * Bounded queue of LogLine, any number of writers and one reader, without
+ * locks. Each slot carries a sequence number that tells whether it is free
+ * for the writer of a position or filled for the reader.
+ */
+class LogRing {
+public:
+	LogRing();
+
+	/**
+	 * Queue a line
+	 * @return bool - false if the ring is full, the line is dropped
+	 */
+	bool push(uint32_t time, uint8_t level, const char *text, size_t length);
+	/**
+	 * Take the oldest line, single reader only
+	 * @return bool - false if the ring is empty
+	 */
+	bool pop(LogLine &line);
+
+	/** Lines dropped because the ring was full */
+	uint32_t dropped() const {
+		return droppedLines.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Slot {
+		std::atomic<uint32_t> sequence;
+		LogLine line;
+	};
+
+	Slot slots[LOG_SLOTS];
+	std::atomic<uint32_t> writePosition;
+	uint32_t readPosition;
+	std::atomic<uint32_t> droppedLines;
+};
+
+/**
+ * Set up the logger
+ * @param clock - time stamp source in ms
+ * @param wake - called after a line was queued, e.g. to wake the drain task, may be NULL
+ */
+void appLogBegin(uint32_t (*clock)(), void (*wake)());
+/** Format and queue a line, use the LOG_ macros instead */
+void appLog(uint8_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+/**
+ * Take the oldest line, formatted as "time level message\n", from the drain task
+ * @return size_t - length of the line, 0 if nothing is queued
+ */
+size_t appLogNext(char *out, size_t size);
+/** Lines dropped because the ring was full */
+uint32_t appLogDropped();
+
+#endif
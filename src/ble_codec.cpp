@@ -0,0 +1,76 @@
+/**
+ * Payload codec for the BLE characteristics
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "ble_codec.h"
+
+#include <string.h>
+
+void codecInit(BleCodec &codec, const char *key) {
+	size_t keyLength = strlen(key);
+	if (keyLength > CODEC_MAX_KEY) {
+		keyLength = CODEC_MAX_KEY;
+	}
+	if (keyLength == 0) {
+		memset(&codec, 0, sizeof(codec));
+		return;
+	}
+
+	// Smallest multiple of the key length that is also a multiple of 4
+	size_t period = keyLength;
+	while (period % 4) {
+		period += keyLength;
+	}
+	codec.period = period;
+
+	for (size_t index = 0; index < period; index++) {
+		codec.bytes[index] = (uint8_t) key[index % keyLength];
+	}
+	for (size_t phase = 0; phase < 4; phase++) {
+		for (size_t word = 0; word < period / 4; word++) {
+			uint8_t stream[4];
+			for (size_t byte = 0; byte < 4; byte++) {
+				stream[byte] = codec.bytes[(phase + 4 * word + byte) % period];
+			}
+			memcpy(&codec.words[phase][word], stream, sizeof(stream));
+		}
+	}
+}
+
+void codecApply(const BleCodec &codec, uint8_t *data, size_t length) {
+	if (codec.period == 0) {
+		return;
+	}
+
+	size_t index = 0;
+	size_t keyIndex = 0;
+
+	// Bytes up to the first word boundary of the payload
+	while (index < length && ((uintptr_t)(data + index) & 3)) {
+		data[index++] ^= codec.bytes[keyIndex++];
+		if (keyIndex >= codec.period) keyIndex = 0;
+	}
+
+	// Whole words, the keystream phase stays fixed from here on
+	const uint32_t *stream = codec.words[keyIndex & 3];
+	size_t word = keyIndex / 4;
+	size_t words = codec.period / 4;
+	for (; index + 4 <= length; index += 4) {
+		uint32_t value;
+		uint8_t *aligned = (uint8_t *) __builtin_assume_aligned(data + index, 4);
+		memcpy(&value, aligned, sizeof(value));
+		value ^= stream[word];
+		memcpy(aligned, &value, sizeof(value));
+		if (++word >= words) word = 0;
+	}
+	keyIndex = (keyIndex & 3) + 4 * word;
+	if (keyIndex >= codec.period) keyIndex -= codec.period;
+
+	// Remaining tail bytes
+	while (index < length) {
+		data[index++] ^= codec.bytes[keyIndex++];
+		if (keyIndex >= codec.period) keyIndex = 0;
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ * Payload codec for the BLE characteristics
+ *
+ * Payloads are XORed with the device name, the same obfuscation the web
+ * app applies. The keystream is derived once from the name, so encoding
+ * and decoding is a single pass over the payload, 32 bits at a time.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef BLE_CODEC_H
+#define BLE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Longest key the codec accepts, longer keys are truncated */
+#define CODEC_MAX_KEY 32
+/** Keystream period is the key length rounded up to a multiple of 4 bytes per word */
+#define CODEC_MAX_PERIOD (4 * CODEC_MAX_KEY)
+
+/**
+ * BleCodec
+ * Keystream repeated to a period that is a multiple of 4 bytes, stored once
+ * for each of the 4 possible byte phases of a word aligned payload.
+ */
+struct BleCodec {
+	/** words[phase][index] holds key bytes phase + 4 * index onwards */
+	uint32_t words[4][CODEC_MAX_PERIOD / 4];
+	/** Keystream as bytes, for unaligned head and tail bytes */
+	uint8_t bytes[CODEC_MAX_PERIOD];
+	/** Keystream period in bytes, 0 if no key is set */
+	uint16_t period;
+};
+
+/**
+ * Derive the keystream from a key
+ * @param codec - codec to initialize
+ * @param key - zero terminated key, usually the device name
+ */
+void codecInit(BleCodec &codec, const char *key);
+
+/**
+ * Encode or decode a payload in place
+ * XOR is its own inverse, so the same call does both.
+ * @param codec - codec initialized with codecInit()
+ * @param data - payload
+ * @param length - payload length in bytes
+ */
+void codecApply(const BleCodec &codec, uint8_t *data, size_t length);
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * Service and characteristic UUIDs
+ *
+ * Shared by the sketch and the socket transport of the native build.
+ * Service & wifi uuid are what's used in the original sketch, to maintain
+ * compatibility, list & status uuid were randomly generated using
+ * https://www.uuidgenerator.net/
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef BLE_UUIDS_H
+#define BLE_UUIDS_H
+
+#define SERVICE_UUID  "0000aaaa-ead2-11e7-80c1-9a214cf093ae"
+#define WIFI_UUID     "00005555-ead2-11e7-80c1-9a214cf093ae"
+#define WIFI_LIST_UUID "1d338124-7ddc-449e-afc7-67f8673a1160"
+#define WIFI_STATUS_UUID "5b3595c4-ad4f-4e1e-954e-3b290cc02eb0"
+#define WIFI_STATUS_EXT_UUID "62a4d857-2c05-4716-8335-ed2381e07d34"
+#define WIFI_DIAG_UUID "0299b113-ed73-4fcb-b984-7cbb673f94ce"
+/** Length of a UUID string, without the terminator */
+#define UUID_STRING_LENGTH 36
+
+#endif
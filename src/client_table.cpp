@@ -0,0 +1,81 @@
+/**
+ * Table of connected BLE clients
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "client_table.h"
+
+#include <string.h>
+
+ClientTable::ClientTable() : used(0) {
+	memset(clients, 0, sizeof(clients));
+}
+
+BleClient *ClientTable::add(uint16_t connId, const uint8_t *address) {
+	BleClient *client = find(connId);
+	if (client == NULL) {
+		for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+			if (!clients[index].used) {
+				client = &clients[index];
+				used++;
+				break;
+			}
+		}
+	}
+	if (client == NULL) {
+		return NULL;
+	}
+
+	memset(client, 0, sizeof(*client));
+	client->used = true;
+	client->connId = connId;
+	memcpy(client->address, address, sizeof(client->address));
+	client->mtu = BLE_DEFAULT_MTU;
+	return client;
+}
+
+bool ClientTable::remove(uint16_t connId) {
+	BleClient *client = find(connId);
+	if (client == NULL) {
+		return false;
+	}
+	client->used = false;
+	used--;
+	return true;
+}
+
+BleClient *ClientTable::find(uint16_t connId) {
+	for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+		if (clients[index].used && clients[index].connId == connId) {
+			return &clients[index];
+		}
+	}
+	return NULL;
+}
+
+BleClient *ClientTable::findByAddress(const uint8_t *address) {
+	for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+		if (clients[index].used && !memcmp(clients[index].address, address, sizeof(clients[index].address))) {
+			return &clients[index];
+		}
+	}
+	return NULL;
+}
+
+uint8_t ClientTable::subscribers(uint8_t mask) const {
+	uint8_t subscribed = 0;
+	for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+		if (clients[index].used && (clients[index].subscriptions & mask)) {
+			subscribed++;
+		}
+	}
+	return subscribed;
+}
+
+AdvertisingChange advertisingChange(const ClientTable &clients, bool advertising) {
+	if (clients.hasFreeSlot()) {
+		return advertising ? ADVERTISING_KEEP : ADVERTISING_START;
+	}
+	return advertising ? ADVERTISING_STOP : ADVERTISING_KEEP;
+}
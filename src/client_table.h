@@ -0,0 +1,95 @@
+/**
+ * Table of connected BLE clients
+ *
+ * Fixed capacity, keyed by the GATT connection id. Holds what each client
+ * subscribed to, the parameters negotiated with it and the protocol it
+ * writes credentials in, so notifications can be sent to subscribed clients
+ * only and every client is answered in its own format. Not thread safe,
+ * callers serialize access.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef CLIENT_TABLE_H
+#define CLIENT_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Clients served at the same time, below the controller's connection limit */
+#define MAX_BLE_CLIENTS 3
+/** ATT MTU until a client negotiates a larger one */
+#define BLE_DEFAULT_MTU 23
+
+/** Notification subscriptions, one bit per characteristic */
+enum ClientSubscription {
+	SUB_STATUS = 1 << 0,
+	SUB_STATUS_EXT = 1 << 1
+};
+
+/** One connected client */
+struct BleClient {
+	bool used;
+	uint16_t connId;
+	uint8_t address[6];
+	/** ClientSubscription bits */
+	uint8_t subscriptions;
+	uint16_t mtu;
+	/** Connection interval in 1.25 ms units, 0 until reported */
+	uint16_t interval;
+	uint16_t latency;
+	/** Supervision timeout in 10 ms units */
+	uint16_t timeout;
+	/** The last credential write of this client was a TLV frame, JSON until it writes */
+	bool usesTlv;
+};
+
+/** Change of advertising after a client connected or disconnected */
+enum AdvertisingChange {
+	ADVERTISING_KEEP,
+	ADVERTISING_START,
+	ADVERTISING_STOP
+};
+
+class ClientTable {
+public:
+	ClientTable();
+
+	/**
+	 * Add a client, or reset it if the connection id is already known
+	 * @return BleClient* - the client, NULL if the table is full
+	 */
+	BleClient *add(uint16_t connId, const uint8_t *address);
+
+	/** Remove a client, returns false if it was not in the table */
+	bool remove(uint16_t connId);
+
+	/** Client with this connection id, NULL if none */
+	BleClient *find(uint16_t connId);
+
+	/** Client with this address, NULL if none */
+	BleClient *findByAddress(const uint8_t *address);
+
+	/** Number of connected clients */
+	uint8_t count() const { return used; }
+
+	bool hasFreeSlot() const { return used < MAX_BLE_CLIENTS; }
+
+	/** Number of clients subscribed to any of the bits in mask */
+	uint8_t subscribers(uint8_t mask) const;
+
+	/** Slot by index, for iteration over 0..MAX_BLE_CLIENTS-1, check used */
+	const BleClient &slot(size_t index) const { return clients[index]; }
+
+private:
+	BleClient clients[MAX_BLE_CLIENTS];
+	uint8_t used;
+};
+
+/**
+ * Advertising runs while there is room for another client
+ * @param advertising - advertising is running, false after a connect as the controller stopped it
+ */
+AdvertisingChange advertisingChange(const ClientTable &clients, bool advertising);
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * WiFi connection state machine
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "conn_manager.h"
+
+ConnManager::ConnManager(ConnActions &actions, const ConnManagerConfig &config)
+	: actions(actions), config(config), current(CM_IDLE), fastAttempt(false), timeoutPending(false), deadline(0),
+	  failedAttempts(0), randomState(1) {
+}
+
+void ConnManager::seed(uint32_t value) {
+	// xorshift32 never leaves 0
+	randomState = value != 0 ? value : 1;
+}
+
+void ConnManager::begin(bool hasCredentials, uint32_t now) {
+	if (hasCredentials) {
+		start(now);
+	} else {
+		enter(CM_IDLE, now, 0);
+	}
+}
+
+void ConnManager::handle(const ConnEvent &event, uint32_t now) {
+	switch (event.type) {
+		case CM_EVT_CREDENTIALS:
+			// The cached AP belongs to the old credentials, the platform dropped it
+			failedAttempts = 0;
+			start(now);
+			break;
+		case CM_EVT_ERASE:
+			actions.disconnect();
+			enter(CM_IDLE, now, 0);
+			break;
+		case CM_EVT_GOT_IP:
+			if (current != CM_IDLE && current != CM_CONNECTED) {
+				// A late association still counts, whatever was pending is dropped
+				bool fast = (current == CM_CONNECTING && fastAttempt) || current == CM_DEBOUNCE;
+				failedAttempts = 0;
+				enter(CM_CONNECTED, now, 0);
+				actions.connected(fast);
+			}
+			break;
+		case CM_EVT_LOST:
+			if (current == CM_CONNECTED) {
+				if (config.debounceMs > 0) {
+					enter(CM_DEBOUNCE, now, config.debounceMs);
+				} else {
+					reconnect(now);
+				}
+			} else if (current == CM_CONNECTING) {
+				fail(now);
+			}
+			break;
+		case CM_EVT_SCAN_DONE:
+			if (current != CM_SCANNING) {
+				break;
+			}
+			if (actions.selectNetwork()) {
+				fastAttempt = false;
+				enter(CM_CONNECTING, now, CM_CONNECT_TIMEOUT);
+				actions.connect();
+			} else {
+				backoff(now);
+			}
+			break;
+	}
+}
+
+void ConnManager::tick(uint32_t now) {
+	if (!timeoutPending || (int32_t)(now - deadline) < 0) {
+		return;
+	}
+	timeoutPending = false;
+	switch (current) {
+		case CM_SCANNING:
+			backoff(now);
+			break;
+		case CM_CONNECTING:
+			fail(now);
+			break;
+		case CM_DEBOUNCE:
+			reconnect(now);
+			break;
+		case CM_BACKOFF:
+			start(now);
+			break;
+		default:
+			break;
+	}
+}
+
+uint32_t ConnManager::nextTimeout(uint32_t now) const {
+	if (!timeoutPending) {
+		return CM_NO_TIMEOUT;
+	}
+	int32_t remaining = (int32_t)(deadline - now);
+	return remaining > 0 ? (uint32_t)remaining : 0;
+}
+
+void ConnManager::start(uint32_t now) {
+	if (actions.connectCached()) {
+		fastAttempt = true;
+		enter(CM_CONNECTING, now, CM_FAST_CONNECT_TIMEOUT);
+		return;
+	}
+	scan(now);
+}
+
+void ConnManager::reconnect(uint32_t now) {
+	if (config.quickRetry) {
+		start(now);
+	} else {
+		scan(now);
+	}
+}
+
+void ConnManager::scan(uint32_t now) {
+	fastAttempt = false;
+	enter(CM_SCANNING, now, CM_SCAN_TIMEOUT);
+	actions.startScan();
+}
+
+void ConnManager::fail(uint32_t now) {
+	if (fastAttempt) {
+		scan(now);
+	} else {
+		backoff(now);
+	}
+}
+
+void ConnManager::backoff(uint32_t now) {
+	enter(CM_BACKOFF, now, backoffDelay());
+}
+
+uint32_t ConnManager::backoffDelay() {
+	uint32_t delay = config.backoffMinMs;
+	for (uint8_t attempt = 0; attempt < failedAttempts && delay < config.backoffMaxMs; attempt++) {
+		delay *= 2;
+	}
+	if (delay > config.backoffMaxMs) {
+		delay = config.backoffMaxMs;
+	}
+	if (failedAttempts < 0xFF) {
+		failedAttempts++;
+	}
+	uint32_t spread = delay / 100 * config.jitterPercent;
+	if (spread > 0) {
+		delay = delay - spread + nextRandom() % (2 * spread + 1);
+	}
+	// 0 would mean no timeout
+	return delay > 0 ? delay : 1;
+}
+
+uint32_t ConnManager::nextRandom() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState;
+}
+
+void ConnManager::enter(ConnManagerState state, uint32_t now, uint32_t timeout) {
+	current = state;
+	timeoutPending = timeout != 0;
+	deadline = now + timeout;
+	actions.stateChanged(state, timeout);
+}
@@ -0,0 +1,170 @@
+/**
+ * WiFi connection state machine
+ *
+ * Decides when to scan, connect, wait and retry. It does not touch the
+ * radio itself: the platform feeds it events and the current time, and
+ * carries out what it asks for through ConnActions. Time is passed in as
+ * milliseconds, so the same code runs on the device and against a virtual
+ * clock.
+ *
+ *   IDLE        no credentials, waits for CM_EVT_CREDENTIALS
+ *   SCANNING    waits for CM_EVT_SCAN_DONE
+ *   CONNECTING  waits for CM_EVT_GOT_IP, falls back to a scan or backs off
+ *   CONNECTED   waits for CM_EVT_LOST
+ *   DEBOUNCE    connection lost, waits if the driver gets it back by itself
+ *   BACKOFF     waits for the retry delay, then starts over
+ *
+ * The retry delay doubles with every failed attempt, up to a maximum, and
+ * is spread by a random jitter so several devices behind a flapping AP do
+ * not retry in lockstep.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef CONN_MANAGER_H
+#define CONN_MANAGER_H
+
+#include <stdint.h>
+
+/** Time in ms a direct connect to the cached AP may take before falling back to a scan */
+#define CM_FAST_CONNECT_TIMEOUT 3000
+/** Time in ms a connect to a scanned network may take */
+#define CM_CONNECT_TIMEOUT 15000
+/** Time in ms to wait for a requested scan */
+#define CM_SCAN_TIMEOUT 15000
+/** Defaults for ConnManagerConfig */
+#define CM_DEBOUNCE_TIME 1000
+#define CM_BACKOFF_MIN 2000
+#define CM_BACKOFF_MAX 60000
+#define CM_BACKOFF_JITTER 20
+/** Returned by ConnManager::nextTimeout() if nothing is pending */
+#define CM_NO_TIMEOUT 0xFFFFFFFFUL
+
+enum ConnManagerState {
+	CM_IDLE = 0,
+	CM_SCANNING,
+	CM_CONNECTING,
+	CM_CONNECTED,
+	CM_DEBOUNCE,
+	CM_BACKOFF
+};
+
+/** Retry behaviour */
+struct ConnManagerConfig {
+	/** Time in ms a lost connection may come back by itself before anything is done, 0 to act at once */
+	uint32_t debounceMs;
+	/** Retry the cached AP directly before scanning after a lost connection */
+	bool quickRetry;
+	/** Retry delay in ms after the first failed attempt */
+	uint32_t backoffMinMs;
+	/** Upper bound in ms of the doubling retry delay */
+	uint32_t backoffMaxMs;
+	/** Random spread of the retry delay, in percent of it, in both directions */
+	uint8_t jitterPercent;
+};
+
+enum ConnEventType {
+	/** New credentials were stored */
+	CM_EVT_CREDENTIALS = 0,
+	/** Credentials were erased */
+	CM_EVT_ERASE,
+	/** The station received an IP address */
+	CM_EVT_GOT_IP,
+	/** The station lost its connection, or a connect failed */
+	CM_EVT_LOST,
+	/** A scan requested with ConnActions::startScan() completed */
+	CM_EVT_SCAN_DONE
+};
+
+/** Event queued by the platform, small enough to be copied into a queue */
+struct ConnEvent {
+	uint8_t type;
+	/** Event specific, the disconnect reason for CM_EVT_LOST */
+	uint8_t arg;
+};
+
+/**
+ * ConnActions
+ * Implemented by the platform, called from ConnManager only.
+ */
+class ConnActions {
+public:
+	virtual ~ConnActions() {}
+	/** Start a scan, answered with CM_EVT_SCAN_DONE */
+	virtual void startScan() = 0;
+	/**
+	 * Pick a network from the last scan
+	 * @return bool - false if no configured network was found
+	 */
+	virtual bool selectNetwork() = 0;
+	/**
+	 * Connect to the AP of the last successful association, on its channel
+	 * @return bool - false if no AP is cached
+	 */
+	virtual bool connectCached() = 0;
+	/** Connect to the network picked by selectNetwork() */
+	virtual void connect() = 0;
+	virtual void disconnect() = 0;
+	/**
+	 * An IP was received
+	 * @param fast - the connect went to the cached AP without a scan
+	 */
+	virtual void connected(bool fast) = 0;
+	/**
+	 * Called on every state change, after the new state is set
+	 * @param timeout - time in ms the state lasts at most, 0 if unlimited
+	 */
+	virtual void stateChanged(ConnManagerState state, uint32_t timeout) = 0;
+};
+
+class ConnManager {
+public:
+	ConnManager(ConnActions &actions, const ConnManagerConfig &config);
+
+	/** Seed the jitter, e.g. from a hardware random source */
+	void seed(uint32_t value);
+	/** Start from IDLE, or with a connect if credentials are stored */
+	void begin(bool hasCredentials, uint32_t now);
+	void handle(const ConnEvent &event, uint32_t now);
+	/** Handle an expired timeout, call when nextTimeout() elapsed */
+	void tick(uint32_t now);
+	/** Time in ms until tick() has something to do, CM_NO_TIMEOUT if nothing is pending */
+	uint32_t nextTimeout(uint32_t now) const;
+
+	ConnManagerState state() const {
+		return current;
+	}
+
+	/** Failed attempts since the last successful connect */
+	uint8_t failures() const {
+		return failedAttempts;
+	}
+
+private:
+	/** Connect to the cached AP if there is one, else scan */
+	void start(uint32_t now);
+	void scan(uint32_t now);
+	/** Lost connection did not come back, quick retry or scan */
+	void reconnect(uint32_t now);
+	/** Attempt failed, scan if it was the cached AP, else wait */
+	void fail(uint32_t now);
+	void backoff(uint32_t now);
+	/** Next retry delay, grows with failedAttempts */
+	uint32_t backoffDelay();
+	/** xorshift32 */
+	uint32_t nextRandom();
+	/** Change state, timeout 0 for none */
+	void enter(ConnManagerState state, uint32_t now, uint32_t timeout);
+
+	ConnActions &actions;
+	const ConnManagerConfig &config;
+	ConnManagerState current;
+	/** The current connect goes to the cached AP */
+	bool fastAttempt;
+	bool timeoutPending;
+	uint32_t deadline;
+	uint8_t failedAttempts;
+	uint32_t randomState;
+};
+
+#endif
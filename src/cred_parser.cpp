@@ -0,0 +1,267 @@
+/**
+ * Allocation-free parser for credential writes
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "cred_parser.h"
+
+#include <string.h>
+
+namespace {
+
+/** Credential fields found in a write */
+enum {
+	FIELD_SSID_PRIM = 1 << 0,
+	FIELD_PW_PRIM = 1 << 1,
+	FIELD_SSID_SEC = 1 << 2,
+	FIELD_PW_SEC = 1 << 3,
+	FIELD_ERASE = 1 << 4,
+	FIELD_RESET = 1 << 5,
+	FIELD_ALL_CREDENTIALS = FIELD_SSID_PRIM | FIELD_PW_PRIM | FIELD_SSID_SEC | FIELD_PW_SEC
+};
+
+/** Read position inside the payload */
+struct Cursor {
+	char *pos;
+	char *end;
+};
+
+void skipSpace(Cursor &cursor) {
+	while (cursor.pos < cursor.end
+			&& (*cursor.pos == ' ' || *cursor.pos == '\t' || *cursor.pos == '\r' || *cursor.pos == '\n')) {
+		cursor.pos++;
+	}
+}
+
+int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/** Read the 4 hex digits of a \u escape, cursor on the first digit */
+bool parseHex4(Cursor &cursor, unsigned long &value) {
+	if (cursor.end - cursor.pos < 4) {
+		return false;
+	}
+	value = 0;
+	for (int index = 0; index < 4; index++) {
+		int digit = hexValue(*cursor.pos++);
+		if (digit < 0) {
+			return false;
+		}
+		value = (value << 4) | digit;
+	}
+	return true;
+}
+
+/** Write a code point as UTF-8, never longer than the escape it replaces */
+char *putUtf8(char *out, unsigned long codePoint) {
+	if (codePoint < 0x80) {
+		*out++ = (char) codePoint;
+	} else if (codePoint < 0x800) {
+		*out++ = (char) (0xC0 | (codePoint >> 6));
+		*out++ = (char) (0x80 | (codePoint & 0x3F));
+	} else if (codePoint < 0x10000) {
+		*out++ = (char) (0xE0 | (codePoint >> 12));
+		*out++ = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		*out++ = (char) (0x80 | (codePoint & 0x3F));
+	} else {
+		*out++ = (char) (0xF0 | (codePoint >> 18));
+		*out++ = (char) (0x80 | ((codePoint >> 12) & 0x3F));
+		*out++ = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		*out++ = (char) (0x80 | (codePoint & 0x3F));
+	}
+	return out;
+}
+
+/**
+ * Parse a string token, cursor on the opening quote
+ * The unescaped string is written over the token itself.
+ */
+bool parseString(Cursor &cursor, char *&value, size_t &valueLength) {
+	if (cursor.pos >= cursor.end || *cursor.pos != '"') {
+		return false;
+	}
+	cursor.pos++;
+	value = cursor.pos;
+	char *out = cursor.pos;
+
+	while (cursor.pos < cursor.end) {
+		char c = *cursor.pos++;
+		if (c == '"') {
+			valueLength = out - value;
+			return true;
+		}
+		if ((unsigned char) c < 0x20) {
+			return false;
+		}
+		if (c != '\\') {
+			*out++ = c;
+			continue;
+		}
+		if (cursor.pos >= cursor.end) {
+			return false;
+		}
+		c = *cursor.pos++;
+		switch (c) {
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '/': *out++ = '/'; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u': {
+				unsigned long codePoint;
+				if (!parseHex4(cursor, codePoint)) {
+					return false;
+				}
+				if (codePoint >= 0xD800 && codePoint < 0xDC00) {
+					// High surrogate, must be followed by the low one
+					unsigned long low;
+					if (cursor.end - cursor.pos < 2 || cursor.pos[0] != '\\' || cursor.pos[1] != 'u') {
+						return false;
+					}
+					cursor.pos += 2;
+					if (!parseHex4(cursor, low) || low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+				} else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+					return false;
+				}
+				out = putUtf8(out, codePoint);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	return false;
+}
+
+/** Skip a true/false/null/number value */
+bool skipPrimitive(Cursor &cursor) {
+	char *start = cursor.pos;
+	while (cursor.pos < cursor.end) {
+		char c = *cursor.pos;
+		if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'E') {
+			cursor.pos++;
+		} else {
+			break;
+		}
+	}
+	return cursor.pos > start;
+}
+
+/** Copy a string value into a slot, fails if it does not fit */
+bool copySlot(char *slot, size_t size, const char *value, size_t valueLength) {
+	if (valueLength >= size || memchr(value, 0, valueLength) != NULL) {
+		return false;
+	}
+	memcpy(slot, value, valueLength);
+	slot[valueLength] = 0;
+	return true;
+}
+
+/** Compare a key token to a zero terminated name */
+bool keyIs(const char *key, size_t keyLength, const char *name) {
+	return strlen(name) == keyLength && !memcmp(key, name, keyLength);
+}
+
+}
+
+CredCommand parseCredentials(char *json, size_t length, WiFiCredentials &credentials) {
+	Cursor cursor = { json, json + length };
+	WiFiCredentials received;
+	unsigned fields = 0;
+
+	skipSpace(cursor);
+	if (cursor.pos >= cursor.end || *cursor.pos++ != '{') {
+		return CRED_INVALID;
+	}
+	skipSpace(cursor);
+	if (cursor.pos < cursor.end && *cursor.pos == '}') {
+		cursor.pos++;
+	} else {
+		while (true) {
+			char *key;
+			size_t keyLength;
+			skipSpace(cursor);
+			if (!parseString(cursor, key, keyLength)) {
+				return CRED_INVALID;
+			}
+			skipSpace(cursor);
+			if (cursor.pos >= cursor.end || *cursor.pos++ != ':') {
+				return CRED_INVALID;
+			}
+			skipSpace(cursor);
+			if (cursor.pos >= cursor.end) {
+				return CRED_INVALID;
+			}
+
+			if (*cursor.pos == '"') {
+				char *value;
+				size_t valueLength;
+				if (!parseString(cursor, value, valueLength)) {
+					return CRED_INVALID;
+				}
+				struct { const char *name; char *slot; size_t size; unsigned field; } slots[] = {
+					{ "ssidPrim", received.ssidPrim, sizeof(received.ssidPrim), FIELD_SSID_PRIM },
+					{ "pwPrim", received.pwPrim, sizeof(received.pwPrim), FIELD_PW_PRIM },
+					{ "ssidSec", received.ssidSec, sizeof(received.ssidSec), FIELD_SSID_SEC },
+					{ "pwSec", received.pwSec, sizeof(received.pwSec), FIELD_PW_SEC }
+				};
+				for (size_t index = 0; index < sizeof(slots) / sizeof(slots[0]); index++) {
+					if (keyIs(key, keyLength, slots[index].name)) {
+						if (!copySlot(slots[index].slot, slots[index].size, value, valueLength)) {
+							return CRED_INVALID;
+						}
+						fields |= slots[index].field;
+					}
+				}
+			} else if (!skipPrimitive(cursor)) {
+				// Nested objects and arrays are not part of the protocol
+				return CRED_INVALID;
+			}
+			if (keyIs(key, keyLength, "erase")) fields |= FIELD_ERASE;
+			if (keyIs(key, keyLength, "reset")) fields |= FIELD_RESET;
+
+			skipSpace(cursor);
+			if (cursor.pos >= cursor.end) {
+				return CRED_INVALID;
+			}
+			char c = *cursor.pos++;
+			if (c == '}') {
+				break;
+			}
+			if (c != ',') {
+				return CRED_INVALID;
+			}
+		}
+	}
+
+	// Only whitespace or zero padding may follow the object
+	while (cursor.pos < cursor.end) {
+		char c = *cursor.pos++;
+		if (c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != 0) {
+			return CRED_INVALID;
+		}
+	}
+
+	if ((fields & FIELD_ALL_CREDENTIALS) == FIELD_ALL_CREDENTIALS) {
+		credentials = received;
+		return CRED_SET;
+	}
+	if (fields & FIELD_ERASE) {
+		return CRED_ERASE;
+	}
+	if (fields & FIELD_RESET) {
+		return CRED_RESET;
+	}
+	return CRED_NONE;
+}
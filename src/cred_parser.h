@@ -0,0 +1,47 @@
+/**
+ * Allocation-free parser for credential writes
+ *
+ * Parses the flat JSON object written to the WiFi characteristic, e.g.
+ * {"ssidPrim":"","pwPrim":"","ssidSec":"","pwSec":""}, {"erase":true}
+ * or {"reset":true}. Strings are unescaped in place inside the received
+ * buffer and copied once into fixed-size credential slots.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef CRED_PARSER_H
+#define CRED_PARSER_H
+
+#include <stddef.h>
+
+#include "credentials.h"
+
+/** Command carried by a credential write */
+enum CredCommand {
+	/** Not a JSON object, or a value does not fit its slot */
+	CRED_INVALID = 0,
+	/** Valid object without a known command */
+	CRED_NONE,
+	/** All four credential fields, stored in the output slots */
+	CRED_SET,
+	/** Erase stored credentials */
+	CRED_ERASE,
+	/** Restart the device */
+	CRED_RESET,
+	/** Add or update one network of the table, binary frames only */
+	CRED_ADD_NETWORK,
+	/** Remove one network of the table, binary frames only */
+	CRED_REMOVE_NETWORK
+};
+
+/**
+ * Parse a decoded credential write
+ * The buffer is modified, strings are unescaped in place.
+ * @param json - decoded payload, need not be zero terminated
+ * @param length - payload length in bytes
+ * @param credentials - receives the fields if CRED_SET is returned, untouched otherwise
+ * @return CredCommand - command found in the payload
+ */
+CredCommand parseCredentials(char *json, size_t length, WiFiCredentials &credentials);
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * Fixed-size WiFi credential slots
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+/** SSID buffer size, 32 characters + zero terminator */
+#define CRED_SSID_SIZE 33
+/** Password buffer size, 64 characters + zero terminator */
+#define CRED_PW_SIZE 65
+
+/** Credentials of the primary and secondary network, zero terminated */
+struct WiFiCredentials {
+	char ssidPrim[CRED_SSID_SIZE];
+	char pwPrim[CRED_PW_SIZE];
+	char ssidSec[CRED_SSID_SIZE];
+	char pwSec[CRED_PW_SIZE];
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Packed diagnostics record
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "diag_record.h"
+
+namespace {
+
+void putUint16(uint8_t *out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+void putUint32(uint8_t *out, uint32_t value) {
+	out[0] = value & 0xFF;
+	out[1] = (value >> 8) & 0xFF;
+	out[2] = (value >> 16) & 0xFF;
+	out[3] = value >> 24;
+}
+
+uint16_t getUint16(const uint8_t *in) {
+	return in[0] | (in[1] << 8);
+}
+
+uint32_t getUint32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+}
+
+size_t encodeDiagRecord(const DiagRecord &record, uint8_t *out, size_t size) {
+	size_t length = DIAG_RECORD_HEADER_SIZE + 2 * record.taskCount;
+	if (record.taskCount > DIAG_MAX_TASKS || size < length) {
+		return 0;
+	}
+	out[0] = DIAG_RECORD_VERSION;
+	out[1] = record.fragmentation;
+	putUint32(out + 2, record.freeHeap);
+	putUint32(out + 6, record.minFreeHeap);
+	putUint32(out + 10, record.largestBlock);
+	putUint16(out + 14, record.bleConnects);
+	putUint16(out + 16, record.bleDisconnects);
+	putUint16(out + 18, record.bleWrites);
+	putUint16(out + 20, record.bleReads);
+	putUint16(out + 22, record.wifiScans);
+	putUint16(out + 24, record.wifiGotIP);
+	putUint16(out + 26, record.wifiDisconnects);
+	putUint16(out + 28, record.logDropped);
+	out[30] = record.taskCount;
+	for (uint8_t task = 0; task < record.taskCount; task++) {
+		putUint16(out + DIAG_RECORD_HEADER_SIZE + 2 * task, record.stackFree[task]);
+	}
+	return length;
+}
+
+bool decodeDiagRecord(const uint8_t *in, size_t length, DiagRecord &record) {
+	if (length < DIAG_RECORD_HEADER_SIZE || in[0] < 1) {
+		return false;
+	}
+	uint8_t taskCount = in[30];
+	if (taskCount > DIAG_MAX_TASKS || length < DIAG_RECORD_HEADER_SIZE + 2 * (size_t) taskCount) {
+		return false;
+	}
+	record.fragmentation = in[1];
+	record.freeHeap = getUint32(in + 2);
+	record.minFreeHeap = getUint32(in + 6);
+	record.largestBlock = getUint32(in + 10);
+	record.bleConnects = getUint16(in + 14);
+	record.bleDisconnects = getUint16(in + 16);
+	record.bleWrites = getUint16(in + 18);
+	record.bleReads = getUint16(in + 20);
+	record.wifiScans = getUint16(in + 22);
+	record.wifiGotIP = getUint16(in + 24);
+	record.wifiDisconnects = getUint16(in + 26);
+	record.logDropped = getUint16(in + 28);
+	record.taskCount = taskCount;
+	for (uint8_t task = 0; task < taskCount; task++) {
+		record.stackFree[task] = getUint16(in + DIAG_RECORD_HEADER_SIZE + 2 * task);
+	}
+	return true;
+}
@@ -0,0 +1,75 @@
+/**
+ * Packed diagnostics record
+ *
+ * Served on the diagnostics characteristic, read only. Tells how much
+ * stack and heap the firmware has left and how busy the radios were, so
+ * stack sizes can be tuned and fragmentation seen before a device fails.
+ * All multi byte fields are little endian, counters wrap:
+ *
+ *   offset  size  field
+ *   0       1     version (DIAG_RECORD_VERSION)
+ *   1       1     heap fragmentation in percent
+ *   2       4     free heap in bytes
+ *   6       4     lowest free heap since boot in bytes
+ *   10      4     largest free heap block in bytes
+ *   14      2     BLE connects
+ *   16      2     BLE disconnects
+ *   18      2     BLE writes
+ *   20      2     BLE reads
+ *   22      2     WiFi scans done
+ *   24      2     WiFi IP addresses received
+ *   26      2     WiFi disconnects
+ *   28      2     log lines dropped
+ *   30      1     number of tasks n
+ *   31      2*n   stack high water mark of each task in bytes, 0xFFFF if not running
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef DIAG_RECORD_H
+#define DIAG_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Layout version, bumped when fields are added */
+#define DIAG_RECORD_VERSION 1
+/** Most tasks a record holds */
+#define DIAG_MAX_TASKS 8
+/** Size without the task list */
+#define DIAG_RECORD_HEADER_SIZE 31
+#define DIAG_RECORD_MAX_SIZE (DIAG_RECORD_HEADER_SIZE + 2 * DIAG_MAX_TASKS)
+/** Stack high water mark of a task that is not running */
+#define DIAG_NO_TASK 0xFFFF
+
+/** Decoded diagnostics record */
+struct DiagRecord {
+	uint8_t fragmentation;
+	uint32_t freeHeap;
+	uint32_t minFreeHeap;
+	uint32_t largestBlock;
+	uint16_t bleConnects;
+	uint16_t bleDisconnects;
+	uint16_t bleWrites;
+	uint16_t bleReads;
+	uint16_t wifiScans;
+	uint16_t wifiGotIP;
+	uint16_t wifiDisconnects;
+	uint16_t logDropped;
+	uint8_t taskCount;
+	uint16_t stackFree[DIAG_MAX_TASKS];
+};
+
+/**
+ * Encode a diagnostics record
+ * @return size_t - encoded length, 0 if out is too small or taskCount is out of range
+ */
+size_t encodeDiagRecord(const DiagRecord &record, uint8_t *out, size_t size);
+
+/**
+ * Decode a diagnostics record, newer versions with more fields are accepted
+ * @return bool - false if the buffer is too short or the version is unknown
+ */
+bool decodeDiagRecord(const uint8_t *in, size_t length, DiagRecord &record);
+
+#endif
@@ -4,7 +4,7 @@
  * Used to configure WiFi credentials over Bluetooth LE on a ESP32 WROOM.
  * 
  * Requirements:
- * ArduinoJson v.5 (checked with 5.13.4)
+ * No libraries besides the esp32-arduino core
  * Confirmed working envioronments:
  * - Arduino 1.8.11 & esp32-arduino 1.0.4
  * - PlatformIO Home 3.1.0, Core 4.2.1, Espressif 32 1.11.2
@@ -15,7 +15,7 @@
  * 
  * Additions made by Uri Shani (UriShX), 02/2020: 
  * 1. Additional characteristic for getting SSID list over BLE (read only)
- * 2. Additional characteristic for serving connection status as notifications, every 1 second
+ * 2. Additional characteristic for serving connection status as notifications, sent on every change and every 10 seconds
  * 
  * Published under the MIT license, see LICENSE.md
  */
@@ -23,14 +23,10 @@
 // Default Arduino includes
 #include <Arduino.h>
 #include <WiFi.h>
+#include <esp_wifi.h>
 #include <nvs.h>
 #include <nvs_flash.h>
-
-// Includes for JSON object handling
-// Requires ArduinoJson library, ver.<6 (latest checked: 5.13.4)
-// https://arduinojson.org
-// https://github.com/bblanchon/ArduinoJson
-#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
 
 // Includes for BLE
 #include <BLEUtils.h>
@@ -43,37 +39,156 @@
 // Flash storage of variables (instead of EEPROM)
 #include <Preferences.h>
 
+// Double-buffered WiFi scan results
+#include "scan_cache.h"
+// Dwell time, channels and early termination of scans
+#include "scan_policy.h"
+// Channel by channel scan without dropping the connection
+#include "wifi_scan.h"
+// Encoding of the BLE payloads
+#include "ble_codec.h"
+// Candidate networks
+#include "network_table.h"
+// Stored records
+#include "nvs_record.h"
+// Extended connection status
+#include "status_record.h"
+#include "status_snapshot.h"
+// Connected BLE clients
+#include "client_table.h"
+// Status notifications on change and heartbeat
+#include "notify_schedule.h"
+// Connection state machine
+#include "conn_manager.h"
+// Logging without blocking the callers
+#include "app_log.h"
+// Stack, heap and event counters
+#include "diag_record.h"
+// One handler per WiFi event
+#include "wifi_events.h"
+// Credential writes and reads, over the platform interfaces of hal.h
+#include "provisioning.h"
+// List of Service and Characteristic UUIDs
+#include "ble_uuids.h"
+// Provisioning latency trace, built with -DAPP_TRACE=1
+#include "trace.h"
+
 /** freeRTOS task handle */
 TaskHandle_t sendBLEdataTask;
-/** freeRTOS mutex handle */
-SemaphoreHandle_t connStatSemaphore;
+/** freeRTOS task handle for background WiFi scans */
+TaskHandle_t wifiScanTask;
+/** freeRTOS task handle of the connection manager */
+TaskHandle_t manageConnectionTask;
+/** freeRTOS task handle of the log writer */
+TaskHandle_t logTask;
+/** Lowest priority above idle, lines are written out when nothing else runs */
+#define LOG_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+/** Time in ms the log task sleeps if it is not woken */
+#define LOG_DRAIN_PERIOD 500
+/**
+ * Stack sizes in bytes of the log and notification tasks, both format text
+ * with newlib's vsnprintf, which takes over 1 KB of stack on its own. The
+ * diagnostics characteristic reports what is left of them.
+ */
+#define LOG_TASK_STACK 3072
+#define STATUS_TASK_STACK 4096
+/** Events for the connection manager, see postConnEvent() */
+QueueHandle_t connEventQueue;
+/** Given by scanDone() when the WiFi library finished a scan */
+SemaphoreHandle_t scanDoneSemaphore;
+/** Handlers and counts of the WiFi events, fed by wifiEvent() */
+EventDispatcher<system_event_info_t> wifiEvents;
+static_assert(SYSTEM_EVENT_MAX <= WIFI_EVENT_SLOTS, "WiFi events without a slot");
+/** Serializes writers of connStatus, readers never take it */
+portMUX_TYPE statusMux = portMUX_INITIALIZER_UNLOCKED;
+/** freeRTOS mutex handle for bleClients */
+SemaphoreHandle_t clientsSemaphore;
 
 /** Build time */
 const char compileDate[] = __DATE__ " " __TIME__;
 
 /** Unique device name */
 char apName[] = "ESP32-xxxxxxxxxxxx";
-/** Selected network 
-    true = use primary network
-	false = use secondary network
-*/
-bool usePrimAP = true;
+/** Codec for BLE payloads, keyed with apName */
+BleCodec bleCodec;
+/** Slot in networks of the network to connect to, NETWORK_NONE if none */
+uint8_t selectedNetwork = NETWORK_NONE;
 /** Flag if stored AP credentials are available */
 bool hasCredentials = false;
-/** Number of found SSIDs */
-int apNum = 0;
-/** Time of last SSID scan */
-unsigned long apScanTime;
-/** Connection status */
-volatile bool isConnected = false;
-/** Connection change status */
-bool connStatusChanged = false;
-/** BLE connection status */
+/** Results of the last completed WiFi scan */
+ScanCache scanCache;
+/** Copy of scanCache selectNetwork() works on, only used by the connection manager task */
+ScanSnapshot selectScan;
+/** Time in ms added to the expected duration of a scan before giving up on it */
+#define SCAN_MARGIN 2000
+/** Policy of the pending scan request, NULL if none */
+const ScanPolicy * volatile requestedScanPolicy = NULL;
+/** The connection manager waits for the next completed scan */
+std::atomic<bool> connScanPending(false);
+#if APP_TRACE
+/** Set when a connection was notified, the log task then writes out the trace */
+std::atomic<bool> traceDumpPending(false);
+void wakeLogTask();
+#endif
+/** AP of the last successful association, persisted next to the credentials */
+struct LastAP {
+	bool valid;
+	/** Slot in networks of the network the AP belongs to */
+	uint8_t network;
+	uint8_t bssid[6];
+	uint8_t channel;
+	/** wifi_auth_mode_t reported by the AP */
+	uint8_t authMode;
+} lastAP;
+/** Connection attempt in progress, for boot/reconnect to IP timing */
+bool connectInProgress = true;
+/** millis() when the current connection attempt started, 0 at boot */
+unsigned long connectStartTime = 0;
+/** millis() when the last IP address was received */
+volatile unsigned long gotIPTime = 0;
+/** Connection status, set by the WiFi event handlers */
+std::atomic<bool> isConnected(false);
+/** connectWiFi() dropped the link to switch networks, the next leave event is not a loss */
+std::atomic<bool> expectedDisconnect(false);
+/** An IP was received at least once since boot, later ones count as reconnects */
+bool hasConnected = false;
+/** BLE connection status, true if at least one client is connected */
 volatile bool deviceConnected = false;
-/** int representation of connected to primary ssid (1), secondary (2), or disconnected (0) */
-uint16_t sendVal = 0x0000;
+/** Connected BLE clients, guarded by clientsSemaphore */
+ClientTable bleClients;
+/** Advertising is running, only changed from the BLE event handlers */
+bool advertising = false;
+/** The library called onWrite of the WiFi characteristic, bleGattsEvent handles the write */
+bool credentialsWritten = false;
+/** Connection of the last credential write */
+uint16_t credentialsConnId = 0;
+/**
+ * Connection status, readable from any task without blocking
+ * profile is the slot of the connected network + 1, 0 if disconnected, see legacyStatusValue()
+ */
+Snapshot<StatusRecord> connStatus;
+/** Interval in ms of status notifications without a change, 0 to only notify on changes */
+#define STATUS_HEARTBEAT 10000
+/** micros() of the last status change, for change-to-notify latency */
+volatile unsigned long statusChangeTime = 0;
 /** WiFi authentication mode types for enum parsing, based on esp_wifi_types.h */
-const String authModes[] = {"open", "WEP", "WPA_PSK", "WPA2_PSK", "WPA_WPA2_PSK", "WPA2_ENTERPRISE", "MAX"};
+const char * const authModes[] = {"open", "WEP", "WPA_PSK", "WPA2_PSK", "WPA_WPA2_PSK", "WPA2_ENTERPRISE", "MAX"};
+/** Heap state, see readHeapStats() */
+struct HeapStats {
+	uint32_t freeBytes;
+	uint32_t largestBlock;
+	/** Lowest free heap since boot */
+	uint32_t minFree;
+	/** Percentage of the free heap outside the largest free block */
+	uint8_t fragmentation;
+};
+/** Number of BLE requests, only written by bleGattsEvent() */
+struct BleCounters {
+	uint32_t connects;
+	uint32_t disconnects;
+	uint32_t writes;
+	uint32_t reads;
+} bleCounters;
 
 /**
  * Create unique device name from MAC address
@@ -84,22 +199,16 @@ void createName() {
 	esp_read_mac(baseMac, ESP_MAC_WIFI_STA);
 	// Write unique name into apName
 	sprintf(apName, "ESP32-%02X%02X%02X%02X%02X%02X", baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5]);
+	// Derive the payload keystream from the name once
+	codecInit(bleCodec, apName);
 }
 
-// List of Service and Characteristic UUIDs
-// service & wifi uuid are what's used in the original sketch, to maintain compatibility
-// list & status uuid were randomly generated using https://www.uuidgenerator.net/
-#define SERVICE_UUID  "0000aaaa-ead2-11e7-80c1-9a214cf093ae"
-#define WIFI_UUID     "00005555-ead2-11e7-80c1-9a214cf093ae"
-#define WIFI_LIST_UUID "1d338124-7ddc-449e-afc7-67f8673a1160"
-#define WIFI_STATUS_UUID "5b3595c4-ad4f-4e1e-954e-3b290cc02eb0"
-
-/** SSIDs of local WiFi networks */
-String ssidPrim;
-String ssidSec;
-/** Password for local WiFi network */
-String pwPrim;
-String pwSec;
+/** SSIDs and passwords of local WiFi networks */
+NetworkTable networks;
+/** Version of the lastAP record */
+#define LAST_AP_RECORD_VERSION 1
+/** bssid, channel, auth mode and network */
+#define LAST_AP_RECORD_SIZE 9
 
 /** Characteristic for digital output */
 BLECharacteristic *pCharacteristicWiFi;
@@ -107,6 +216,14 @@ BLECharacteristic *pCharacteristicWiFi;
 BLECharacteristic *pCharacteristicList;
 /** Characteristic for connection status */
 BLECharacteristic *pCharacteristicStatus;
+/** Notification descriptor of pCharacteristicStatus */
+BLE2902 *pStatusDescriptor;
+/** Characteristic for extended connection status */
+BLECharacteristic *pCharacteristicStatusExt;
+/** Notification descriptor of pCharacteristicStatusExt */
+BLE2902 *pStatusExtDescriptor;
+/** Characteristic for diagnostics */
+BLECharacteristic *pCharacteristicDiag;
 /** BLE Advertiser */
 BLEAdvertising* pAdvertising;
 /** BLE Service */
@@ -114,304 +231,754 @@ BLEService *pService;
 /** BLE Server */
 BLEServer *pServer;
 
-/** Buffer for JSON string */
-// MAx size is 51 bytes for frame: 
-// {"ssidPrim":"","pwPrim":"","ssidSec":"","pwSec":""}
-// + 4 x 32 bytes for 2 SSID's and 2 passwords
-StaticJsonBuffer<200> jsonBuffer;
-// {"SSID":["","","","","","","","","",""]} + 10 x 32 bytes for 10 SSIDs, and some spare
-StaticJsonBuffer<500> ssidBuffer;
+/**
+ * PreferencesStore
+ * KeyValueStore over one Preferences namespace, opened once in setup()
+ */
+class PreferencesStore: public KeyValueStore {
+public:
+	void begin(const char *name) {
+		preferences.begin(name, false);
+	}
+
+	size_t getBytes(const char *key, void *buffer, size_t size) {
+		return preferences.getBytes(key, buffer, size);
+	}
+
+	size_t putBytes(const char *key, const void *value, size_t length) {
+		return preferences.putBytes(key, value, length);
+	}
+
+	void getString(const char *key, char *buffer, size_t size) {
+		if (preferences.getString(key, buffer, size) == 0 && size > 0) {
+			buffer[0] = 0;
+		}
+	}
+
+	bool getBool(const char *key, bool defaultValue) {
+		return preferences.getBool(key, defaultValue);
+	}
+
+	bool remove(const char *key) {
+		return preferences.remove(key);
+	}
+
+	bool clear() {
+		return preferences.clear();
+	}
+
+	/** Close the namespace, e.g. before the NVS partition is erased */
+	void end() {
+		preferences.end();
+	}
+
+private:
+	Preferences preferences;
+};
+
+/**
+ * FreeRtosLock
+ * Lock over a FreeRTOS mutex, created in setup()
+ */
+class FreeRtosLock: public Lock {
+public:
+	bool begin() {
+		mutex = xSemaphoreCreateMutex();
+		return mutex != NULL;
+	}
+
+	void lock() {
+		xSemaphoreTake(mutex, portMAX_DELAY);
+	}
+
+	void unlock() {
+		xSemaphoreGive(mutex);
+	}
+
+private:
+	SemaphoreHandle_t mutex;
+};
+
+/**
+ * CharacteristicValue
+ * GattValue of a BLE characteristic
+ */
+class CharacteristicValue: public GattValue {
+public:
+	explicit CharacteristicValue(BLECharacteristic *characteristic) : characteristic(characteristic) {}
+
+	void setValue(const uint8_t *data, size_t length) {
+		characteristic->setValue((uint8_t *)data, length);
+	}
+
+private:
+	BLECharacteristic *characteristic;
+};
+
+/** "WiFiCred" namespace, holds the networks and lastAP records */
+PreferencesStore credentialStore;
+/** Guards changes to networks, and credentialStore once the tasks run */
+FreeRtosLock networksLock;
+
+/**
+ * EspScanRadio
+ * Scans through the WiFi library, runs in the scan task
+ */
+class EspScanRadio: public ScanRadio {
+	/**
+	 * Starts the scan and waits for scanDone(), which is called once the WiFi
+	 * library has fetched the results.
+	 */
+	int scanChannel(const ScanPolicy &policy, uint8_t channel) {
+		wifi_scan_config_t config;
+		memset(&config, 0, sizeof(config));
+		config.channel = channel;
+		config.show_hidden = true;
+		config.scan_type = policy.passive ? WIFI_SCAN_TYPE_PASSIVE : WIFI_SCAN_TYPE_ACTIVE;
+		config.scan_time.active.min = policy.dwellMs / 2;
+		config.scan_time.active.max = policy.dwellMs;
+		config.scan_time.passive = policy.dwellMs;
+
+		// A single channel takes one dwell time
+		ScanPolicy visited = policy;
+		if (channel) {
+			visited.channelMask = SCAN_CHANNEL(channel);
+		}
+
+		// Drop a completion of an earlier scan that timed out
+		xSemaphoreTake(scanDoneSemaphore, 0);
+		WiFi.scanDelete();
+		if (esp_wifi_scan_start(&config, false) != ESP_OK) {
+			return -1;
+		}
+		if (xSemaphoreTake(scanDoneSemaphore, pdMS_TO_TICKS(scanPolicyDuration(visited) + SCAN_MARGIN)) != pdTRUE) {
+			esp_wifi_scan_stop();
+			return -1;
+		}
+		return WiFi.scanComplete();
+	}
+
+	/** Copy the results held by the WiFi library into a snapshot and free them */
+	void copyResults(ScanSnapshot &result, int apNum) {
+		for (int index = 0; index < apNum && result.count < SCAN_CACHE_MAX_AP; index++) {
+			// WiFi.SSID(index) would build a String, the BSSID is the first field of the
+			// record the library holds, so the record is read from there instead
+			const wifi_ap_record_t *record = (const wifi_ap_record_t *)WiFi.BSSID(index);
+			if (record == NULL) {
+				break;
+			}
+			ScanRecord& ap = result.aps[result.count++];
+			strlcpy(ap.ssid, (const char *)record->ssid, sizeof(ap.ssid));
+			ap.rssi = record->rssi;
+			ap.channel = record->primary;
+			ap.authMode = record->authmode;
+			memcpy(ap.bssid, record->bssid, sizeof(ap.bssid));
+		}
+		// Results are copied, free the memory held by the WiFi library
+		WiFi.scanDelete();
+	}
+
+	bool knownNetworksFound(const ScanSnapshot &result) {
+		if (!hasCredentials) {
+			return false;
+		}
+		LockGuard guard(networksLock);
+		return networks.allFound(result.aps, result.count);
+	}
+};
+
+EspScanRadio scanRadio;
 
 /** WiFi SSIDs scan 
- * Separated from ScanWiFi(), so could be used independetley
- * @return int - number of found access points
+ * Runs only in the scan task, other tasks use requestWiFiScan().
+ * Scans in station mode without dropping an existing connection, the station
+ * keeps its association and IP while the radio visits the other channels,
+ * see runScan().
+ * Copies the results into the back buffer of scanCache and publishes it.
+ * @param policy - how to scan
+ * @return int - number of found access points, -1 if the scan could not run
  */
-int actualWiFiScan() {
-	Serial.println("Start scanning for networks");
+int actualWiFiScan(const ScanPolicy &policy) {
+	LOG_INFO("Start scanning for networks, %s %dms on %d channels",
+		policy.passive ? "passive" : "active", policy.dwellMs, scanPolicyChannels(policy));
+	TRACE(TRACE_SCAN_START, scanPolicyChannels(policy));
 
-	WiFi.disconnect(true);
+	// Both are no-ops if the station is already up
 	WiFi.enableSTA(true);
 	WiFi.mode(WIFI_STA);
 
-	// Scan for AP
-	apScanTime = millis();
-	int _apNum = WiFi.scanNetworks(false,true,false,1000);
-	if (_apNum == 0) {
-		Serial.println("Found no networks?????");
-		return false;
+	int found = runScan(policy, scanRadio, scanCache.back());
+	if (found < 0) {
+		TRACE(TRACE_SCAN_END, -1);
+		return -1;
 	}
-	
-	return _apNum;
+	if (found == 0) {
+		LOG_WARN("Found no networks?????");
+	}
+	scanCache.publish(millis());
+	TRACE(TRACE_SCAN_END, found);
+
+	return found;
+}
+
+/** Callback for a finished scan, the WiFi library has already fetched the results */
+void scanDone(uint16_t event, const system_event_info_t &info) {
+	xSemaphoreGive(scanDoneSemaphore);
 }
 
 /**
-	 scanWiFi
-	 Scans for available networks 
-	 and decides if a switch between
-	 allowed networks makes sense
+ * Queue an event for the connection manager, never blocks
+ * @param type - ConnEventType
+ * @param arg - event specific, the disconnect reason for CM_EVT_LOST
+ */
+void postConnEvent(uint8_t type, uint8_t arg = 0) {
+	ConnEvent event = { type, arg };
+	if (xQueueSend(connEventQueue, &event, 0) != pdTRUE) {
+		LOG_ERROR("Connection event %d dropped", type);
+	}
+}
+
+/** WiFi scan task
+ * works independently from the connection manager and the BLE callbacks, in a separate freeRTOS task.
+ * waits for a scan request, runs the (blocking) scan and publishes the results to scanCache,
+ * then tells the connection manager if it is waiting for a scan.
+ */
+void wifiScan(void * parameter) {
+	while(1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		const ScanPolicy *policy = requestedScanPolicy;
+		requestedScanPolicy = NULL;
+		actualWiFiScan(policy != NULL ? *policy : listScanPolicy);
+		if (connScanPending.exchange(false)) {
+			postConnEvent(CM_EVT_SCAN_DONE);
+		}
+	}
+}
+
+/** Ask the scan task for a new scan, returns immediately
+ * If several requests are pending, a policy that scans every channel wins
+ * over one that may stop early, so a SSID list read always gets a full list.
+ * @param policy - how to scan, must outlive the scan
+ */
+void requestWiFiScan(const ScanPolicy &policy) {
+	const ScanPolicy *pending = requestedScanPolicy;
+	if (pending == NULL || !policy.stopWhenKnownFound) {
+		requestedScanPolicy = &policy;
+	}
+	xTaskNotifyGive(wifiScanTask);
+}
+
+/** Read the AP of the last successful association from credentialStore */
+void loadLastAP() {
+	uint8_t record[NVS_RECORD_HEADER_SIZE + LAST_AP_RECORD_SIZE];
+	size_t length = credentialStore.getBytes("lastAP", record, sizeof(record));
+	const uint8_t *payload = nvsRecordOpen(record, length, LAST_AP_RECORD_VERSION, length);
+	lastAP.valid = payload != NULL && length == LAST_AP_RECORD_SIZE;
+	if (!lastAP.valid) {
+		return;
+	}
+	memcpy(lastAP.bssid, payload, sizeof(lastAP.bssid));
+	lastAP.channel = payload[6];
+	lastAP.authMode = payload[7];
+	lastAP.network = payload[8];
+	LockGuard guard(networksLock);
+	if (lastAP.channel == 0 || networks.get(lastAP.network) == NULL) {
+		lastAP.valid = false;
+	}
+}
+
+/**
+ * Store the AP the station is associated with, if it differs from lastAP
+ * Called by the connection manager after an IP was received.
+ */
+void saveLastAP() {
+	wifi_ap_record_t apInfo;
+	if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) {
+		return;
+	}
+	if (lastAP.valid
+			&& lastAP.network == selectedNetwork
+			&& lastAP.channel == apInfo.primary
+			&& lastAP.authMode == apInfo.authmode
+			&& !memcmp(lastAP.bssid, apInfo.bssid, sizeof(lastAP.bssid))) {
+		return;
+	}
+
+	lastAP.valid = true;
+	lastAP.network = selectedNetwork;
+	lastAP.channel = apInfo.primary;
+	lastAP.authMode = apInfo.authmode;
+	memcpy(lastAP.bssid, apInfo.bssid, sizeof(lastAP.bssid));
+
+	uint8_t record[NVS_RECORD_HEADER_SIZE + LAST_AP_RECORD_SIZE];
+	uint8_t *payload = record + NVS_RECORD_HEADER_SIZE;
+	memcpy(payload, lastAP.bssid, sizeof(lastAP.bssid));
+	payload[6] = lastAP.channel;
+	payload[7] = lastAP.authMode;
+	payload[8] = lastAP.network;
+
+	{
+		LockGuard guard(networksLock);
+		credentialStore.putBytes("lastAP", record, nvsRecordSeal(record, LAST_AP_RECORD_VERSION, LAST_AP_RECORD_SIZE));
+	}
+	LOG_INFO("Cached AP %02X:%02X:%02X:%02X:%02X:%02X on channel %d",
+		lastAP.bssid[0], lastAP.bssid[1], lastAP.bssid[2], lastAP.bssid[3], lastAP.bssid[4], lastAP.bssid[5], lastAP.channel);
+}
+
+/** Forget the cached AP, e.g. when new credentials were received */
+void clearLastAP() {
+	lastAP.valid = false;
+	LockGuard guard(networksLock);
+	credentialStore.remove("lastAP");
+}
+
+/**
+	 selectNetwork
+	 Checks the last scan for available networks 
+	 and picks the configured one with the best score,
+	 see NetworkTable::select()
 
 	 @return <code>bool</code>
 	        True if at least one allowed network was found
 */
-bool scanWiFi() {
-	/** RSSI for primary network */
-	int8_t rssiPrim;
-	/** RSSI for secondary network */
-	int8_t rssiSec;
-	/** Result of this function */
-	bool result = false;
-	
-	apNum = actualWiFiScan();
-
-	byte foundAP = 0;
-	bool foundPrim = false;
-
-	for (int index=0; index<apNum; index++) {
-		String ssid = WiFi.SSID(index);
-		Serial.println("Found AP: " + ssid + " RSSI: " + WiFi.RSSI(index) + " Encrytion: " + authModes[WiFi.encryptionType(index)]);
-		if (!strcmp((const char*) &ssid[0], (const char*) &ssidPrim[0])) {
-			Serial.println("Found primary AP");
-			foundAP++;
-			foundPrim = true;
-			rssiPrim = WiFi.RSSI(index);
-		}
-		if (!strcmp((const char*) &ssid[0], (const char*) &ssidSec[0])) {
-			Serial.println("Found secondary AP");
-			foundAP++;
-			rssiSec = WiFi.RSSI(index);
-		}
+bool selectNetwork() {
+	scanCache.read(selectScan);
+	const ScanSnapshot& scan = selectScan;
+	if (scan.generation == 0 || millis() - scan.scanTime > SCAN_MAX_AGE) {
+		LOG_WARN("WiFi scan failed or timed out");
+		return false;
+	}
+
+	for (int index=0; index<scan.count; index++) {
+		const ScanRecord& ap = scan.aps[index];
+		LOG_DEBUG("Found AP: %s RSSI: %d Encrytion: %s", ap.ssid, ap.rssi, authModes[ap.authMode < WIFI_AUTH_MAX ? ap.authMode : WIFI_AUTH_MAX]);
+	}
+
+	uint8_t bestAp;
+	networksLock.lock();
+	uint8_t network = networks.select(scan.aps, scan.count, &bestAp);
+	networksLock.unlock();
+	if (network == NETWORK_NONE) {
+		return false;
+	}
+	LOG_INFO("Selected network %d: %s RSSI: %d", network, scan.aps[bestAp].ssid, scan.aps[bestAp].rssi);
+	selectedNetwork = network;
+	return true;
+}
+
+/**
+ * Encode the extended status with the current uptime and signal strength
+ * @param record - status read from connStatus
+ * @param out - buffer of at least STATUS_RECORD_SIZE bytes
+ * @return size_t - encoded length
+ */
+size_t buildStatusRecord(StatusRecord record, uint8_t *out) {
+	record.uptime = millis() / 1000;
+	if (record.state == CONN_STATE_CONNECTED) {
+		record.rssi = WiFi.RSSI();
+	}
+	return encodeStatusRecord(record, out, STATUS_RECORD_SIZE);
+}
+
+/**
+ * Set the connection state of the extended status
+ * @param state - ConnState
+ */
+void setConnState(uint8_t state) {
+	portENTER_CRITICAL(&statusMux);
+	StatusRecord status = connStatus.read();
+	status.state = state;
+	connStatus.write(status);
+	portEXIT_CRITICAL(&statusMux);
+}
+
+/** Wake up the notification task
+ * @param reason - STATUS_CHANGED or STATUS_SUBSCRIBED
+ */
+void notifyStatusTask(uint32_t reason);
+
+/** Handle the value written to the WiFi characteristic by a connection */
+void writeCredentials(uint16_t connId);
+
+/**
+ * Keep advertising while there is room for another client
+ * The controller stops advertising when a client connects.
+ */
+void updateAdvertising() {
+	switch (advertisingChange(bleClients, advertising)) {
+		case ADVERTISING_START:
+			pAdvertising->start();
+			advertising = true;
+			break;
+		case ADVERTISING_STOP:
+			pAdvertising->stop();
+			advertising = false;
+			break;
+		case ADVERTISING_KEEP:
+			break;
 	}
+}
 
-	switch (foundAP) {
-		case 0:
-			result = false;
+/**
+ * bleGattsEvent
+ * Tracks client connections, disconnections, MTU and subscriptions per connection id.
+ * Registered as custom GATTS handler, as BLEServerCallbacks::onDisconnect does not
+ * tell which client disconnected. Runs in the BLE task after the library has handled
+ * the event.
+ */
+void bleGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
+	switch (event) {
+		case ESP_GATTS_CONNECT_EVT: {
+			bleCounters.connects++;
+			TRACE(TRACE_BLE_CONNECT, param->connect.conn_id);
+			xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+			bool added = bleClients.add(param->connect.conn_id, param->connect.remote_bda) != NULL;
+			deviceConnected = true;
+			// The controller stopped advertising for this connection
+			advertising = false;
+			updateAdvertising();
+			xSemaphoreGive(clientsSemaphore);
+			LOG_INFO("BLE client %d connected, %d of %d", param->connect.conn_id, bleClients.count(), MAX_BLE_CLIENTS);
+			if (!added) {
+				LOG_WARN("No free client slot, dropping connection");
+				pServer->disconnect(param->connect.conn_id);
+			}
 			break;
-		case 1:
-			if (foundPrim) {
-				usePrimAP = true;
-			} else {
-				usePrimAP = false;
+		}
+		case ESP_GATTS_DISCONNECT_EVT:
+			bleCounters.disconnects++;
+			xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+			bleClients.remove(param->disconnect.conn_id);
+			deviceConnected = bleClients.count() > 0;
+			updateAdvertising();
+			xSemaphoreGive(clientsSemaphore);
+			LOG_INFO("BLE client %d disconnected, %d of %d", param->disconnect.conn_id, bleClients.count(), MAX_BLE_CLIENTS);
+			break;
+		case ESP_GATTS_MTU_EVT: {
+			xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+			BleClient *client = bleClients.find(param->mtu.conn_id);
+			if (client != NULL) {
+				client->mtu = param->mtu.mtu;
 			}
-			result = true;
+			xSemaphoreGive(clientsSemaphore);
 			break;
-		default:
-			Serial.printf("RSSI Prim: %d Sec: %d\n", rssiPrim, rssiSec);
-			if (rssiPrim > rssiSec) {
-				usePrimAP = true; // RSSI of primary network is better
-			} else {
-				usePrimAP = false; // RSSI of secondary network is better
+		}
+		case ESP_GATTS_READ_EVT:
+			bleCounters.reads++;
+			break;
+		case ESP_GATTS_WRITE_EVT: {
+			bleCounters.writes++;
+			if (credentialsWritten) {
+				credentialsWritten = false;
+				writeCredentials(param->write.conn_id);
+				break;
+			}
+			// Subscriptions are kept per client, the BLE2902 value is shared by all of them
+			uint8_t mask = 0;
+			if (param->write.handle == pStatusDescriptor->getHandle()) {
+				mask = SUB_STATUS;
+			} else if (param->write.handle == pStatusExtDescriptor->getHandle()) {
+				mask = SUB_STATUS_EXT;
+			}
+			if (mask == 0 || param->write.is_prep || param->write.len < 1) {
+				break;
+			}
+			bool subscribe = param->write.value[0] & 0x01;
+			xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+			BleClient *client = bleClients.find(param->write.conn_id);
+			if (client != NULL) {
+				if (subscribe) {
+					client->subscriptions |= mask;
+				} else {
+					client->subscriptions &= ~mask;
+				}
+			}
+			xSemaphoreGive(clientsSemaphore);
+			if (subscribe) {
+				// Send the current status right away
+				notifyStatusTask(STATUS_SUBSCRIBED);
 			}
-			result = true;
+			break;
+		}
+		case ESP_GATTS_EXEC_WRITE_EVT:
+			// End of a long write, the library has put the value together
+			if (credentialsWritten) {
+				credentialsWritten = false;
+				writeCredentials(param->exec_write.conn_id);
+			}
+			break;
+		default:
 			break;
 	}
-	return result;
 }
 
 /**
- * MyServerCallbacks
- * Callbacks for client connection and disconnection
- */
-class MyServerCallbacks: public BLEServerCallbacks {
-	// TODO this doesn't take into account several clients being connected
-	void onConnect(BLEServer* pServer) {
-		Serial.println("BLE client connected");
-		deviceConnected = true;
-	};
+ * bleGapEvent
+ * Stores the connection parameters negotiated with each client
+ */
+void bleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+	if (event != ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+		return;
+	}
+	xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+	BleClient *client = bleClients.findByAddress(param->update_conn_params.bda);
+	if (client != NULL) {
+		client->interval = param->update_conn_params.conn_int;
+		client->latency = param->update_conn_params.latency;
+		client->timeout = param->update_conn_params.timeout;
+	}
+	xSemaphoreGive(clientsSemaphore);
+}
+
+/**
+ * Send a notification to every client subscribed to a characteristic
+ * @param pCharacteristic - characteristic the value belongs to
+ * @param mask - ClientSubscription bit of the characteristic
+ * @return uint8_t - number of clients notified
+ */
+uint8_t notifySubscribers(BLECharacteristic *pCharacteristic, uint8_t mask, uint8_t *data, size_t length) {
+	uint8_t notified = 0;
+	xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+	for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+		const BleClient &client = bleClients.slot(index);
+		if (client.used && (client.subscriptions & mask) && length <= (size_t)(client.mtu - 3)) {
+			if (esp_ble_gatts_send_indicate(pServer->getGattsIf(), client.connId, pCharacteristic->getHandle(), length, data, false) == ESP_OK) {
+				notified++;
+			}
+		}
+	}
+	xSemaphoreGive(clientsSemaphore);
+	return notified;
+}
+
+/**
+ * EspProvisioningHooks
+ * Carries out what a credential write asks for, runs in the BLE task
+ */
+class EspProvisioningHooks: public ProvisioningHooks {
+	void credentialsChanged(bool stored) {
+		clearLastAP();
+		hasCredentials = stored;
+		postConnEvent(stored ? CM_EVT_CREDENTIALS : CM_EVT_ERASE);
+	}
+
+	void erased() {
+		lastAP.valid = false;
+		hasCredentials = false;
+		postConnEvent(CM_EVT_ERASE);
+
+		// The whole partition is erased, credentialStore is closed meanwhile and
+		// opened again on the new partition, no other task uses it under the lock
+		LockGuard guard(networksLock);
+		credentialStore.end();
+		int err;
+		err=nvs_flash_erase();
+		LOG_INFO("nvs_flash_erase: %d", err);
+		err=nvs_flash_init();
+		LOG_INFO("nvs_flash_init: %d", err);
+		credentialStore.begin("WiFiCred");
+	}
 
-	void onDisconnect(BLEServer* pServer) {
-		Serial.println("BLE client disconnected");
-		deviceConnected = false;
-		pAdvertising->start();
+	void reset() {
+		WiFi.disconnect();
+		esp_restart();
 	}
 };
 
+EspProvisioningHooks provisioningHooks;
+/** Credential writes and reads of the WiFi characteristic */
+Provisioning provisioning(networks, bleCodec, credentialStore, networksLock, provisioningHooks);
+
+void writeCredentials(uint16_t connId) {
+	std::string value = pCharacteristicWiFi->getValue();
+	if (value.length() == 0) {
+		return;
+	}
+	LOG_DEBUG("Received %u bytes over BLE from client %d", (unsigned)value.length(), connId);
+	TRACE(TRACE_CRED_RECEIVED, value.length());
+	// Clients are only added and removed by the BLE task, the pointer stays valid after the semaphore is given
+	xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+	BleClient *client = bleClients.find(connId);
+	xSemaphoreGive(clientsSemaphore);
+	credentialsConnId = connId;
+	CredCommand command = provisioning.write(client, (uint8_t *)&value[0], value.length());
+	TRACE(TRACE_CRED_DONE, command);
+	(void)command;
+}
+
 /**
  * MyCallbackHandler
  * Callbacks for BLE client read/write requests
+ * onWrite and onRead are not told the connection. Writes are handled by
+ * bleGattsEvent, which runs right after onWrite with the connection id.
  */
 class MyCallbackHandler: public BLECharacteristicCallbacks {
 	void onWrite(BLECharacteristic *pCharacteristic) {
-		std::string value = pCharacteristic->getValue();
-		if (value.length() == 0) {
-			return;
-		}
-		Serial.println("Received over BLE: " + String((char *)&value[0]));
-
-		// Decode data
-		int keyIndex = 0;
-		for (int index = 0; index < value.length(); index ++) {
-			value[index] = (char) value[index] ^ (char) apName[keyIndex];
-			keyIndex++;
-			if (keyIndex >= strlen(apName)) keyIndex = 0;
-		}
-
-		/** Json object for incoming data */
-		JsonObject& jsonIn = jsonBuffer.parseObject((char *)&value[0]);
-		if (jsonIn.success()) {
-			if (jsonIn.containsKey("ssidPrim") &&
-					jsonIn.containsKey("pwPrim") && 
-					jsonIn.containsKey("ssidSec") &&
-					jsonIn.containsKey("pwSec")) {
-				ssidPrim = jsonIn["ssidPrim"].as<String>();
-				pwPrim = jsonIn["pwPrim"].as<String>();
-				ssidSec = jsonIn["ssidSec"].as<String>();
-				pwSec = jsonIn["pwSec"].as<String>();
-
-				Preferences preferences;
-				preferences.begin("WiFiCred", false);
-				preferences.putString("ssidPrim", ssidPrim);
-				preferences.putString("ssidSec", ssidSec);
-				preferences.putString("pwPrim", pwPrim);
-				preferences.putString("pwSec", pwSec);
-				preferences.putBool("valid", true);
-				preferences.end();
-
-				Serial.println("Received over bluetooth:");
-				Serial.println("primary SSID: "+ssidPrim+" password: "+pwPrim);
-				Serial.println("secondary SSID: "+ssidSec+" password: "+pwSec);
-				connStatusChanged = true;
-				hasCredentials = true;
-			} else if (jsonIn.containsKey("erase")) {
-				Serial.println("Received erase command");
-				Preferences preferences;
-				preferences.begin("WiFiCred", false);
-				preferences.clear();
-				preferences.end();
-				connStatusChanged = true;
-				hasCredentials = false;
-				ssidPrim = "";
-				pwPrim = "";
-				ssidSec = "";
-				pwSec = "";
-
-				int err;
-				err=nvs_flash_init();
-				Serial.println("nvs_flash_init: " + err);
-				err=nvs_flash_erase();
-				Serial.println("nvs_flash_erase: " + err);
-			} else if (jsonIn.containsKey("reset")) {
-				WiFi.disconnect();
-				esp_restart();
-			}
-		} else {
-			Serial.println("Received invalid JSON");
-		}
-		jsonBuffer.clear();
+		credentialsWritten = true;
 	};
 
 	void onRead(BLECharacteristic *pCharacteristic) {
-		Serial.println("BLE onRead request");
-		String wifiCredentials;
-
-		/** Json object for outgoing data */
-		JsonObject& jsonOut = jsonBuffer.createObject();
-		jsonOut["ssidPrim"] = ssidPrim;
-		jsonOut["pwPrim"] = pwPrim;
-		jsonOut["ssidSec"] = ssidSec;
-		jsonOut["pwSec"] = pwSec;
-		// Convert JSON object into a string
-		jsonOut.printTo(wifiCredentials);
-
-		// encode the data
-		int keyIndex = 0;
-		Serial.println("Stored settings: " + wifiCredentials);
-		for (int index = 0; index < wifiCredentials.length(); index ++) {
-			wifiCredentials[index] = (char) wifiCredentials[index] ^ (char) apName[keyIndex];
-			keyIndex++;
-			if (keyIndex >= strlen(apName)) keyIndex = 0;
-		}
-		pCharacteristicWiFi->setValue((uint8_t*)&wifiCredentials[0],wifiCredentials.length());
-		jsonBuffer.clear();
+		LOG_DEBUG("BLE onRead request");
+		// Answered in the protocol of the client that wrote credentials last, JSON once it disconnected
+		xSemaphoreTake(clientsSemaphore,portMAX_DELAY);
+		const BleClient *client = bleClients.find(credentialsConnId);
+		xSemaphoreGive(clientsSemaphore);
+		CharacteristicValue characteristic(pCharacteristicWiFi);
+		provisioning.readCredentials(client, characteristic);
 	}
 };
 
 /** ListCallbackHandler
  * callback for SSID list read request
+ * Provisioning::serveList() serializes the list once per scan generation, and
+ * keeps the value for all offsets of a long read.
  */
 class ListCallbackHandler: public BLECharacteristicCallbacks {
+	/** Copy of scanCache the list is built from, only used by the BLE task */
+	ScanSnapshot scan;
+
 	void onRead(BLECharacteristic *pCharacteristic) {
-		Serial.println("BLE onRead request");
-		String wifiSSIDsFound;
-		
-		byte counter = 0;
-
-		while (!apNum && counter < 20) {
-			if (millis() - apScanTime > 10000) apNum = actualWiFiScan();
-			counter++;
-			delay(500);
-		}
+		LOG_DEBUG("BLE onRead request");
 
-		/** Json object for outgoing data */
-		JsonObject& jsonOut = ssidBuffer.createObject();
-		JsonArray& SSID = jsonOut.createNestedArray("SSID");
-		for (int i = 0; i < apNum && i < 10; i++) {
-			String ssid = WiFi.SSID(i);
+		// Never wait for the radio here, serve the latest snapshot
+		// and refresh it in the background if it is missing or stale
+		scanCache.read(scan);
+		if (listNeedsScan(scan, millis())) {
+			requestWiFiScan(listScanPolicy);
+		}
 
-			if (WiFi.encryptionType(i) != 0) {
-				SSID.add(ssid);
-			}
+		CharacteristicValue characteristic(pCharacteristicList);
+		if (provisioning.serveList(scan, millis(), characteristic)) {
+			LOG_DEBUG("SSID list serialization %u", provisioning.listSerializations());
 		}
-		// Convert JSON object into a string
-		jsonOut.printTo(wifiSSIDsFound);
-
-		// encode the data (doesn't seem necessary, if added should be added to web app as well)
-		Serial.println("Found SSIDs: " + wifiSSIDsFound);
-		// int keyIndex = 0;
-		// for (int index = 0; index < wifiSSIDsFound.length(); index ++) {
-		// 	wifiSSIDsFound[index] = (char) wifiSSIDsFound[index] ^ (char) apName[keyIndex];
-		// 	keyIndex++;
-		// 	if (keyIndex >= strlen(apName)) keyIndex = 0;
-		// }
-		pCharacteristicList->setValue((uint8_t*)&wifiSSIDsFound[0],wifiSSIDsFound.length());
-		ssidBuffer.clear();
 	}
 };
 
+/** Current heap state */
+HeapStats readHeapStats() {
+	HeapStats heap;
+	heap.freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	heap.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+	heap.minFree = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+	heap.fragmentation = heap.freeBytes > 0 ? 100 - (uint64_t)heap.largestBlock * 100 / heap.freeBytes : 0;
+	return heap;
+}
+
+void notifyStatusTask(uint32_t reason) {
+	if (reason & STATUS_CHANGED) {
+		statusChangeTime = micros();
+	}
+	xTaskNotify(sendBLEdataTask, reason, eSetBits);
+}
+
 /** BLE notification task
- * works independently from loop(), in a separate freeRTOS task.
- * if the esp32 device (server) is connected to a client, update the client every 1 second
- * of the wifi connection status.
- * in order to not cause interference between the two tasks, a mutex semaphore is used by the
- * wifi connection callbacks which update the variable, loop(), and the notification task.
+ * works independently from the other tasks, in a separate freeRTOS task.
+ * sleeps until the wifi connection callbacks report a status change, or a client
+ * subscribes to notifications, and pushes the status to the client right away.
+ * if STATUS_HEARTBEAT is not 0, the status is also sent at that interval.
+ * the status is read from the connStatus snapshot, so the task never waits for
+ * the wifi connection callbacks which update it.
  */
 void sendBLEdata(void * parameter) {
-  TickType_t xLastWakeTime;
-  TickType_t xPeriod = pdMS_TO_TICKS(1000);
-  
-  xLastWakeTime = xTaskGetTickCount();
-
-  bool notificationFlag = false;
-  
-    while(1) {
-        // if the device is connected via BLE try to send notifications
-        if (deviceConnected) {
-			// Take mutex, set value, give mutex
-			xSemaphoreTake(connStatSemaphore,0);
-            pCharacteristicStatus->setValue(sendVal);
-			xSemaphoreGive(connStatSemaphore);
-
-            // test if notifications are enabled by client
-            byte testNotify = *pCharacteristicStatus->getDescriptorByUUID((uint16_t)0x2902)->getValue();
-
-            // if enabled, send value over BLE
-            if (testNotify == 1) {
-                pCharacteristicStatus->notify(); // Send the value to the app!
+	NotifySchedule schedule(STATUS_HEARTBEAT);
+	bool notificationFlag = false;
+	uint32_t reason;
+	/** Heap state of the last log line */
+	uint8_t loggedFragmentation = 0xFF;
+
+	while(1) {
+		// sleep until a status change, a subscription or the heartbeat
+		uint32_t timeout = schedule.nextTimeout(millis());
+		if (xTaskNotifyWait(0, 0xFFFFFFFF, &reason,
+				timeout == NOTIFY_NO_TIMEOUT ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) != pdTRUE) {
+			reason = 0;
+		}
+		HeapStats heap = readHeapStats();
+		if (heap.fragmentation != loggedFragmentation) {
+			LOG_INFO("Heap free %u, largest block %u, fragmentation %u%%",
+				heap.freeBytes, heap.largestBlock, heap.fragmentation);
+			loggedFragmentation = heap.fragmentation;
+		}
+
+		// if the device is connected via BLE try to send notifications
+		if (schedule.wake(reason, millis()) && deviceConnected) {
+			// Both characteristics are built from the same snapshot
+			StatusRecord status = connStatus.read();
+			uint16_t value = legacyStatusValue(status);
+			pCharacteristicStatus->setValue(value);
+
+			uint8_t record[STATUS_RECORD_SIZE];
+			size_t recordLength = buildStatusRecord(status, record);
+			pCharacteristicStatusExt->setValue(record, recordLength);
+			notifySubscribers(pCharacteristicStatusExt, SUB_STATUS_EXT, record, recordLength);
+
+			// send value over BLE to the clients that enabled notifications
+			uint8_t notified = notifySubscribers(pCharacteristicStatus, SUB_STATUS, (uint8_t *)&value, sizeof(value));
+			if (notified > 0) {
+				if (reason & STATUS_CHANGED) {
+					LOG_DEBUG("status notified %lu us after change", micros() - statusChangeTime);
+					TRACE(TRACE_STATUS_NOTIFIED, value);
+#if APP_TRACE
+					// Provisioning is done once the connection was notified
+					if (status.state == CONN_STATE_CONNECTED) {
+						traceDumpPending = true;
+						wakeLogTask();
+					}
+#endif
+				}
 				if (!notificationFlag) {
-					Serial.println("started notification service");
+					LOG_INFO("started notification service");
 					notificationFlag = true;
 				}
-            } else if (notificationFlag){
-                // else print failure message to serial monitor
-				Serial.print("notify failed, value of 0x2902 descriptor:\t");
-				Serial.println(testNotify, HEX);//*pCharacteristicMeas->getDescriptorByUUID((uint16_t)0x2902)->getValue(), HEX);
+			} else if (notificationFlag){
+				LOG_INFO("notifications disabled by all clients");
 				notificationFlag = false;
-            }
-        }
-        // sleep task for 1000 ms 
-        vTaskDelayUntil(&xLastWakeTime, xPeriod);
-    }
+			}
+		}
+	}
 }
 
+/** StatusCallbackHandler
+ * callback for extended status read request
+ */
+class StatusCallbackHandler: public BLECharacteristicCallbacks {
+	void onRead(BLECharacteristic *pCharacteristic) {
+		uint8_t record[STATUS_RECORD_SIZE];
+		pCharacteristic->setValue(record, buildStatusRecord(connStatus.read(), record));
+	}
+};
+
+/** DiagCallbackHandler
+ * callback for diagnostics read request
+ */
+class DiagCallbackHandler: public BLECharacteristicCallbacks {
+	void onRead(BLECharacteristic *pCharacteristic) {
+		DiagRecord diag;
+		HeapStats heap = readHeapStats();
+		diag.fragmentation = heap.fragmentation;
+		diag.freeHeap = heap.freeBytes;
+		diag.minFreeHeap = heap.minFree;
+		diag.largestBlock = heap.largestBlock;
+		diag.bleConnects = bleCounters.connects;
+		diag.bleDisconnects = bleCounters.disconnects;
+		diag.bleWrites = bleCounters.writes;
+		diag.bleReads = bleCounters.reads;
+		diag.wifiScans = wifiEvents.count(SYSTEM_EVENT_SCAN_DONE);
+		diag.wifiGotIP = wifiEvents.count(SYSTEM_EVENT_STA_GOT_IP);
+		diag.wifiDisconnects = wifiEvents.count(SYSTEM_EVENT_STA_DISCONNECTED);
+		diag.logDropped = appLogDropped();
+		// In the order of README.md, the last one is the BLE task running this callback
+		TaskHandle_t tasks[] = { sendBLEdataTask, wifiScanTask, manageConnectionTask, logTask, xTaskGetCurrentTaskHandle() };
+		diag.taskCount = sizeof(tasks) / sizeof(tasks[0]);
+		for (uint8_t task = 0; task < diag.taskCount; task++) {
+			// In bytes on the ESP32, where a stack word is a byte
+			diag.stackFree[task] = tasks[task] != NULL ? uxTaskGetStackHighWaterMark(tasks[task]) : DIAG_NO_TASK;
+		}
+		uint8_t record[DIAG_RECORD_MAX_SIZE];
+		pCharacteristic->setValue(record, encodeDiagRecord(diag, record, sizeof(record)));
+	}
+};
+
 /**
  * initBLE
  * Initialize BLE service and characteristic
@@ -425,8 +992,9 @@ void initBLE() {
 	// Create BLE Server
 	pServer = BLEDevice::createServer();
 
-	// Set server callbacks
-	pServer->setCallbacks(new MyServerCallbacks());
+	// Track clients per connection
+	BLEDevice::setCustomGattsHandler(bleGattsEvent);
+	BLEDevice::setCustomGapHandler(bleGapEvent);
 
 	// Create BLE Service
 	pService = pServer->createService(BLEUUID(SERVICE_UUID),20);
@@ -453,7 +1021,25 @@ void initBLE() {
 							BLECharacteristic::PROPERTY_NOTIFY
 						);
 	// pCharacteristicStatus->setCallbacks(new MyCallbacks()); // If only notifications no need for callback?
-	pCharacteristicStatus->addDescriptor(new BLE2902());
+	pStatusDescriptor = new BLE2902();
+	pCharacteristicStatus->addDescriptor(pStatusDescriptor);
+
+	// Create BLE Characteristic for the packed extended status, read or notify
+	pCharacteristicStatusExt = pService->createCharacteristic(
+		BLEUUID(WIFI_STATUS_EXT_UUID),
+		BLECharacteristic::PROPERTY_READ |
+		BLECharacteristic::PROPERTY_NOTIFY
+	);
+	pCharacteristicStatusExt->setCallbacks(new StatusCallbackHandler());
+	pStatusExtDescriptor = new BLE2902();
+	pCharacteristicStatusExt->addDescriptor(pStatusExtDescriptor);
+
+	// Create BLE Characteristic for diagnostics, read only
+	pCharacteristicDiag = pService->createCharacteristic(
+		BLEUUID(WIFI_DIAG_UUID),
+		BLECharacteristic::PROPERTY_READ
+	);
+	pCharacteristicDiag->setCallbacks(new DiagCallbackHandler());
 
 	// Start the service
 	pService->start();
@@ -463,57 +1049,297 @@ void initBLE() {
 	pAdvertising->addServiceUUID(SERVICE_UUID);
   	pAdvertising->setScanResponse(true);
 	pAdvertising->start();
+	advertising = true;
 }
 
 /** Callback for receiving IP address from AP */
-void gotIP(system_event_id_t event) {
-	isConnected = true;
-	connStatusChanged = true;
-	/** Check if ip corresponds to 1st or 2nd configured SSID 
-	 * takes semaphore, sets (uint16_t)sendVal, and gives semaphore
-	*/
-	String connectedSSID = WiFi.SSID();
-	xSemaphoreTake(connStatSemaphore,portMAX_DELAY);
-	if (connectedSSID == ssidPrim) {
-		// Serial.println("connected to primary SSID");
-		sendVal = 0x0001;
-	} else if (connectedSSID == ssidSec) {
-		sendVal = 0x0002;
+void gotIP(uint16_t event, const system_event_info_t &info) {
+	gotIPTime = millis();
+	TRACE(TRACE_GOT_IP, 0);
+	wifi_ap_record_t apInfo;
+	if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) {
+		memset(&apInfo, 0, sizeof(apInfo));
+	}
+	/** Find the network of the SSID, the status profile is its slot + 1 */
+	networksLock.lock();
+	uint8_t network = networks.find((const char *)apInfo.ssid);
+	networksLock.unlock();
+	int8_t rssi = apInfo.rssi;
+	uint8_t channel = apInfo.primary;
+	portENTER_CRITICAL(&statusMux);
+	StatusRecord status = connStatus.read();
+	status.profile = network != NETWORK_NONE ? network + 1 : 0;
+	if (hasConnected) {
+		status.reconnectCount++;
 	}
-	xSemaphoreGive(connStatSemaphore);
+	hasConnected = true;
+	status.state = CONN_STATE_CONNECTED;
+	status.rssi = rssi;
+	status.channel = channel;
+	memcpy(status.ipv4, &info.got_ip.ip_info.ip.addr, sizeof(status.ipv4));
+	connStatus.write(status);
+	portEXIT_CRITICAL(&statusMux);
+	isConnected = true;
+	postConnEvent(CM_EVT_GOT_IP);
+	notifyStatusTask(STATUS_CHANGED);
 }
 
 /** Callback for connection loss */
-void lostCon(system_event_id_t event) {
+void lostCon(uint16_t event, const system_event_info_t &info) {
+	portENTER_CRITICAL(&statusMux);
+	StatusRecord status = connStatus.read();
+	status.state = CONN_STATE_DISCONNECTED;
+	status.profile = 0;
+	status.rssi = 0;
+	status.channel = 0;
+	status.lastDisconnectReason = info.disconnected.reason;
+	memset(status.ipv4, 0, sizeof(status.ipv4));
+	connStatus.write(status);
+	portEXIT_CRITICAL(&statusMux);
 	isConnected = false;
-	connStatusChanged = true;
-	/** if disconnected, take semaphore, set (uint16_t)sendVal = 0, give semaphore */
-	xSemaphoreTake(connStatSemaphore,portMAX_DELAY);
-	sendVal = 0x0000;
-	xSemaphoreGive(connStatSemaphore);
+	// Our own disconnect while switching, the manager is already connecting to the new network
+	bool expected = expectedDisconnect.exchange(false);
+	if (!expected || info.disconnected.reason != WIFI_REASON_ASSOC_LEAVE) {
+		postConnEvent(CM_EVT_LOST, info.disconnected.reason);
+	}
+	notifyStatusTask(STATUS_CHANGED);
+}
+
+/** Callback for the association with an AP, before DHCP */
+void staConnected(uint16_t event, const system_event_info_t &info) {
+	TRACE(TRACE_ASSOCIATED, info.connected.channel);
+}
+
+/**
+ * Callback for all WiFi events
+ * Registered once in setup(), so every event runs exactly one handler
+ * of wifiEvents no matter how often a connection is started.
+ */
+void wifiEvent(system_event_id_t event, system_event_info_t info) {
+	wifiEvents.dispatch(event, info);
 }
 
 /**
- * Start connection to AP
+ * Start connection to AP selected by selectNetwork()
+ * The station is only disconnected if it is associated with a different AP,
+ * if it is already connected to the selected one the connection manager is
+ * told right away.
+ * @param bssid - connect to this AP only, NULL to let the driver pick one
+ * @param channel - channel of bssid, 0 if unknown
  */
-void connectWiFi() {
-	// Setup callback function for successful connection
-	WiFi.onEvent(gotIP, SYSTEM_EVENT_STA_GOT_IP);
-	// Setup callback function for lost connection
-	WiFi.onEvent(lostCon, SYSTEM_EVENT_STA_DISCONNECTED);
+void connectWiFi(const uint8_t *bssid = NULL, int32_t channel = 0) {
+	// Copied, a BLE write may change the slot while the connection starts
+	char ssid[CRED_SSID_SIZE];
+	char pw[CRED_PW_SIZE];
+	{
+		LockGuard guard(networksLock);
+		const NetworkEntry *entry = networks.get(selectedNetwork);
+		if (entry == NULL) {
+			return;
+		}
+		strcpy(ssid, entry->ssid);
+		strcpy(pw, entry->pw);
+	}
+
+	wifi_ap_record_t apInfo;
+	if (isConnected && esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) {
+		if (!strcmp((const char *)apInfo.ssid, ssid)) {
+			LOG_INFO("Already connected to %s", ssid);
+			postConnEvent(CM_EVT_GOT_IP);
+			return;
+		}
+		// Switching networks, only now drop the current link
+		LOG_INFO("Switching from %s", (const char *)apInfo.ssid);
+		expectedDisconnect = true;
+		WiFi.disconnect();
+	}
 
-	WiFi.disconnect(true);
 	WiFi.enableSTA(true);
 	WiFi.mode(WIFI_STA);
 
-	Serial.println();
-	Serial.print("Start connection to ");
-	if (usePrimAP) {
-		Serial.println(ssidPrim);
-		WiFi.begin(ssidPrim.c_str(), pwPrim.c_str());
-	} else {
-		Serial.println(ssidSec);
-		WiFi.begin(ssidSec.c_str(), pwSec.c_str());
+	LOG_INFO("Start connection to %s", ssid);
+	TRACE(TRACE_CONNECT_START, selectedNetwork);
+	WiFi.begin(ssid, pw, channel, bssid);
+}
+
+/**
+ * Print the time from boot or from losing the connection until an IP was received
+ * @param fast - the IP came from a direct connect to the cached AP
+ */
+void reportConnectTime(bool fast) {
+	if (!connectInProgress) {
+		return;
+	}
+	LOG_INFO("%s to IP: %lu ms via %s path",
+		connectStartTime == 0 ? "Boot" : "Reconnect",
+		gotIPTime - connectStartTime,
+		fast ? "fast" : "scan");
+	connectInProgress = false;
+}
+
+/**
+ * EspConnActions
+ * Carries out the steps decided by the connection manager, runs in its task
+ */
+class EspConnActions: public ConnActions {
+	void startScan() {
+		connScanPending = true;
+		requestWiFiScan(connectScanPolicy);
+	}
+
+	bool selectNetwork() {
+		bool found = ::selectNetwork();
+		if (!found) {
+			LOG_WARN("Could not find any AP");
+		}
+		return found;
+	}
+
+	bool connectCached() {
+		if (!lastAP.valid) {
+			return false;
+		}
+		LOG_INFO("Fast connect on channel %d", lastAP.channel);
+		selectedNetwork = lastAP.network;
+		connectWiFi(lastAP.bssid, lastAP.channel);
+		return true;
+	}
+
+	void connect() {
+		connectWiFi();
+	}
+
+	void disconnect() {
+		WiFi.disconnect();
+	}
+
+	void connected(bool fast) {
+		uint8_t profile = connStatus.read().profile;
+		if (profile == 1) LOG_INFO("Connected to primary SSID");
+		else if (profile == 2) LOG_INFO("Connected to secondary SSID");
+		if (profile != 0) {
+			// The driver may have reconnected by itself, the network is the one in the status
+			selectedNetwork = profile - 1;
+			networksLock.lock();
+			if (networks.markSuccess(selectedNetwork)) {
+				provisioning.save();
+			}
+			networksLock.unlock();
+		}
+		wifi_ap_record_t apInfo;
+		if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) {
+			memset(&apInfo, 0, sizeof(apInfo));
+		}
+		IPAddress ip = WiFi.localIP();
+		LOG_INFO("Connected to AP: %s with IP: %u.%u.%u.%u RSSI: %d",
+			(const char *)apInfo.ssid, ip[0], ip[1], ip[2], ip[3], apInfo.rssi);
+		reportConnectTime(fast);
+		saveLastAP();
+	}
+
+	void stateChanged(ConnManagerState state, uint32_t timeout) {
+		switch (state) {
+			case CM_IDLE:
+				setConnState(CONN_STATE_NO_CREDENTIALS);
+				break;
+			case CM_DEBOUNCE:
+				// lostCon() already reported the disconnect, only start the reconnect timing
+				if (!connectInProgress) {
+					connectInProgress = true;
+					connectStartTime = millis();
+				}
+				break;
+			case CM_SCANNING:
+			case CM_CONNECTING:
+				if (!connectInProgress) {
+					connectInProgress = true;
+					connectStartTime = millis();
+				}
+				setConnState(CONN_STATE_CONNECTING);
+				break;
+			case CM_CONNECTED:
+				// gotIP() already filled in the status
+				break;
+			case CM_BACKOFF:
+				LOG_INFO("Retrying in %u ms", timeout);
+				setConnState(CONN_STATE_DISCONNECTED);
+				break;
+		}
+	}
+};
+
+EspConnActions connActions;
+/** Reconnect timing: debounce, quick retry to the cached AP, backoff and jitter */
+const ConnManagerConfig connConfig = { CM_DEBOUNCE_TIME, true, CM_BACKOFF_MIN, CM_BACKOFF_MAX, CM_BACKOFF_JITTER };
+/** Connection state machine, only used by the manageConnection task */
+ConnManager connManager(connActions, connConfig);
+
+/** Connection manager task
+ * works independently from the BLE callbacks and the WiFi event handlers, in a separate freeRTOS task.
+ * sleeps until one of them queues an event, or until the next timeout of the state
+ * machine, so nothing polls for connection changes.
+ */
+void manageConnection(void * parameter) {
+	connManager.seed(esp_random());
+	connManager.begin(hasCredentials, millis());
+	while(1) {
+		uint32_t timeout = connManager.nextTimeout(millis());
+		ConnEvent event;
+		if (xQueueReceive(connEventQueue, &event, timeout == CM_NO_TIMEOUT ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) == pdTRUE) {
+			connManager.handle(event, millis());
+		}
+		connManager.tick(millis());
+	}
+}
+
+/** Time stamp of log lines */
+uint32_t logClock() {
+	return millis();
+}
+
+#if APP_TRACE
+/** Time stamp of trace events */
+uint32_t traceClock() {
+	return micros();
+}
+#endif
+
+/** Called by the logger for every queued line */
+void wakeLogTask() {
+	if (logTask != NULL) {
+		xTaskNotifyGive(logTask);
+	}
+}
+
+/**
+ * drainLog
+ * Writes queued log lines to Serial, the only task that blocks on the port
+ * @param pvParameters - unused
+ */
+void drainLog(void *pvParameters) {
+	char line[LOG_OUTPUT_SIZE];
+	uint32_t reportedDrops = 0;
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_DRAIN_PERIOD));
+		size_t length;
+		while ((length = appLogNext(line, sizeof(line))) > 0) {
+			Serial.write((const uint8_t *)line, length);
+		}
+		uint32_t dropped = appLogDropped();
+		if (dropped != reportedDrops) {
+			Serial.printf("%u log lines dropped\n", dropped - reportedDrops);
+			reportedDrops = dropped;
+		}
+#if APP_TRACE
+		if (traceDumpPending.exchange(false)) {
+			// Static, the stack of this task is small
+			static char traceLine[TRACE_LINE_SIZE];
+			TraceExport trace;
+			while ((length = trace.next(traceLine, sizeof(traceLine))) > 0) {
+				Serial.write((const uint8_t *)traceLine, length);
+			}
+		}
+#endif
 	}
 }
 
@@ -523,95 +1349,101 @@ void setup() {
 
 	// Initialize Serial port
 	Serial.begin(115200);
+	// Log task first, everything after logs through it
+	appLogBegin(logClock, wakeLogTask);
+	xTaskCreate(
+		drainLog,
+		"logTask",
+		LOG_TASK_STACK,
+		NULL,
+		LOG_TASK_PRIORITY,
+		&logTask
+	);
+#if APP_TRACE
+	traceBegin(traceClock);
+#endif
 	// Send some device info
-	Serial.print("Build: ");
-	Serial.println(compileDate);
+	LOG_INFO("Build: %s", compileDate);
 
 	// Set up mutex semaphore
-	connStatSemaphore = xSemaphoreCreateMutex();
+	clientsSemaphore = xSemaphoreCreateMutex();
 
-	if(connStatSemaphore == NULL){
-		Serial.println("Error creating connStatSemaphore");
+	if(clientsSemaphore == NULL){
+		LOG_ERROR("Error creating clientsSemaphore");
+	}
+	if (!networksLock.begin()) {
+		LOG_ERROR("Error creating networksLock");
 	}
 
+	// Filled by the WiFi event handlers, the scan task and BLE writes
+	connEventQueue = xQueueCreate(8, sizeof(ConnEvent));
+
 	// ble task
     xTaskCreate(
     sendBLEdata,
     "sendBLEdataTask",
-    2048,
+    STATUS_TASK_STACK,
     NULL,
     1,
     &sendBLEdataTask
     );
+
+	// WiFi scan task, scanDone() wakes it up when the WiFi library has the results
+	scanDoneSemaphore = xSemaphoreCreateBinary();
+	// Scan, connect and disconnect events, registered once for the lifetime of the sketch
+	wifiEvents.on(SYSTEM_EVENT_SCAN_DONE, scanDone);
+	wifiEvents.on(SYSTEM_EVENT_STA_CONNECTED, staConnected);
+	wifiEvents.on(SYSTEM_EVENT_STA_GOT_IP, gotIP);
+	wifiEvents.on(SYSTEM_EVENT_STA_DISCONNECTED, lostCon);
+	WiFi.onEvent(wifiEvent);
+	xTaskCreate(
+		wifiScan,
+		"wifiScanTask",
+		4096,
+		NULL,
+		1,
+		&wifiScanTask
+	);
     delay(500);
 
-	Preferences preferences;
-	preferences.begin("WiFiCred", false);
-	bool hasPref = preferences.getBool("valid", false);
-	if (hasPref) {
-		ssidPrim = preferences.getString("ssidPrim","");
-		ssidSec = preferences.getString("ssidSec","");
-		pwPrim = preferences.getString("pwPrim","");
-		pwSec = preferences.getString("pwSec","");
-
-		Serial.printf("%s,%s,%s,%s\n",ssidPrim,pwPrim,ssidSec,pwSec);
-
-		if (ssidPrim.equals("") 
-				|| pwPrim.equals("")
-				|| ssidSec.equals("")
-				|| pwPrim.equals("")) {
-			Serial.println("Found preferences but credentials are invalid");
-		} else {
-			Serial.println("Read from preferences:");
-			Serial.println("primary SSID: "+ssidPrim+" password: "+pwPrim);
-			Serial.println("secondary SSID: "+ssidSec+" password: "+pwSec);
-			hasCredentials = true;
+	credentialStore.begin("WiFiCred");
+	unsigned long loadStart = micros();
+	provisioning.load();
+	LOG_INFO("Credentials loaded in %lu us", micros() - loadStart);
+	networksLock.lock();
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		const NetworkEntry *entry = networks.get(index);
+		if (entry != NULL) {
+			LOG_INFO("Network %d: %s priority %d", index, entry->ssid, entry->priority);
 		}
-	} else {
-		Serial.println("Could not find preferences, need send data over BLE");
 	}
-	preferences.end();
+	hasCredentials = networks.count() > 0;
+	networksLock.unlock();
+	if (!hasCredentials) {
+		LOG_INFO("Could not find preferences, need send data over BLE");
+	}
+	loadLastAP();
 
 	// Start BLE server
 	initBLE();
 
-	if (hasCredentials) {
-		apScanTime = millis();
-		// Check for available AP's
-		if (!scanWiFi()) {
-			Serial.println("Could not find any AP");
-		} else {
-			// If AP was found, start connection
-			connectWiFi();
-		}
+	if (!hasCredentials) {
+		// Have a SSID list ready for the first read
+		requestWiFiScan(listScanPolicy);
 	}
+
+	// Connection manager task, connects right away if credentials are stored
+	xTaskCreate(
+		manageConnection,
+		"manageConnectionTask",
+		4096,
+		NULL,
+		1,
+		&manageConnectionTask
+	);
 }
 
 void loop() {
-	if (connStatusChanged) {
-		if (isConnected) {
-			Serial.print("Connected to AP: ");
-			String connectedSSID = WiFi.SSID();
-			xSemaphoreTake(connStatSemaphore,portMAX_DELAY);
-			if (sendVal == 1) Serial.println("connected to primary SSID");
-			else if (sendVal == 2) Serial.println("Connected to secondary SSID");
-			xSemaphoreGive(connStatSemaphore);
-			Serial.print(connectedSSID);
-			Serial.print(" with IP: ");
-			Serial.print(WiFi.localIP());
-			Serial.print(" RSSI: ");
-			Serial.println(WiFi.RSSI());
-		} else {
-			if (hasCredentials) {
-				Serial.println("Lost WiFi connection");
-				// Received WiFi credentials
-				if (!scanWiFi()) { // Check for available AP's
-					Serial.println("Could not find any AP");
-				} else { // If AP was found, start connection
-					connectWiFi();
-				}
-			} 
-		}
-		connStatusChanged = false;
-	}
+	// Everything runs in its own task, nothing is left to poll
+	vTaskDelete(NULL);
 }
@@ -0,0 +1,76 @@
+/**
+ * Platform interfaces of the provisioning logic
+ *
+ * Thin wrappers over what the portable modules need from the platform:
+ * persistent storage (Preferences), characteristic values (BLE) and
+ * mutual exclusion (FreeRTOS mutexes). The sketch implements them over
+ * the ESP32 libraries, src/native/ in memory for the native build. The
+ * WiFi radio is behind ConnActions, see conn_manager.h.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * KeyValueStore
+ * One namespace of persistent storage, keys are at most 15 characters
+ */
+class KeyValueStore {
+public:
+	virtual ~KeyValueStore() {}
+	/** @return size_t - bytes copied, 0 if the key is missing or the value does not fit */
+	virtual size_t getBytes(const char *key, void *buffer, size_t size) = 0;
+	/** @return size_t - bytes written, 0 on failure */
+	virtual size_t putBytes(const char *key, const void *value, size_t length) = 0;
+	/** Zero terminated string, empty if the key is missing */
+	virtual void getString(const char *key, char *buffer, size_t size) = 0;
+	virtual bool getBool(const char *key, bool defaultValue) = 0;
+	virtual bool remove(const char *key) = 0;
+	/** Remove every key of the namespace */
+	virtual bool clear() = 0;
+};
+
+/**
+ * GattValue
+ * Value of a characteristic, as served to the next read
+ */
+class GattValue {
+public:
+	virtual ~GattValue() {}
+	virtual void setValue(const uint8_t *data, size_t length) = 0;
+};
+
+/**
+ * Lock
+ * Mutex, held for short sections only
+ */
+class Lock {
+public:
+	virtual ~Lock() {}
+	virtual void lock() = 0;
+	virtual void unlock() = 0;
+};
+
+/** Holds a Lock for the scope it is declared in */
+class LockGuard {
+public:
+	explicit LockGuard(Lock &lock) : held(lock) {
+		held.lock();
+	}
+	~LockGuard() {
+		held.unlock();
+	}
+
+private:
+	LockGuard(const LockGuard &);
+	LockGuard &operator=(const LockGuard &);
+
+	Lock &held;
+};
+
+#endif
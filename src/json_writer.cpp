@@ -0,0 +1,101 @@
+/**
+ * JSON output into a fixed buffer
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "json_writer.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t size)
+	: buffer(buffer), size(size), pos(0), needComma(false), overflowed(size == 0) {
+	if (size > 0) {
+		buffer[0] = 0;
+	}
+}
+
+void JsonWriter::beginObject() {
+	separate();
+	put('{');
+	needComma = false;
+}
+
+void JsonWriter::endObject() {
+	put('}');
+	needComma = true;
+}
+
+void JsonWriter::beginArray() {
+	separate();
+	put('[');
+	needComma = false;
+}
+
+void JsonWriter::endArray() {
+	put(']');
+	needComma = true;
+}
+
+void JsonWriter::key(const char *name) {
+	separate();
+	putQuoted(name);
+	put(':');
+	needComma = false;
+}
+
+void JsonWriter::value(const char *text) {
+	separate();
+	putQuoted(text);
+	needComma = true;
+}
+
+size_t JsonWriter::quotedSize(const char *text) {
+	size_t length = 2;
+	for (; *text; text++) {
+		unsigned char c = *text;
+		if (c == '"' || c == '\\') {
+			length += 2;
+		} else if (c < 0x20) {
+			length += 6;
+		} else {
+			length++;
+		}
+	}
+	return length;
+}
+
+void JsonWriter::separate() {
+	if (needComma) {
+		put(',');
+	}
+}
+
+void JsonWriter::put(char c) {
+	if (overflowed || pos + 1 >= size) {
+		overflowed = true;
+		return;
+	}
+	buffer[pos++] = c;
+	buffer[pos] = 0;
+}
+
+void JsonWriter::putQuoted(const char *text) {
+	static const char hex[] = "0123456789abcdef";
+	put('"');
+	for (; *text; text++) {
+		unsigned char c = *text;
+		if (c == '"' || c == '\\') {
+			put('\\');
+			put(c);
+		} else if (c < 0x20) {
+			put('\\');
+			put('u');
+			put('0');
+			put('0');
+			put(hex[c >> 4]);
+			put(hex[c & 0x0F]);
+		} else {
+			put(c);
+		}
+	}
+	put('"');
+}
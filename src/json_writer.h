@@ -0,0 +1,58 @@
+/**
+ * JSON output into a fixed buffer
+ *
+ * Writes objects, arrays and string values straight into a caller owned
+ * buffer, with commas and escaping handled, and never allocates. Once
+ * something does not fit the writer stops and overflow() is set; the
+ * buffer then holds a truncated, invalid text.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+
+class JsonWriter {
+public:
+	/** @param size - buffer size, one byte is kept for the zero terminator */
+	JsonWriter(char *buffer, size_t size);
+
+	void beginObject();
+	void endObject();
+	void beginArray();
+	void endArray();
+	/** Key of the next value inside an object */
+	void key(const char *name);
+	/** String value, escaped */
+	void value(const char *text);
+
+	/** Length of the text so far, without the zero terminator */
+	size_t length() const {
+		return pos;
+	}
+	/** Bytes that can still be written */
+	size_t remaining() const {
+		return size - 1 - pos;
+	}
+	bool overflow() const {
+		return overflowed;
+	}
+	/** Worst case size of a string value, quotes and escapes included */
+	static size_t quotedSize(const char *text);
+
+private:
+	void separate();
+	void put(char c);
+	void putQuoted(const char *text);
+
+	char *buffer;
+	size_t size;
+	size_t pos;
+	/** The next key or value needs a comma in front */
+	bool needComma;
+	bool overflowed;
+};
+
+#endif
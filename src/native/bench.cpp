@@ -0,0 +1,508 @@
+/**
+ * Micro-benchmarks of the provisioning code paths
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "heap_counter.h"
+#include "memory_hal.h"
+#include "../app_log.h"
+#include "../ble_codec.h"
+#include "../cred_parser.h"
+#include "../network_table.h"
+#include "../nvs_record.h"
+#include "../notify_schedule.h"
+#include "../provisioning.h"
+#include "../scan_policy.h"
+#include "../tlv_codec.h"
+
+namespace {
+
+/** Longest payload of a write case */
+#define BENCH_MAX_PAYLOAD 512
+
+const uint16_t decodeSizes[] = { 20, 64, 244, BENCH_MAX_PAYLOAD };
+const uint8_t ssidLengths[] = { 4, 16, 32 };
+const uint8_t listSizes[] = { 1, 5, 10, SCAN_CACHE_MAX_AP };
+const uint8_t tableSizes[] = { 2, 8, MAX_NETWORKS };
+const uint8_t scanSizes[] = { 10, 20, 50 };
+
+/** Channels of the two stored networks in the scan model, 0 if out of range */
+const uint8_t knownChannels[][2] = { { 1, 1 }, { 1, 6 }, { 6, 11 }, { 11, 13 }, { 6, 0 } };
+/** Neighbour APs of the scan model, spread over the channels */
+#define SCAN_MODEL_NEIGHBOURS 20
+
+/** Simulated time of the notify case, a day */
+#define NOTIFY_DURATION (24 * 3600000UL)
+/** Mean time between status changes of the notify case */
+#define NOTIFY_CHANGE_INTERVAL 300000
+/** Heartbeat of the sketch, and the polling interval of older versions */
+#define NOTIFY_HEARTBEAT 10000
+#define NOTIFY_POLL_INTERVAL 1000
+
+/** Results of select(), so the calls are not optimized away */
+volatile uint32_t sink;
+
+/** Time per call in ns, after a warm up of a tenth of the iterations */
+template <typename Op>
+double timeOp(uint32_t iterations, Op op) {
+	for (uint32_t index = 0; index < iterations / 10; index++) {
+		op(index);
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint32_t index = 0; index < iterations; index++) {
+		op(index);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return ns / iterations;
+}
+
+/** Credentials of length characters, in two variants so every write changes the table */
+void fillCredentials(WiFiCredentials &credentials, uint8_t length, char variant) {
+	uint8_t pwLength = length * 2 < CRED_PW_SIZE - 1 ? length * 2 : CRED_PW_SIZE - 1;
+	memset(&credentials, 0, sizeof(credentials));
+	memset(credentials.ssidPrim, variant, length);
+	memset(credentials.pwPrim, 'p', pwLength);
+	memset(credentials.ssidSec, 's', length);
+	memset(credentials.pwSec, 'q', pwLength);
+}
+
+/** Encoded payload the web app would write */
+size_t buildPayload(uint8_t *out, bool tlv, const WiFiCredentials &credentials, const BleCodec &codec) {
+	size_t length;
+	if (tlv) {
+		length = tlvEncodeCredentials(out, BENCH_MAX_PAYLOAD, TLV_OP_SET_CREDENTIALS, credentials);
+	} else {
+		length = snprintf((char *)out, BENCH_MAX_PAYLOAD, "{\"ssidPrim\":\"%s\",\"pwPrim\":\"%s\",\"ssidSec\":\"%s\",\"pwSec\":\"%s\"}",
+			credentials.ssidPrim, credentials.pwPrim, credentials.ssidSec, credentials.pwSec);
+	}
+	codecApply(codec, out, length);
+	return length;
+}
+
+/** Decode payloads of each size, alone */
+void benchDecode(const BleCodec &codec, uint32_t iterations) {
+	uint8_t payload[BENCH_MAX_PAYLOAD];
+	memset(payload, 'x', sizeof(payload));
+	for (size_t size = 0; size < sizeof(decodeSizes) / sizeof(decodeSizes[0]); size++) {
+		double ns = timeOp(iterations, [&](uint32_t) {
+			codecApply(codec, payload, decodeSizes[size]);
+		});
+		sink = sink + payload[0];
+		printf("{\"bench\":\"decode\",\"payload_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			decodeSizes[size], iterations, ns);
+	}
+}
+
+/**
+ * Parse credential writes of each length, in one format
+ * in_place parses the decoded value where it is. getvalue_copy first copies
+ * it into a std::string, as BLECharacteristic::getValue() does on the device.
+ * Heap use is counted by the operator new of heap_counter.h.
+ */
+void benchParse(const BleCodec &codec, uint32_t iterations, bool tlv) {
+	const char *format = tlv ? "tlv" : "json";
+	for (size_t size = 0; size < sizeof(ssidLengths); size++) {
+		WiFiCredentials credentials;
+		fillCredentials(credentials, ssidLengths[size], 'a');
+		uint8_t payload[BENCH_MAX_PAYLOAD];
+		size_t length = buildPayload(payload, tlv, credentials, codec);
+		codecApply(codec, payload, length);
+
+		for (uint8_t copy = 0; copy < 2; copy++) {
+			uint8_t work[BENCH_MAX_PAYLOAD];
+			uint64_t allocations = heapAllocations();
+			heapResetPeak();
+			size_t before = heapInUse();
+			double ns = timeOp(iterations, [&](uint32_t) {
+				WiFiCredentials parsed;
+				CredCommand command;
+				if (copy) {
+					std::string value((const char *)payload, length);
+					command = tlv
+						? parseTlvCredentials((const uint8_t *)&value[0], length, parsed)
+						: parseCredentials(&value[0], length, parsed);
+				} else {
+					memcpy(work, payload, length);
+					command = tlv ? parseTlvCredentials(work, length, parsed) : parseCredentials((char *)work, length, parsed);
+				}
+				sink = sink + command;
+			});
+			// timeOp() runs a tenth of the iterations more to warm up
+			double allocationsPerOp = (double)(heapAllocations() - allocations) / (iterations + iterations / 10);
+			printf("{\"bench\":\"parse\",\"format\":\"%s\",\"mode\":\"%s\",\"ssid_length\":%u,\"payload_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f,\"allocations_per_op\":%.1f,\"peak_heap_bytes\":%u}\n",
+				format, copy ? "getvalue_copy" : "in_place", ssidLengths[size], (unsigned)length, iterations, ns,
+				allocationsPerOp, (unsigned)(heapPeak() - before));
+		}
+	}
+}
+
+/** Write and read back credentials of each length, in one format */
+void benchCredentials(const BleCodec &codec, uint32_t iterations, bool tlv) {
+	const char *format = tlv ? "tlv" : "json";
+	for (size_t size = 0; size < sizeof(ssidLengths); size++) {
+		NetworkTable networks;
+		MemoryStore store;
+		StdLock lock;
+		CountingHooks hooks;
+		Provisioning provisioning(networks, codec, store, lock, hooks);
+
+		uint8_t payloads[2][BENCH_MAX_PAYLOAD];
+		size_t lengths[2];
+		WiFiCredentials credentials;
+		for (uint8_t variant = 0; variant < 2; variant++) {
+			fillCredentials(credentials, ssidLengths[size], 'a' + variant);
+			lengths[variant] = buildPayload(payloads[variant], tlv, credentials, codec);
+		}
+
+		// Decoded in place, so every call gets a fresh copy
+		uint8_t work[BENCH_MAX_PAYLOAD];
+		memcpy(work, payloads[0], lengths[0]);
+		BleClient client;
+		memset(&client, 0, sizeof(client));
+		if (provisioning.write(&client, work, lengths[0]) != CRED_SET) {
+			fprintf(stderr, "%s payload of %u characters was rejected\n", format, ssidLengths[size]);
+			continue;
+		}
+		double ns = timeOp(iterations, [&](uint32_t index) {
+			memcpy(work, payloads[index & 1], lengths[index & 1]);
+			provisioning.write(&client, work, lengths[index & 1]);
+		});
+		printf("{\"bench\":\"write\",\"format\":\"%s\",\"ssid_length\":%u,\"payload_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			format, ssidLengths[size], (unsigned)lengths[0], iterations, ns);
+
+		MemoryValue value;
+		ns = timeOp(iterations, [&](uint32_t) {
+			provisioning.readCredentials(&client, value);
+		});
+		printf("{\"bench\":\"read_credentials\",\"format\":\"%s\",\"ssid_length\":%u,\"value_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			format, ssidLengths[size], (unsigned)value.value.size(), iterations, ns);
+	}
+}
+
+/**
+ * Read the stored networks at boot, for tables of each size
+ * verify checks the header and CRC of the record, load is Provisioning::load():
+ * one read from the store, verify and deserialize.
+ */
+void benchLoad(const BleCodec &codec, uint32_t iterations) {
+	for (size_t size = 0; size < sizeof(tableSizes); size++) {
+		MemoryStore store;
+		StdLock lock;
+		CountingHooks hooks;
+		{
+			// Longest SSIDs and passwords, so the record has its largest size
+			NetworkTable networks;
+			Provisioning provisioning(networks, codec, store, lock, hooks);
+			for (uint8_t index = 0; index < tableSizes[size]; index++) {
+				char ssid[CRED_SSID_SIZE];
+				char pw[CRED_PW_SIZE];
+				memset(ssid, 'a' + index % 26, sizeof(ssid) - 1);
+				ssid[sizeof(ssid) - 1] = 0;
+				ssid[0] = 'A' + index;
+				memset(pw, 'p', sizeof(pw) - 1);
+				pw[sizeof(pw) - 1] = 0;
+				networks.add(ssid, pw, index);
+			}
+			LockGuard guard(lock);
+			provisioning.save();
+		}
+
+		uint8_t record[NVS_RECORD_HEADER_SIZE + NETWORK_TABLE_MAX_SIZE];
+		size_t length = store.getBytes("networks", record, sizeof(record));
+		double ns = timeOp(iterations, [&](uint32_t) {
+			size_t payloadLength;
+			sink = sink + (nvsRecordOpen(record, length, NETWORKS_RECORD_VERSION, payloadLength) != NULL);
+		});
+		printf("{\"bench\":\"load\",\"step\":\"verify\",\"networks\":%u,\"record_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			tableSizes[size], (unsigned)length, iterations, ns);
+
+		NetworkTable networks;
+		Provisioning provisioning(networks, codec, store, lock, hooks);
+		ns = timeOp(iterations, [&](uint32_t) {
+			provisioning.load();
+		});
+		if (networks.count() != tableSizes[size]) {
+			fprintf(stderr, "Loaded %u of %u networks\n", networks.count(), tableSizes[size]);
+		}
+		printf("{\"bench\":\"load\",\"step\":\"load\",\"networks\":%u,\"record_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			tableSizes[size], (unsigned)length, iterations, ns);
+	}
+}
+
+/** Serialize SSID lists of scans of each size */
+void benchList(const BleCodec &codec, uint32_t iterations) {
+	NetworkTable networks;
+	MemoryStore store;
+	StdLock lock;
+	CountingHooks hooks;
+	Provisioning provisioning(networks, codec, store, lock, hooks);
+	for (size_t size = 0; size < sizeof(listSizes); size++) {
+		ScanSnapshot scan;
+		memset(&scan, 0, sizeof(scan));
+		for (uint8_t ap = 0; ap < listSizes[size]; ap++) {
+			// Longest SSIDs, so the list fills its buffer
+			ScanRecord &record = scan.aps[scan.count++];
+			memset(record.ssid, 'a' + ap % 26, CRED_SSID_SIZE - 1);
+			record.rssi = -40 - ap;
+			record.channel = 1 + ap % 13;
+			record.authMode = 3;
+		}
+		scan.generation = 1;
+
+		MemoryValue value;
+		double ns = timeOp(iterations, [&](uint32_t) {
+			provisioning.readList(scan, value);
+		});
+		printf("{\"bench\":\"read_list\",\"aps\":%u,\"value_bytes\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+			listSizes[size], (unsigned)value.value.size(), iterations, ns);
+	}
+}
+
+/** Select from tables of each size against scans of each size */
+void benchSelect(uint32_t iterations) {
+	for (size_t table = 0; table < sizeof(tableSizes); table++) {
+		NetworkTable networks;
+		char ssid[CRED_SSID_SIZE];
+		for (uint8_t index = 0; index < tableSizes[table]; index++) {
+			snprintf(ssid, sizeof(ssid), "site-network-%02u", index);
+			networks.add(ssid, "password", index % 4);
+		}
+		for (size_t size = 0; size < sizeof(scanSizes); size++) {
+			// Every third AP belongs to a network of the table, the others are neighbours
+			std::vector<ScanRecord> aps(scanSizes[size]);
+			for (uint8_t ap = 0; ap < aps.size(); ap++) {
+				memset(&aps[ap], 0, sizeof(aps[ap]));
+				if (ap % 3 == 0) {
+					snprintf(aps[ap].ssid, sizeof(aps[ap].ssid), "site-network-%02u", (ap / 3) % tableSizes[table]);
+				} else {
+					snprintf(aps[ap].ssid, sizeof(aps[ap].ssid), "neighbour-%02u", ap);
+				}
+				aps[ap].rssi = -45 - ap;
+				aps[ap].channel = 1 + ap % 13;
+				aps[ap].authMode = 3;
+			}
+			double ns = timeOp(iterations, [&](uint32_t) {
+				sink = sink + networks.select(aps.data(), aps.size());
+			});
+			printf("{\"bench\":\"select\",\"networks\":%u,\"aps\":%u,\"iterations\":%u,\"ns_per_op\":%.1f}\n",
+				tableSizes[table], scanSizes[size], iterations, ns);
+		}
+	}
+}
+
+/**
+ * Radio time of one scan in the channel model
+ * Visits the channels of the policy in the order of the scan task, each
+ * for its dwell time. A single pass takes scanPolicyDuration(), a scan
+ * that stops early ends on the channel where allFound() first holds.
+ * @param found - set to the number of stored networks seen
+ * @return uint32_t - scan time in ms
+ */
+uint32_t modelScan(const ScanPolicy &policy, const NetworkTable &networks, const std::vector<ScanRecord> &aps,
+		uint8_t &visited, uint8_t &found) {
+	std::vector<ScanRecord> seen;
+	visited = 0;
+	for (uint8_t channel = 1; channel <= SCAN_MAX_CHANNEL; channel++) {
+		if (!(policy.channelMask & SCAN_CHANNEL(channel))) {
+			continue;
+		}
+		visited++;
+		for (size_t ap = 0; ap < aps.size(); ap++) {
+			if (aps[ap].channel == channel) {
+				seen.push_back(aps[ap]);
+			}
+		}
+		if (!scanPolicySinglePass(policy) && policy.stopWhenKnownFound
+				&& networks.allFound(seen.data(), seen.size())) {
+			break;
+		}
+	}
+	found = 0;
+	for (uint8_t slot = 0; slot < MAX_NETWORKS; slot++) {
+		const NetworkEntry *entry = networks.get(slot);
+		for (size_t ap = 0; entry != NULL && ap < seen.size(); ap++) {
+			if (!strcmp(seen[ap].ssid, entry->ssid)) {
+				found++;
+				break;
+			}
+		}
+	}
+	return scanPolicySinglePass(policy) ? scanPolicyDuration(policy) : (uint32_t)visited * policy.dwellMs;
+}
+
+/**
+ * SSID list scan against connect scan in a channel model
+ * Two stored networks on the channels of knownChannels among neighbour
+ * APs on every channel. Reports the channels visited and the radio time
+ * of each policy, the time the station is away from its own channel.
+ */
+void benchScanModel() {
+	NetworkTable networks;
+	networks.add("home", "password", 0);
+	networks.add("office", "password", 0);
+	const ScanPolicy *policies[] = { &listScanPolicy, &connectScanPolicy };
+	const char *names[] = { "list", "connect" };
+	for (size_t placement = 0; placement < sizeof(knownChannels) / sizeof(knownChannels[0]); placement++) {
+		std::vector<ScanRecord> aps(SCAN_MODEL_NEIGHBOURS);
+		for (uint8_t ap = 0; ap < aps.size(); ap++) {
+			memset(&aps[ap], 0, sizeof(aps[ap]));
+			snprintf(aps[ap].ssid, sizeof(aps[ap].ssid), "neighbour-%02u", ap);
+			aps[ap].channel = 1 + ap % 13;
+		}
+		const char *ssids[] = { "home", "office" };
+		for (uint8_t known = 0; known < 2; known++) {
+			if (knownChannels[placement][known] == 0) {
+				continue;
+			}
+			ScanRecord record;
+			memset(&record, 0, sizeof(record));
+			strcpy(record.ssid, ssids[known]);
+			record.channel = knownChannels[placement][known];
+			aps.push_back(record);
+		}
+		for (size_t policy = 0; policy < 2; policy++) {
+			uint8_t visited;
+			uint8_t found;
+			uint32_t ms = modelScan(*policies[policy], networks, aps, visited, found);
+			printf("{\"bench\":\"scan_model\",\"policy\":\"%s\",\"known_channels\":\"%u+%u\",\"channels\":%u,\"found\":%u,\"scan_ms\":%u}\n",
+				names[policy], knownChannels[placement][0], knownChannels[placement][1], visited, found, ms);
+		}
+	}
+}
+
+/** Status changes at random times, xorshift so every run is the same */
+std::vector<uint32_t> statusChanges() {
+	std::vector<uint32_t> changes;
+	uint32_t state = 2463534242UL;
+	uint32_t now = 0;
+	while (true) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		now += 1 + state % (2 * NOTIFY_CHANGE_INTERVAL);
+		if (now >= NOTIFY_DURATION) {
+			return changes;
+		}
+		changes.push_back(now);
+	}
+}
+
+void printNotify(const char *mode, uint32_t interval, uint32_t changes, uint32_t sends, uint64_t latencySum, uint32_t latencyMax) {
+	printf("{\"bench\":\"notify\",\"mode\":\"%s\",\"interval_ms\":%u,\"hours\":%lu,\"changes\":%u,\"notifications\":%u,"
+		"\"latency_mean_ms\":%.1f,\"latency_max_ms\":%u}\n",
+		mode, interval, NOTIFY_DURATION / 3600000, changes, sends, changes > 0 ? (double)latencySum / changes : 0, latencyMax);
+}
+
+/**
+ * Status notifications over a simulated day, in virtual time
+ * The notification task as the sketch runs it, woken by changes with a
+ * heartbeat, against the polling loop of older versions which sent the
+ * status every second and so reported a change up to a second late.
+ */
+void benchNotify() {
+	std::vector<uint32_t> changes = statusChanges();
+
+	NotifySchedule schedule(NOTIFY_HEARTBEAT);
+	uint32_t now = 0;
+	uint32_t sends = 0;
+	size_t next = 0;
+	while (now < NOTIFY_DURATION) {
+		uint32_t timeout = schedule.nextTimeout(now);
+		uint32_t reasons = 0;
+		if (next < changes.size() && changes[next] <= now + timeout) {
+			// Woken by the change, sent at once
+			now = changes[next++];
+			reasons = STATUS_CHANGED;
+		} else {
+			now += timeout;
+		}
+		if (schedule.wake(reasons, now)) {
+			sends++;
+		}
+	}
+	printNotify("event", NOTIFY_HEARTBEAT, changes.size(), sends, 0, 0);
+
+	uint64_t latencySum = 0;
+	uint32_t latencyMax = 0;
+	for (size_t change = 0; change < changes.size(); change++) {
+		uint32_t latency = NOTIFY_POLL_INTERVAL - changes[change] % NOTIFY_POLL_INTERVAL;
+		latencySum += latency;
+		latencyMax = latency > latencyMax ? latency : latencyMax;
+	}
+	printNotify("poll", NOTIFY_POLL_INTERVAL, changes.size(), NOTIFY_DURATION / NOTIFY_POLL_INTERVAL, latencySum, latencyMax);
+}
+
+void printLog(const char *mode, uint32_t iterations, double ns) {
+	printf("{\"bench\":\"log\",\"mode\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f}\n", mode, iterations, ns);
+}
+
+/**
+ * Cost of a log call in a BLE callback
+ * enabled: queued to the ring, which the log task drains between calls, the
+ * drain is not timed. dropped: the log task is starved and the ring full.
+ * compiled_out: a level above APP_LOG_LEVEL, as in the release build.
+ */
+void benchLog(uint32_t iterations) {
+	char line[LOG_OUTPUT_SIZE];
+	while (appLogNext(line, sizeof(line)) > 0) {
+	}
+	double total = 0;
+	for (uint32_t done = 0; done < iterations; ) {
+		// Less than a ring of lines per batch, so none is dropped
+		uint32_t batch = iterations - done < LOG_SLOTS / 2 ? iterations - done : LOG_SLOTS / 2;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (uint32_t index = 0; index < batch; index++) {
+			LOG_INFO("BLE client %d connected, %d of %d", (int)(done + index) & 0xFF, 1, MAX_BLE_CLIENTS);
+		}
+		total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		done += batch;
+		while (appLogNext(line, sizeof(line)) > 0) {
+		}
+	}
+	printLog("enabled", iterations, total / iterations);
+
+	double ns = timeOp(iterations, [&](uint32_t index) {
+		LOG_INFO("BLE client %d connected, %d of %d", (int)index & 0xFF, 1, MAX_BLE_CLIENTS);
+	});
+	printLog("dropped", iterations, ns);
+	while (appLogNext(line, sizeof(line)) > 0) {
+	}
+
+#if APP_LOG_LEVEL < LOG_LEVEL_DEBUG
+	ns = timeOp(iterations, [&](uint32_t index) {
+		LOG_DEBUG("BLE client %d connected, %d of %d", (int)index & 0xFF, 1, MAX_BLE_CLIENTS);
+		sink = index;
+	});
+	printLog("compiled_out", iterations, ns);
+#endif
+}
+
+}
+
+void runBenchmarks(const char *deviceName, uint32_t iterations) {
+	if (iterations == 0) {
+		iterations = 1;
+	}
+	BleCodec codec;
+	codecInit(codec, deviceName);
+	benchDecode(codec, iterations);
+	benchParse(codec, iterations, false);
+	benchParse(codec, iterations, true);
+	benchCredentials(codec, iterations, false);
+	benchCredentials(codec, iterations, true);
+	benchLoad(codec, iterations);
+	benchList(codec, iterations);
+	benchSelect(iterations);
+	benchScanModel();
+	benchNotify();
+	benchLog(iterations);
+}
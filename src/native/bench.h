@@ -0,0 +1,37 @@
+/**
+ * Micro-benchmarks of the provisioning code paths
+ *
+ * Times the code the BLE callbacks and the connection manager run on the
+ * device, over the in-memory backends: payload decoding, credential
+ * parsing with its heap use, credential writes (decode, parse and store)
+ * and reads in the JSON and TLV formats for several SSID and password
+ * lengths, the boot time read of the stored networks for several table
+ * sizes, SSID list serialization for several scan sizes, and network
+ * selection for several table and scan sizes. The scan model compares the
+ * channels visited by the SSID list scan and the connect scan. The notify
+ * case counts status notifications and their latency after a change over
+ * a simulated day, against the older polling loop. The log case times a
+ * log call of a callback, queued, dropped on a full ring, and compiled
+ * out below APP_LOG_LEVEL.
+ * Prints one JSON object per case and line, so results can be compared
+ * between builds.
+ * Not built for the ESP32.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/** Iterations of each case without an argument */
+#define BENCH_DEFAULT_ITERATIONS 20000
+
+/**
+ * Run all cases and print their results to stdout
+ * @param deviceName - key of the payload codec
+ */
+void runBenchmarks(const char *deviceName, uint32_t iterations);
+
+#endif
@@ -0,0 +1,193 @@
+/**
+ * GATT over a TCP socket for the native build
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "gatt_socket.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+
+#include "../app_log.h"
+
+bool gattSend(int fd, const uint8_t *data, size_t length) {
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+bool gattReceive(int fd, uint8_t *data, size_t length) {
+	while (length > 0) {
+		ssize_t received = recv(fd, data, length, 0);
+		if (received <= 0) {
+			return false;
+		}
+		data += received;
+		length -= received;
+	}
+	return true;
+}
+
+int gattConnect(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	// Requests are small and answered one by one
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	return fd;
+}
+
+int gattRequest(int fd, uint8_t op, const char *uuid, const uint8_t *value, size_t length, uint8_t *response, size_t &responseLength) {
+	uint8_t header[GATT_REQUEST_HEADER_SIZE];
+	if (length > GATT_MAX_VALUE || strlen(uuid) != UUID_STRING_LENGTH) {
+		return -1;
+	}
+	header[0] = op;
+	memcpy(header + 1, uuid, UUID_STRING_LENGTH);
+	header[1 + UUID_STRING_LENGTH] = length & 0xFF;
+	header[2 + UUID_STRING_LENGTH] = length >> 8;
+	if (!gattSend(fd, header, sizeof(header)) || !gattSend(fd, value, length)) {
+		return -1;
+	}
+	uint8_t reply[GATT_RESPONSE_HEADER_SIZE];
+	if (!gattReceive(fd, reply, sizeof(reply))) {
+		return -1;
+	}
+	responseLength = reply[1] | (reply[2] << 8);
+	if (responseLength > GATT_MAX_VALUE || !gattReceive(fd, response, responseLength)) {
+		return -1;
+	}
+	return reply[0];
+}
+
+GattSocketServer::GattSocketServer(Provisioning &provisioning, const ScanSnapshot &scan, CountingHooks &hooks)
+	: provisioning(provisioning), scan(scan), hooks(hooks), listener(-1), handled(0) {
+}
+
+uint16_t GattSocketServer::listen(uint16_t port) {
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return 0;
+	}
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	if (bind(listener, (sockaddr *)&address, sizeof(address)) != 0
+			|| ::listen(listener, SOMAXCONN) != 0
+			|| getsockname(listener, (sockaddr *)&address, &addressLength) != 0) {
+		close(listener);
+		listener = -1;
+		return 0;
+	}
+	return ntohs(address.sin_port);
+}
+
+void GattSocketServer::serve() {
+	while (true) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			// stop() shut the listener down
+			return;
+		}
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		std::thread(&GattSocketServer::session, this, fd).detach();
+	}
+}
+
+void GattSocketServer::stop() {
+	if (listener >= 0) {
+		shutdown(listener, SHUT_RDWR);
+		close(listener);
+		listener = -1;
+	}
+}
+
+void GattSocketServer::session(int fd) {
+	uint8_t header[GATT_REQUEST_HEADER_SIZE];
+	uint8_t value[GATT_MAX_VALUE];
+	char uuid[UUID_STRING_LENGTH + 1];
+	MemoryValue response;
+	// Every socket is one connection, with its own credentials protocol
+	BleClient client;
+	memset(&client, 0, sizeof(client));
+	client.used = true;
+	client.connId = (uint16_t)fd;
+	client.mtu = GATT_MAX_VALUE;
+	while (gattReceive(fd, header, sizeof(header))) {
+		size_t length = header[1 + UUID_STRING_LENGTH] | (header[2 + UUID_STRING_LENGTH] << 8);
+		if (length > GATT_MAX_VALUE || !gattReceive(fd, value, length)) {
+			break;
+		}
+		memcpy(uuid, header + 1, UUID_STRING_LENGTH);
+		uuid[UUID_STRING_LENGTH] = 0;
+
+		uint8_t reply[GATT_RESPONSE_HEADER_SIZE] = { GATT_STATUS_NOT_SUPPORTED, 0, 0 };
+		{
+			std::lock_guard<std::mutex> guard(gattMutex);
+			reply[0] = handle(client, header[0], uuid, value, length, response);
+			handled++;
+		}
+		size_t responseLength = reply[0] == GATT_STATUS_OK ? response.value.size() : 0;
+		reply[1] = responseLength & 0xFF;
+		reply[2] = responseLength >> 8;
+		if (!gattSend(fd, reply, sizeof(reply)) || !gattSend(fd, response.value.data(), responseLength)) {
+			break;
+		}
+	}
+	close(fd);
+}
+
+uint8_t GattSocketServer::handle(BleClient &client, uint8_t op, const char *uuid, uint8_t *value, size_t length, MemoryValue &response) {
+	response.value.clear();
+	if (!strcmp(uuid, WIFI_UUID)) {
+		if (op == GATT_OP_WRITE) {
+			if (length > 0) {
+				provisioning.write(&client, value, length);
+			}
+			return GATT_STATUS_OK;
+		}
+		if (op == GATT_OP_READ) {
+			provisioning.readCredentials(&client, response);
+			return GATT_STATUS_OK;
+		}
+	} else if (!strcmp(uuid, WIFI_LIST_UUID) && op == GATT_OP_READ) {
+		provisioning.readList(scan, response);
+		return GATT_STATUS_OK;
+	} else if (!strcmp(uuid, WIFI_STATUS_UUID) && op == GATT_OP_READ) {
+		// There is no radio, stored credentials count as connected to the primary network
+		uint8_t status[2] = { hooks.hasCredentials ? (uint8_t)1 : (uint8_t)0, 0 };
+		response.setValue(status, sizeof(status));
+		return GATT_STATUS_OK;
+	}
+	LOG_DEBUG("Unsupported GATT request %u on %s", op, uuid);
+	return GATT_STATUS_NOT_SUPPORTED;
+}
@@ -0,0 +1,98 @@
+/**
+ * GATT over a TCP socket for the native build
+ *
+ * Serves the WiFi, SSID list and status characteristics of the device to
+ * host clients, so the provisioning logic can be driven by many clients at
+ * once. Every request is answered before the next one is handled, the way
+ * the BLE stack runs all callbacks in one task. Not built for the ESP32.
+ *
+ * Frames, multi byte fields little endian:
+ *   request   op (1), characteristic UUID (36 characters), length (2), value
+ *   response  status (1), length (2), value
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef GATT_SOCKET_H
+#define GATT_SOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#include "memory_hal.h"
+#include "../ble_uuids.h"
+#include "../provisioning.h"
+#include "../scan_cache.h"
+
+/** Default port, the server listens on the loopback interface only */
+#define GATT_SOCKET_PORT 7755
+#define GATT_OP_READ 0x01
+#define GATT_OP_WRITE 0x02
+#define GATT_STATUS_OK 0x00
+/** Unknown operation or characteristic, or the operation is not allowed on it */
+#define GATT_STATUS_NOT_SUPPORTED 0x01
+/** Largest value of a request or response */
+#define GATT_MAX_VALUE 1024
+#define GATT_REQUEST_HEADER_SIZE (1 + UUID_STRING_LENGTH + 2)
+#define GATT_RESPONSE_HEADER_SIZE 3
+
+/** Write all bytes, false if the connection failed */
+bool gattSend(int fd, const uint8_t *data, size_t length);
+/** Read exactly length bytes, false if the connection closed first */
+bool gattReceive(int fd, uint8_t *data, size_t length);
+
+/**
+ * Connect to a server on the loopback interface
+ * @return int - socket, -1 on failure
+ */
+int gattConnect(uint16_t port);
+/**
+ * Send one request and wait for its response
+ * @param response - receives up to GATT_MAX_VALUE bytes
+ * @return int - response status, -1 if the connection failed
+ */
+int gattRequest(int fd, uint8_t op, const char *uuid, const uint8_t *value, size_t length, uint8_t *response, size_t &responseLength);
+
+/**
+ * GattSocketServer
+ * One thread per connection, requests of all connections take turns
+ */
+class GattSocketServer {
+public:
+	/**
+	 * @param scan - served on the SSID list characteristic
+	 * @param hooks - its stored credentials set the status value
+	 */
+	GattSocketServer(Provisioning &provisioning, const ScanSnapshot &scan, CountingHooks &hooks);
+
+	/**
+	 * Listen on 127.0.0.1
+	 * @param port - 0 for any free port
+	 * @return uint16_t - port listened on, 0 on failure
+	 */
+	uint16_t listen(uint16_t port);
+	/** Accept connections until stop() */
+	void serve();
+	void stop();
+
+	/** Requests handled so far */
+	uint32_t requests() const {
+		return handled;
+	}
+
+private:
+	void session(int fd);
+	/** @return uint8_t - response status, response is set if it is GATT_STATUS_OK */
+	uint8_t handle(BleClient &client, uint8_t op, const char *uuid, uint8_t *value, size_t length, MemoryValue &response);
+
+	Provisioning &provisioning;
+	const ScanSnapshot &scan;
+	CountingHooks &hooks;
+	/** Taken for every request, like the single BLE task on the device */
+	std::mutex gattMutex;
+	int listener;
+	uint32_t handled;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * Heap use of the native build
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "heap_counter.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+std::atomic<size_t> inUse(0);
+std::atomic<size_t> peak(0);
+
+}
+
+uint64_t heapAllocations() {
+	return allocations.load(std::memory_order_relaxed);
+}
+
+size_t heapInUse() {
+	return inUse.load(std::memory_order_relaxed);
+}
+
+size_t heapPeak() {
+	return peak.load(std::memory_order_relaxed);
+}
+
+void heapResetPeak() {
+	peak.store(inUse.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+// The unit tests bring their own main() and allocator
+#ifndef PIO_UNIT_TESTING
+
+/** Size of the block in front of every allocation, keeps the alignment of malloc */
+#define HEAP_HEADER_SIZE 16
+
+void *operator new(size_t size) {
+	uint8_t *block = (uint8_t *)malloc(HEAP_HEADER_SIZE + size);
+	if (block == NULL) {
+		throw std::bad_alloc();
+	}
+	*(size_t *)block = size;
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t used = inUse.fetch_add(size, std::memory_order_relaxed) + size;
+	size_t highest = peak.load(std::memory_order_relaxed);
+	while (used > highest && !peak.compare_exchange_weak(highest, used, std::memory_order_relaxed)) {
+	}
+	return block + HEAP_HEADER_SIZE;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return operator new(size);
+	} catch (const std::bad_alloc &) {
+		return NULL;
+	}
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+	return operator new(size, tag);
+}
+
+void operator delete(void *memory) noexcept {
+	if (memory == NULL) {
+		return;
+	}
+	uint8_t *block = (uint8_t *)memory - HEAP_HEADER_SIZE;
+	inUse.fetch_sub(*(size_t *)block, std::memory_order_relaxed);
+	free(block);
+}
+
+void operator delete[](void *memory) noexcept {
+	operator delete(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+	operator delete(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+	operator delete(memory);
+}
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * Heap use of the native build
+ *
+ * The native program replaces the global operator new and delete with
+ * versions that count allocations and the bytes in use, so the bench can
+ * report the heap a code path needs. The unit tests bring their own
+ * main(), and their own allocator where they need one, so there the
+ * counters stay 0. Not built for the ESP32.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef HEAP_COUNTER_H
+#define HEAP_COUNTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Number of operator new calls so far */
+uint64_t heapAllocations();
+/** Bytes allocated through operator new and not deleted yet */
+size_t heapInUse();
+/** Most bytes in use since the last heapResetPeak() */
+size_t heapPeak();
+/** Start a new peak at the bytes in use now */
+void heapResetPeak();
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * Virtual time simulation of WiFi link churn
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "link_sim.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "../network_table.h"
+
+namespace {
+
+enum SimEventType {
+	/** An AP goes down or comes back */
+	SIM_AP_CHANGE = 0,
+	SIM_SCAN_DONE,
+	/** Association finished, successful or not */
+	SIM_ASSOCIATED,
+	SIM_GOT_IP,
+	/** The driver reports a lost link or a failed connect */
+	SIM_LOST
+};
+
+struct SimEvent {
+	uint64_t time;
+	uint8_t type;
+	uint8_t ap;
+	/** Attempt or scan the event belongs to, events of older ones are dropped */
+	uint32_t token;
+
+	bool operator>(const SimEvent &other) const {
+		return time > other.time;
+	}
+};
+
+/**
+ * Simulation
+ * The platform side of ConnManager, with the radio replaced by scheduled events
+ */
+class Simulation: public ConnActions {
+public:
+	Simulation(const SimConfig &config, SimReport &report)
+		: config(config), report(report), manager(*this, config.manager), now(0), scanCount(0),
+		  selectedAp(NETWORK_NONE), cachedAp(NETWORK_NONE), linkAp(NETWORK_NONE), attempt(0), scanToken(0),
+		  lossPending(false), lossTime(0), state(CM_IDLE), stateTime(0), randomState(config.seed != 0 ? config.seed : 1) {
+		memset(apUp, 0, sizeof(apUp));
+	}
+
+	void run() {
+		for (uint8_t ap = 0; ap < config.apCount; ap++) {
+			apUp[ap] = true;
+			schedule(randomDuration(config.aps[ap].meanUpMs), SIM_AP_CHANGE, ap, 0);
+			networks.add(config.aps[ap].ssid, "password", config.aps[ap].priority);
+		}
+		manager.seed(nextRandom());
+		manager.begin(true, 0);
+
+		while (!events.empty()) {
+			uint32_t timeout = manager.nextTimeout((uint32_t)now);
+			if (timeout != CM_NO_TIMEOUT && now + timeout <= events.top().time) {
+				if (now + timeout >= config.durationMs) {
+					break;
+				}
+				now += timeout;
+				manager.tick((uint32_t)now);
+				continue;
+			}
+			SimEvent event = events.top();
+			if (event.time >= config.durationMs) {
+				break;
+			}
+			events.pop();
+			now = event.time;
+			process(event);
+		}
+		now = config.durationMs;
+		account();
+
+		std::sort(latencies.begin(), latencies.end());
+		report.latencyP50 = percentile(50);
+		report.latencyP90 = percentile(90);
+		report.latencyP99 = percentile(99);
+		report.latencyMax = latencies.empty() ? 0 : latencies.back();
+	}
+
+	void startScan() {
+		report.scans++;
+		scanToken++;
+		schedule(now + SIM_SCAN_TIME, SIM_SCAN_DONE, 0, scanToken);
+	}
+
+	bool selectNetwork() {
+		uint8_t bestAp;
+		if (networks.select(scan, scanCount, &bestAp) == NETWORK_NONE) {
+			return false;
+		}
+		selectedAp = scanAp[bestAp];
+		return true;
+	}
+
+	bool connectCached() {
+		if (cachedAp == NETWORK_NONE) {
+			return false;
+		}
+		associate(cachedAp);
+		return true;
+	}
+
+	void connect() {
+		associate(selectedAp);
+	}
+
+	void disconnect() {
+		attempt++;
+		linkAp = NETWORK_NONE;
+	}
+
+	void connected(bool fast) {
+		if (lossPending) {
+			latencies.push_back(now - lossTime);
+			report.reconnects++;
+			if (fast) {
+				report.fastReconnects++;
+			}
+			lossPending = false;
+		}
+	}
+
+	void stateChanged(ConnManagerState next, uint32_t /* timeout */) {
+		account();
+		state = next;
+	}
+
+private:
+	void process(const SimEvent &event) {
+		const SimAp &model = config.aps[event.ap];
+		ConnEvent connEvent = { CM_EVT_LOST, 0 };
+		switch (event.type) {
+			case SIM_AP_CHANGE:
+				apUp[event.ap] = !apUp[event.ap];
+				schedule(now + randomDuration(apUp[event.ap] ? model.meanUpMs : model.meanDownMs), SIM_AP_CHANGE, event.ap, 0);
+				if (!apUp[event.ap] && linkAp == event.ap) {
+					// The manager only hears of it when the driver gives up on the beacons
+					linkAp = NETWORK_NONE;
+					lossPending = true;
+					lossTime = now;
+					report.linkLosses++;
+					schedule(now + SIM_BEACON_TIMEOUT, SIM_LOST, event.ap, attempt);
+				}
+				break;
+			case SIM_SCAN_DONE:
+				if (event.token != scanToken) {
+					break;
+				}
+				fillScan();
+				connEvent.type = CM_EVT_SCAN_DONE;
+				manager.handle(connEvent, (uint32_t)now);
+				break;
+			case SIM_ASSOCIATED:
+				if (event.token != attempt) {
+					break;
+				}
+				if (apUp[event.ap] && rssiAt(event.ap) >= NETWORK_MIN_RSSI) {
+					schedule(now + model.dhcpDelayMs, SIM_GOT_IP, event.ap, attempt);
+				} else {
+					schedule(now + SIM_ASSOC_FAIL_TIME - SIM_ASSOC_TIME, SIM_LOST, event.ap, attempt);
+				}
+				break;
+			case SIM_GOT_IP:
+				if (event.token != attempt) {
+					break;
+				}
+				if (apUp[event.ap]) {
+					linkAp = event.ap;
+					cachedAp = event.ap;
+					connEvent.type = CM_EVT_GOT_IP;
+				}
+				manager.handle(connEvent, (uint32_t)now);
+				break;
+			case SIM_LOST:
+				if (event.token != attempt) {
+					break;
+				}
+				linkAp = NETWORK_NONE;
+				manager.handle(connEvent, (uint32_t)now);
+				break;
+		}
+	}
+
+	void associate(uint8_t ap) {
+		report.connectAttempts++;
+		attempt++;
+		linkAp = NETWORK_NONE;
+		schedule(now + SIM_ASSOC_TIME, SIM_ASSOCIATED, ap, attempt);
+	}
+
+	/** APs that are up, with their RSSI at the end of the scan */
+	void fillScan() {
+		scanCount = 0;
+		for (uint8_t ap = 0; ap < config.apCount; ap++) {
+			if (!apUp[ap]) {
+				continue;
+			}
+			ScanRecord &record = scan[scanCount];
+			memset(&record, 0, sizeof(record));
+			strncpy(record.ssid, config.aps[ap].ssid, sizeof(record.ssid) - 1);
+			record.rssi = rssiAt(ap);
+			record.channel = 1;
+			record.authMode = 3;
+			scanAp[scanCount++] = ap;
+		}
+	}
+
+	int8_t rssiAt(uint8_t ap) const {
+		const SimAp &model = config.aps[ap];
+		if (model.swingPeriodMs == 0) {
+			return model.rssi;
+		}
+		double phase = (double)(now % model.swingPeriodMs) / model.swingPeriodMs;
+		return (int8_t)lround(model.rssi + model.rssiSwing * sin(2 * M_PI * phase));
+	}
+
+	/** Add the time since the last state change to the report */
+	void account() {
+		uint64_t elapsed = now - stateTime;
+		if (state == CM_SCANNING || state == CM_CONNECTING) {
+			report.radioBusyMs += elapsed;
+		} else if (state == CM_CONNECTED) {
+			report.connectedMs += elapsed;
+		}
+		stateTime = now;
+	}
+
+	void schedule(uint64_t time, uint8_t type, uint8_t ap, uint32_t token) {
+		SimEvent event = { time, type, ap, token };
+		events.push(event);
+	}
+
+	uint32_t percentile(uint8_t percent) const {
+		if (latencies.empty()) {
+			return 0;
+		}
+		size_t index = latencies.size() * percent / 100;
+		return latencies[index < latencies.size() ? index : latencies.size() - 1];
+	}
+
+	/** Exponentially distributed, at least 1 ms */
+	uint64_t randomDuration(uint32_t mean) {
+		double uniform = ((nextRandom() >> 8) + 1) / 16777216.0;
+		double duration = -log(uniform) * mean;
+		return duration >= 1 ? (uint64_t)duration : 1;
+	}
+
+	/** xorshift32 */
+	uint32_t nextRandom() {
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+		return randomState;
+	}
+
+	const SimConfig &config;
+	SimReport &report;
+	NetworkTable networks;
+	ConnManager manager;
+	std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent> > events;
+	uint64_t now;
+	bool apUp[SIM_MAX_APS];
+	/** Result of the last scan, scanAp maps its records to APs */
+	ScanRecord scan[SIM_MAX_APS];
+	uint8_t scanAp[SIM_MAX_APS];
+	uint8_t scanCount;
+	uint8_t selectedAp;
+	/** AP of the last successful association */
+	uint8_t cachedAp;
+	/** AP the station has a link to, NETWORK_NONE if none */
+	uint8_t linkAp;
+	uint32_t attempt;
+	uint32_t scanToken;
+	/** A link was lost and has not come back yet */
+	bool lossPending;
+	uint64_t lossTime;
+	std::vector<uint32_t> latencies;
+	ConnManagerState state;
+	uint64_t stateTime;
+	uint32_t randomState;
+};
+
+}
+
+bool runLinkSimulation(const SimConfig &config, SimReport &report) {
+	memset(&report, 0, sizeof(report));
+	if (config.apCount == 0 || config.apCount > SIM_MAX_APS) {
+		return false;
+	}
+	Simulation simulation(config, report);
+	simulation.run();
+	return true;
+}
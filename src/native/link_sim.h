@@ -0,0 +1,84 @@
+/**
+ * Virtual time simulation of WiFi link churn
+ *
+ * Drives ConnManager, the state machine the sketch runs, against modelled
+ * access points on a simulated clock: APs go down and come back at random,
+ * their RSSI swings, scans, associations and DHCP take the time they take
+ * on the device. Reports how long reconnects took after a link was lost
+ * and how long the radio was busy scanning and connecting. Events are
+ * processed in time order without waiting, so hours simulate in
+ * milliseconds. Not built for the ESP32.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef LINK_SIM_H
+#define LINK_SIM_H
+
+#include <stdint.h>
+
+#include "../conn_manager.h"
+
+/** Time in ms of a full scan */
+#define SIM_SCAN_TIME 2000
+/** Time in ms of a successful association */
+#define SIM_ASSOC_TIME 300
+/** Time in ms until the driver gives up on an AP that does not answer */
+#define SIM_ASSOC_FAIL_TIME 3000
+/** Time in ms of missed beacons until the driver reports a lost link */
+#define SIM_BEACON_TIMEOUT 3000
+/** Most APs of a simulation */
+#define SIM_MAX_APS 8
+
+/** Access point model */
+struct SimAp {
+	const char *ssid;
+	/** Priority of its network in the network table */
+	uint8_t priority;
+	/** Mean RSSI in dBm, swinging by rssiSwing dB with a period of swingPeriodMs */
+	int8_t rssi;
+	uint8_t rssiSwing;
+	uint32_t swingPeriodMs;
+	/** Mean time in ms the AP stays up, and stays down after a failure, both exponentially distributed */
+	uint32_t meanUpMs;
+	uint32_t meanDownMs;
+	/** Time in ms from association to the IP address */
+	uint32_t dhcpDelayMs;
+};
+
+struct SimConfig {
+	const SimAp *aps;
+	uint8_t apCount;
+	/** Simulated time in ms */
+	uint64_t durationMs;
+	uint32_t seed;
+	ConnManagerConfig manager;
+};
+
+struct SimReport {
+	/** Links lost while connected */
+	uint32_t linkLosses;
+	/** Links back after a loss, latencies are measured from the loss */
+	uint32_t reconnects;
+	/** Of those, links back through the cached AP or the debounce window, without a scan */
+	uint32_t fastReconnects;
+	uint32_t scans;
+	uint32_t connectAttempts;
+	/** Reconnect latency percentiles in ms */
+	uint32_t latencyP50;
+	uint32_t latencyP90;
+	uint32_t latencyP99;
+	uint32_t latencyMax;
+	/** Time in ms spent scanning or connecting */
+	uint64_t radioBusyMs;
+	/** Time in ms with an IP address */
+	uint64_t connectedMs;
+};
+
+/**
+ * Run a simulation
+ * @return bool - false if the configuration is out of range
+ */
+bool runLinkSimulation(const SimConfig &config, SimReport &report);
+
+#endif
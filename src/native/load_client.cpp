@@ -0,0 +1,125 @@
+/**
+ * Load client for the GATT socket transport
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "load_client.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gatt_socket.h"
+
+namespace {
+
+const char * const operationNames[LOAD_OPERATIONS] = { "write credentials", "read credentials", "read list", "read status" };
+
+/** Results of one session, merged when all are done */
+struct SessionResult {
+	bool connected;
+	uint32_t failures;
+	std::vector<uint32_t> latencies[LOAD_OPERATIONS];
+};
+
+void runSession(uint16_t port, uint32_t session, uint32_t rounds, const BleCodec &codec, SessionResult &result) {
+	result.connected = false;
+	result.failures = 0;
+	int fd = gattConnect(port);
+	if (fd < 0) {
+		return;
+	}
+	result.connected = true;
+
+	// Every session stores its own networks, so every write changes the table
+	char json[128];
+	int jsonLength = snprintf(json, sizeof(json),
+		"{\"ssidPrim\":\"session-%u\",\"pwPrim\":\"password-%u\",\"ssidSec\":\"\",\"pwSec\":\"\"}", session, session);
+	uint8_t payload[128];
+	uint8_t response[GATT_MAX_VALUE];
+
+	for (uint32_t round = 0; round < rounds; round++) {
+		for (uint8_t operation = 0; operation < LOAD_OPERATIONS; operation++) {
+			uint8_t op = GATT_OP_READ;
+			const char *uuid = WIFI_UUID;
+			size_t length = 0;
+			if (operation == LOAD_WRITE_CREDENTIALS) {
+				op = GATT_OP_WRITE;
+				memcpy(payload, json, jsonLength);
+				codecApply(codec, payload, jsonLength);
+				length = jsonLength;
+			} else if (operation == LOAD_READ_LIST) {
+				uuid = WIFI_LIST_UUID;
+			} else if (operation == LOAD_READ_STATUS) {
+				uuid = WIFI_STATUS_UUID;
+			}
+			size_t responseLength;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			int status = gattRequest(fd, op, uuid, payload, length, response, responseLength);
+			uint32_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			if (status < 0) {
+				result.failures++;
+				close(fd);
+				return;
+			}
+			if (status != GATT_STATUS_OK) {
+				result.failures++;
+				continue;
+			}
+			result.latencies[operation].push_back(elapsed);
+		}
+	}
+	close(fd);
+}
+
+}
+
+void runLoad(uint16_t port, uint32_t sessions, uint32_t rounds, const BleCodec &codec, LoadReport &report) {
+	memset(&report, 0, sizeof(report));
+	std::vector<SessionResult> results(sessions);
+	std::vector<std::thread> threads;
+	threads.reserve(sessions);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint32_t session = 0; session < sessions; session++) {
+		threads.push_back(std::thread(runSession, port, session, rounds, std::cref(codec), std::ref(results[session])));
+	}
+	for (size_t index = 0; index < threads.size(); index++) {
+		threads[index].join();
+	}
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<uint32_t> latencies[LOAD_OPERATIONS];
+	for (size_t index = 0; index < results.size(); index++) {
+		if (results[index].connected) {
+			report.sessions++;
+		}
+		report.failures += results[index].failures;
+		for (uint8_t operation = 0; operation < LOAD_OPERATIONS; operation++) {
+			latencies[operation].insert(latencies[operation].end(),
+				results[index].latencies[operation].begin(), results[index].latencies[operation].end());
+		}
+	}
+	for (uint8_t operation = 0; operation < LOAD_OPERATIONS; operation++) {
+		std::vector<uint32_t> &values = latencies[operation];
+		LoadLatency &latency = report.latency[operation];
+		report.requests += values.size();
+		latency.count = values.size();
+		if (values.empty()) {
+			continue;
+		}
+		std::sort(values.begin(), values.end());
+		latency.p50 = values[values.size() * 50 / 100];
+		latency.p99 = values[std::min(values.size() * 99 / 100, values.size() - 1)];
+		latency.max = values.back();
+	}
+}
+
+const char *loadOperationName(uint8_t operation) {
+	return operation < LOAD_OPERATIONS ? operationNames[operation] : "?";
+}
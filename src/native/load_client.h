@@ -0,0 +1,57 @@
+/**
+ * Load client for the GATT socket transport
+ *
+ * Runs many provisioning sessions at once against a GattSocketServer, each
+ * on its own connection and thread, the way a crowd of web app clients
+ * would: write credentials, read them back, read the SSID list and the
+ * status. Reports throughput and per operation latency. Not built for the
+ * ESP32.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef LOAD_CLIENT_H
+#define LOAD_CLIENT_H
+
+#include <stdint.h>
+
+#include "../ble_codec.h"
+
+/** Operations of a session round, in order */
+enum LoadOperation {
+	LOAD_WRITE_CREDENTIALS = 0,
+	LOAD_READ_CREDENTIALS,
+	LOAD_READ_LIST,
+	LOAD_READ_STATUS,
+	LOAD_OPERATIONS
+};
+
+/** Latency of one operation in us */
+struct LoadLatency {
+	uint32_t count;
+	uint32_t p50;
+	uint32_t p99;
+	uint32_t max;
+};
+
+struct LoadReport {
+	/** Sessions that connected */
+	uint32_t sessions;
+	/** Requests answered, and requests that failed or got an error status */
+	uint32_t requests;
+	uint32_t failures;
+	double seconds;
+	LoadLatency latency[LOAD_OPERATIONS];
+};
+
+/**
+ * Run sessions against a server on the loopback interface
+ * @param codec - codec of the device, payloads are encoded like the web app does
+ * @param rounds - rounds of all operations per session
+ */
+void runLoad(uint16_t port, uint32_t sessions, uint32_t rounds, const BleCodec &codec, LoadReport &report);
+
+/** Name of an operation for reports */
+const char *loadOperationName(uint8_t operation);
+
+#endif
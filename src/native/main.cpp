@@ -0,0 +1,295 @@
+/**
+ * Entry point of the native build
+ *
+ * Without arguments runs one provisioning session on the host, over the
+ * in-memory backends: takes over credentials stored by an older version,
+ * writes new ones the way the web app does, reads them and the SSID list
+ * back, sends the same credentials again and erases them. Prints the
+ * characteristic values and the log. Built with -DAPP_TRACE=1 it prints the
+ * trace of the session last, see trace.h.
+ *
+ * "simulate [hours]" runs the connection manager against two flaky APs on
+ * a virtual clock, see link_sim.h, and prints the reconnect statistics.
+ *
+ * "serve [port]" serves the characteristics over TCP, see gatt_socket.h.
+ * "load [sessions] [rounds] [port]" runs that many concurrent sessions,
+ * see load_client.h, against the server on port, or against a server of
+ * its own if no port is given, and prints throughput and latencies.
+ *
+ * "bench [iterations]" times the provisioning code paths, see bench.h, and
+ * prints one JSON line per case.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+// The unit tests of test/ bring their own main()
+#ifndef PIO_UNIT_TESTING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "gatt_socket.h"
+#include "link_sim.h"
+#include "load_client.h"
+#include "memory_hal.h"
+#include "../app_log.h"
+#include "../ble_codec.h"
+#include "../network_table.h"
+#include "../provisioning.h"
+#include "../trace.h"
+
+/** Name the payload codec of the native build is keyed with */
+#define NATIVE_DEVICE_NAME "ESP32-000000000000"
+/** Defaults of the load command */
+#define LOAD_DEFAULT_SESSIONS 200
+#define LOAD_DEFAULT_ROUNDS 20
+
+namespace {
+
+uint32_t hostClock() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+#if APP_TRACE
+uint32_t hostMicros() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printTrace() {
+	char line[TRACE_LINE_SIZE];
+	size_t length;
+	TraceExport trace;
+	while ((length = trace.next(line, sizeof(line))) > 0) {
+		fwrite(line, 1, length, stdout);
+	}
+}
+#endif
+
+void printLog() {
+	char line[LOG_OUTPUT_SIZE];
+	size_t length;
+	while ((length = appLogNext(line, sizeof(line))) > 0) {
+		fwrite(line, 1, length, stdout);
+	}
+}
+
+/** Encode a payload like the web app and write it as a client */
+CredCommand writeText(Provisioning &provisioning, const BleCodec &codec, BleClient *client, const char *text) {
+	std::vector<uint8_t> payload(text, text + strlen(text));
+	codecApply(codec, payload.data(), payload.size());
+	TRACE(TRACE_CRED_RECEIVED, payload.size());
+	CredCommand command = provisioning.write(client, payload.data(), payload.size());
+	TRACE(TRACE_CRED_DONE, command);
+	return command;
+}
+
+/** Print a characteristic value, decoded if the codec is given */
+void printValue(const char *name, const MemoryValue &value, const BleCodec *codec) {
+	std::vector<uint8_t> decoded(value.value);
+	if (codec != NULL) {
+		codecApply(*codec, decoded.data(), decoded.size());
+	}
+	printf("%s: %.*s\n", name, (int)decoded.size(), (const char *)decoded.data());
+}
+
+/** Three APs, the last one open */
+void fillScan(ScanSnapshot &scan) {
+	memset(&scan, 0, sizeof(scan));
+	const char *ssids[] = { "home", "office", "cafe" };
+	for (uint8_t index = 0; index < 3; index++) {
+		ScanRecord &ap = scan.aps[scan.count++];
+		strcpy(ap.ssid, ssids[index]);
+		ap.rssi = -50 - 10 * index;
+		ap.channel = 1 + 5 * index;
+		ap.authMode = index < 2 ? 3 : SCAN_AUTH_OPEN;
+	}
+	scan.generation = 1;
+}
+
+/** Print a load report */
+void printLoad(const LoadReport &report) {
+	printf("Sessions %u, requests %u, failures %u in %.3f s, %.0f requests/s\n",
+		report.sessions, report.requests, report.failures, report.seconds,
+		report.seconds > 0 ? report.requests / report.seconds : 0);
+	for (uint8_t operation = 0; operation < LOAD_OPERATIONS; operation++) {
+		const LoadLatency &latency = report.latency[operation];
+		printf("%-18s %7u x  p50 %6u us  p99 %6u us  max %6u us\n", loadOperationName(operation),
+			latency.count, latency.p50, latency.p99, latency.max);
+	}
+}
+
+/**
+ * Serve the characteristics over TCP, and optionally load the server
+ * @param port - port to listen on, 0 for any
+ * @param sessions - concurrent sessions of the load, 0 to serve until killed
+ */
+int serve(uint16_t port, uint32_t sessions, uint32_t rounds) {
+	NetworkTable networks;
+	BleCodec codec;
+	codecInit(codec, NATIVE_DEVICE_NAME);
+	MemoryStore store;
+	StdLock lock;
+	CountingHooks hooks;
+	Provisioning provisioning(networks, codec, store, lock, hooks);
+	ScanSnapshot scan;
+	fillScan(scan);
+
+	GattSocketServer server(provisioning, scan, hooks);
+	port = server.listen(port);
+	if (port == 0) {
+		perror("listen");
+		return 1;
+	}
+	if (sessions == 0) {
+		printf("Serving on 127.0.0.1:%u\n", port);
+		fflush(stdout);
+		// Print the log while serving
+		std::thread([]() {
+			while (true) {
+				printLog();
+				fflush(stdout);
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+		}).detach();
+		server.serve();
+		return 0;
+	}
+
+	std::thread accepting(&GattSocketServer::serve, &server);
+	LoadReport report;
+	runLoad(port, sessions, rounds, codec, report);
+	server.stop();
+	accepting.join();
+	printLoad(report);
+	printf("Server handled %u requests, store writes %u, log lines dropped %u\n", server.requests(), store.writes, appLogDropped());
+	return report.failures > 0 ? 1 : 0;
+}
+
+/** Simulated hours of the simulate command without an argument */
+#define SIM_DEFAULT_HOURS 1000
+
+int simulate(uint32_t hours) {
+	// A home AP that fails now and then, and a weaker fallback
+	const SimAp aps[] = {
+		{ "home", 1, -62, 8, 600000, 2 * 3600000, 120000, 800 },
+		{ "fallback", 0, -78, 6, 900000, 8 * 3600000, 600000, 1500 }
+	};
+	SimConfig config;
+	config.aps = aps;
+	config.apCount = sizeof(aps) / sizeof(aps[0]);
+	config.durationMs = (uint64_t)hours * 3600000;
+	config.seed = 1;
+	config.manager.debounceMs = CM_DEBOUNCE_TIME;
+	config.manager.quickRetry = true;
+	config.manager.backoffMinMs = CM_BACKOFF_MIN;
+	config.manager.backoffMaxMs = CM_BACKOFF_MAX;
+	config.manager.jitterPercent = CM_BACKOFF_JITTER;
+
+	SimReport report;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	runLinkSimulation(config, report);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("Simulated %u h in %.3f s, %.0f h/s\n", hours, seconds, seconds > 0 ? hours / seconds : 0);
+	printf("Links lost %u, back %u (%u without a scan), scans %u, connect attempts %u\n",
+		report.linkLosses, report.reconnects, report.fastReconnects, report.scans, report.connectAttempts);
+	printf("Reconnect latency ms: p50 %u p90 %u p99 %u max %u\n",
+		report.latencyP50, report.latencyP90, report.latencyP99, report.latencyMax);
+	printf("Radio busy %.3f%%, connected %.3f%%\n",
+		100.0 * report.radioBusyMs / config.durationMs, 100.0 * report.connectedMs / config.durationMs);
+	return 0;
+}
+
+int runSession() {
+	NetworkTable networks;
+	BleCodec codec;
+	codecInit(codec, NATIVE_DEVICE_NAME);
+	MemoryStore store;
+	StdLock lock;
+	CountingHooks hooks;
+	Provisioning provisioning(networks, codec, store, lock, hooks);
+
+	// Keys of older versions are moved to a single record
+	store.putBool("valid", true);
+	store.putString("ssidPrim", "legacy");
+	store.putString("pwPrim", "legacy-password");
+	store.putString("ssidSec", "");
+	store.putString("pwSec", "");
+	provisioning.load();
+	printf("Loaded %u network(s), %u store write(s)\n", networks.count(), store.writes);
+
+	ClientTable clients;
+	const uint8_t address[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+	BleClient *client = clients.add(0, address);
+
+	const char credentials[] = "{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"office\",\"pwSec\":\"other\"}";
+	writeText(provisioning, codec, client, credentials);
+	printf("Credentials written, %u change(s), %u store write(s)\n", hooks.changes, store.writes);
+
+	MemoryValue wifiValue;
+	provisioning.readCredentials(client, wifiValue);
+	printValue("WiFi", wifiValue, &codec);
+
+	// The cafe is open and left out of the list
+	ScanSnapshot scan;
+	fillScan(scan);
+	MemoryValue listValue;
+	provisioning.readList(scan, listValue);
+	printValue("List", listValue, NULL);
+	printf("Selected network %u\n", networks.select(scan.aps, scan.count));
+
+	writeText(provisioning, codec, client, credentials);
+	printf("Same credentials again, %u change(s), %u store write(s)\n", hooks.changes, store.writes);
+
+	writeText(provisioning, codec, client, "{\"erase\":true}");
+	printf("Erased, %u network(s), %u erase(s)\n", networks.count(), hooks.erases);
+
+	printLog();
+#if APP_TRACE
+	printTrace();
+#endif
+	return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+	appLogBegin(hostClock, NULL);
+#if APP_TRACE
+	traceBegin(hostMicros);
+#endif
+	if (argc > 1 && !strcmp(argv[1], "simulate")) {
+		return simulate(argc > 2 ? strtoul(argv[2], NULL, 10) : SIM_DEFAULT_HOURS);
+	}
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		runBenchmarks(NATIVE_DEVICE_NAME, argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_ITERATIONS);
+		return 0;
+	}
+	if (argc > 1 && !strcmp(argv[1], "serve")) {
+		return serve(argc > 2 ? strtoul(argv[2], NULL, 10) : GATT_SOCKET_PORT, 0, 0);
+	}
+	if (argc > 1 && !strcmp(argv[1], "load")) {
+		uint32_t sessions = argc > 2 ? strtoul(argv[2], NULL, 10) : LOAD_DEFAULT_SESSIONS;
+		uint32_t rounds = argc > 3 ? strtoul(argv[3], NULL, 10) : LOAD_DEFAULT_ROUNDS;
+		if (argc > 4) {
+			// Against a running server
+			BleCodec codec;
+			codecInit(codec, NATIVE_DEVICE_NAME);
+			LoadReport report;
+			runLoad(strtoul(argv[4], NULL, 10), sessions, rounds, codec, report);
+			printLoad(report);
+			return report.failures > 0 ? 1 : 0;
+		}
+		return serve(0, sessions > 0 ? sessions : 1, rounds);
+	}
+	return runSession();
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * In-memory platform backends for the native build
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "memory_hal.h"
+
+#include <string.h>
+
+size_t MemoryStore::getBytes(const char *key, void *buffer, size_t size) {
+	std::map<std::string, std::vector<uint8_t> >::const_iterator entry = values.find(key);
+	if (entry == values.end() || entry->second.size() > size) {
+		return 0;
+	}
+	memcpy(buffer, entry->second.data(), entry->second.size());
+	return entry->second.size();
+}
+
+size_t MemoryStore::putBytes(const char *key, const void *value, size_t length) {
+	const uint8_t *bytes = (const uint8_t *) value;
+	values[key].assign(bytes, bytes + length);
+	writes++;
+	return length;
+}
+
+void MemoryStore::getString(const char *key, char *buffer, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	std::map<std::string, std::vector<uint8_t> >::const_iterator entry = values.find(key);
+	size_t length = entry != values.end() ? entry->second.size() : 0;
+	if (length >= size) {
+		length = 0;
+	}
+	if (length > 0) {
+		memcpy(buffer, entry->second.data(), length);
+	}
+	buffer[length] = 0;
+}
+
+bool MemoryStore::getBool(const char *key, bool defaultValue) {
+	std::map<std::string, std::vector<uint8_t> >::const_iterator entry = values.find(key);
+	if (entry == values.end() || entry->second.size() != 1) {
+		return defaultValue;
+	}
+	return entry->second[0] != 0;
+}
+
+bool MemoryStore::remove(const char *key) {
+	return values.erase(key) > 0;
+}
+
+bool MemoryStore::clear() {
+	values.clear();
+	return true;
+}
+
+void MemoryStore::putString(const char *key, const char *value) {
+	putBytes(key, value, strlen(value));
+}
+
+void MemoryStore::putBool(const char *key, bool value) {
+	uint8_t byte = value ? 1 : 0;
+	putBytes(key, &byte, 1);
+}
@@ -0,0 +1,107 @@
+/**
+ * In-memory platform backends for the native build
+ *
+ * Implement the interfaces of hal.h on the host: a key/value store that
+ * lives in memory, characteristic values that keep the last value set,
+ * a std::mutex lock, and provisioning hooks that only count their calls.
+ * Not built for the ESP32.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef MEMORY_HAL_H
+#define MEMORY_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../hal.h"
+#include "../provisioning.h"
+
+/**
+ * MemoryStore
+ * Preferences lookalike, strings and bools are kept as bytes
+ */
+class MemoryStore: public KeyValueStore {
+public:
+	MemoryStore() : writes(0) {}
+
+	size_t getBytes(const char *key, void *buffer, size_t size);
+	size_t putBytes(const char *key, const void *value, size_t length);
+	void getString(const char *key, char *buffer, size_t size);
+	bool getBool(const char *key, bool defaultValue);
+	bool remove(const char *key);
+	bool clear();
+
+	/** Store values the way older versions of the sketch did */
+	void putString(const char *key, const char *value);
+	void putBool(const char *key, bool value);
+
+	/** Number of putBytes() calls, i.e. flash writes on the device */
+	uint32_t writes;
+
+private:
+	std::map<std::string, std::vector<uint8_t> > values;
+};
+
+/**
+ * MemoryValue
+ * Characteristic value, holds what was set last
+ */
+class MemoryValue: public GattValue {
+public:
+	void setValue(const uint8_t *data, size_t length) {
+		value.assign(data, data + length);
+	}
+
+	std::vector<uint8_t> value;
+};
+
+/** Lock over a std::mutex */
+class StdLock: public Lock {
+public:
+	void lock() {
+		mutex.lock();
+	}
+
+	void unlock() {
+		mutex.unlock();
+	}
+
+private:
+	std::mutex mutex;
+};
+
+/**
+ * CountingHooks
+ * ProvisioningHooks without a radio, remembers what was asked for
+ */
+class CountingHooks: public ProvisioningHooks {
+public:
+	CountingHooks() : changes(0), erases(0), resets(0), hasCredentials(false) {}
+
+	void credentialsChanged(bool stored) {
+		changes++;
+		hasCredentials = stored;
+	}
+
+	void erased() {
+		erases++;
+		hasCredentials = false;
+	}
+
+	void reset() {
+		resets++;
+	}
+
+	uint32_t changes;
+	uint32_t erases;
+	uint32_t resets;
+	bool hasCredentials;
+};
+
+#endif
@@ -0,0 +1,273 @@
+/**
+ * Table of candidate WiFi networks
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "network_table.h"
+
+#include <string.h>
+
+namespace {
+
+/** FNV-1a, never 0 so 0 can mark a missing hash */
+uint32_t hashSsid(const char *ssid) {
+	uint32_t hash = 2166136261UL;
+	while (*ssid) {
+		hash ^= (uint8_t) *ssid++;
+		hash *= 16777619UL;
+	}
+	return hash != 0 ? hash : 1;
+}
+
+void putUint32(uint8_t *out, uint32_t value) {
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+uint32_t getUint32(const uint8_t *in) {
+	return (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+/** Append a length prefixed string, advancing pos */
+bool putString(uint8_t *out, size_t size, size_t &pos, const char *value) {
+	size_t length = strlen(value);
+	if (pos + 1 + length > size) {
+		return false;
+	}
+	out[pos++] = (uint8_t) length;
+	memcpy(out + pos, value, length);
+	pos += length;
+	return true;
+}
+
+/** Read a length prefixed string into a slot, advancing pos */
+bool getString(const uint8_t *in, size_t length, size_t &pos, char *slot, size_t size) {
+	if (pos >= length || in[pos] >= size || length - pos - 1 < in[pos]) {
+		return false;
+	}
+	uint8_t valueLength = in[pos++];
+	memcpy(slot, in + pos, valueLength);
+	slot[valueLength] = 0;
+	pos += valueLength;
+	return true;
+}
+
+}
+
+NetworkTable::NetworkTable() {
+	clear();
+}
+
+void NetworkTable::clear() {
+	memset(entries, 0, sizeof(entries));
+	clock = 0;
+	newestSuccess = 0;
+}
+
+bool NetworkTable::set(uint8_t index, const char *ssid, const char *pw, uint8_t priority) {
+	if (index >= MAX_NETWORKS || strlen(ssid) >= CRED_SSID_SIZE || strlen(pw) >= CRED_PW_SIZE) {
+		return false;
+	}
+	NetworkEntry &entry = entries[index];
+	bool sameNetwork = entry.ssid[0] != 0 && !strcmp(entry.ssid, ssid);
+	if (!sameNetwork) {
+		// History belongs to the previous network of the slot
+		memset(&entry, 0, sizeof(entry));
+	}
+	if (ssid[0] == 0) {
+		return true;
+	}
+	strcpy(entry.ssid, ssid);
+	strcpy(entry.pw, pw);
+	entry.priority = priority;
+	entry.ssidHash = hashSsid(ssid);
+	return true;
+}
+
+uint8_t NetworkTable::add(const char *ssid, const char *pw, uint8_t priority) {
+	if (ssid[0] == 0) {
+		return NETWORK_NONE;
+	}
+	uint8_t index = find(ssid);
+	for (uint8_t slot = NETWORK_SECONDARY + 1; index == NETWORK_NONE && slot < MAX_NETWORKS; slot++) {
+		if (entries[slot].ssid[0] == 0) index = slot;
+	}
+	for (uint8_t slot = 0; index == NETWORK_NONE && slot <= NETWORK_SECONDARY; slot++) {
+		if (entries[slot].ssid[0] == 0) index = slot;
+	}
+	if (index == NETWORK_NONE || !set(index, ssid, pw, priority)) {
+		return NETWORK_NONE;
+	}
+	return index;
+}
+
+bool NetworkTable::remove(const char *ssid) {
+	uint8_t index = find(ssid);
+	if (index == NETWORK_NONE) {
+		return false;
+	}
+	memset(&entries[index], 0, sizeof(entries[index]));
+	return true;
+}
+
+const NetworkEntry *NetworkTable::get(uint8_t index) const {
+	if (index >= MAX_NETWORKS || entries[index].ssid[0] == 0) {
+		return NULL;
+	}
+	return &entries[index];
+}
+
+uint8_t NetworkTable::find(const char *ssid) const {
+	if (ssid[0] == 0) {
+		return NETWORK_NONE;
+	}
+	uint32_t hash = hashSsid(ssid);
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		if (entries[index].ssidHash == hash && !strcmp(entries[index].ssid, ssid)) {
+			return index;
+		}
+	}
+	return NETWORK_NONE;
+}
+
+uint8_t NetworkTable::count() const {
+	uint8_t used = 0;
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		if (entries[index].ssid[0] != 0) used++;
+	}
+	return used;
+}
+
+void NetworkTable::setCredentials(const WiFiCredentials &credentials) {
+	set(NETWORK_PRIMARY, credentials.ssidPrim, credentials.pwPrim, entries[NETWORK_PRIMARY].priority);
+	set(NETWORK_SECONDARY, credentials.ssidSec, credentials.pwSec, entries[NETWORK_SECONDARY].priority);
+}
+
+void NetworkTable::getCredentials(WiFiCredentials &credentials) const {
+	strcpy(credentials.ssidPrim, entries[NETWORK_PRIMARY].ssid);
+	strcpy(credentials.pwPrim, entries[NETWORK_PRIMARY].pw);
+	strcpy(credentials.ssidSec, entries[NETWORK_SECONDARY].ssid);
+	strcpy(credentials.pwSec, entries[NETWORK_SECONDARY].pw);
+}
+
+uint8_t NetworkTable::select(const ScanRecord *aps, uint8_t apCount, uint8_t *bestAp) {
+	clock++;
+	uint8_t best = NETWORK_NONE;
+	int32_t bestScore = 0;
+	for (uint8_t ap = 0; ap < apCount; ap++) {
+		// One hash per AP, the string compare only runs on a hash match
+		uint32_t hash = hashSsid(aps[ap].ssid);
+		for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+			NetworkEntry &entry = entries[index];
+			if (entry.ssidHash != hash || strcmp(entry.ssid, aps[ap].ssid)) {
+				continue;
+			}
+			entry.lastSeen = clock;
+			if (aps[ap].rssi < NETWORK_MIN_RSSI) {
+				continue;
+			}
+			int32_t score = aps[ap].rssi + NETWORK_PRIORITY_WEIGHT * entry.priority;
+			if (entry.lastSuccess != 0 && entry.lastSuccess == newestSuccess) {
+				score += NETWORK_LAST_SUCCESS_BONUS;
+			}
+			if (best == NETWORK_NONE || score > bestScore) {
+				best = index;
+				bestScore = score;
+				if (bestAp != NULL) *bestAp = ap;
+			}
+		}
+	}
+	return best;
+}
+
+bool NetworkTable::allFound(const ScanRecord *aps, uint8_t apCount) const {
+	bool found[MAX_NETWORKS] = { false };
+	for (uint8_t ap = 0; ap < apCount; ap++) {
+		uint32_t hash = hashSsid(aps[ap].ssid);
+		for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+			if (entries[index].ssidHash == hash && !strcmp(entries[index].ssid, aps[ap].ssid)) {
+				found[index] = true;
+			}
+		}
+	}
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		if (entries[index].ssid[0] != 0 && !found[index]) {
+			return false;
+		}
+	}
+	return count() > 0;
+}
+
+bool NetworkTable::markSuccess(uint8_t index) {
+	if (get(index) == NULL) {
+		return false;
+	}
+	bool changed = entries[index].lastSuccess == 0 || entries[index].lastSuccess != newestSuccess;
+	clock++;
+	entries[index].lastSuccess = clock;
+	newestSuccess = clock;
+	return changed;
+}
+
+size_t NetworkTable::serialize(uint8_t *out, size_t size) const {
+	if (size < 5) {
+		return 0;
+	}
+	out[0] = NETWORK_TABLE_VERSION;
+	// Only success times are stored, so scans alone do not change the record
+	putUint32(out + 1, newestSuccess);
+	size_t pos = 5;
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		const NetworkEntry &entry = entries[index];
+		if (entry.ssid[0] == 0) {
+			continue;
+		}
+		if (pos + 1 > size) {
+			return 0;
+		}
+		out[pos++] = index;
+		if (!putString(out, size, pos, entry.ssid) || !putString(out, size, pos, entry.pw) || pos + 5 > size) {
+			return 0;
+		}
+		out[pos++] = entry.priority;
+		putUint32(out + pos, entry.lastSuccess);
+		pos += 4;
+	}
+	return pos;
+}
+
+bool NetworkTable::deserialize(const uint8_t *in, size_t length) {
+	clear();
+	if (length < 5 || in[0] != NETWORK_TABLE_VERSION) {
+		return false;
+	}
+	uint32_t storedClock = getUint32(in + 1);
+	size_t pos = 5;
+	while (pos < length) {
+		uint8_t index = in[pos++];
+		if (index >= MAX_NETWORKS) {
+			clear();
+			return false;
+		}
+		NetworkEntry &entry = entries[index];
+		if (!getString(in, length, pos, entry.ssid, sizeof(entry.ssid))
+				|| !getString(in, length, pos, entry.pw, sizeof(entry.pw))
+				|| entry.ssid[0] == 0
+				|| length - pos < 5) {
+			clear();
+			return false;
+		}
+		entry.priority = in[pos++];
+		entry.lastSuccess = getUint32(in + pos);
+		pos += 4;
+		entry.ssidHash = hashSsid(entry.ssid);
+		if (entry.lastSuccess > newestSuccess) {
+			newestSuccess = entry.lastSuccess;
+		}
+	}
+	clock = storedClock;
+	return true;
+}
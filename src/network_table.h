@@ -0,0 +1,124 @@
+/**
+ * Table of candidate WiFi networks
+ *
+ * Fixed capacity, each entry holds the credentials of one network with
+ * its priority and when it was last seen in a scan and last connected to.
+ * Slots NETWORK_PRIMARY and NETWORK_SECONDARY are the networks of the
+ * legacy primary/secondary credential format, other slots are added one
+ * by one. Times are ticks of the table's own clock, which advances on
+ * every scan match and successful connect. Only the time of the newest
+ * success is stored with the table, and the clock resumes from it, so
+ * times stay comparable across restarts and scans alone do not change
+ * the stored record.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef NETWORK_TABLE_H
+#define NETWORK_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "credentials.h"
+#include "scan_cache.h"
+
+/** Number of networks the table holds */
+#define MAX_NETWORKS 16
+/** Slots of the legacy credential format */
+#define NETWORK_PRIMARY 0
+#define NETWORK_SECONDARY 1
+/** No network, e.g. nothing matched a scan */
+#define NETWORK_NONE 0xFF
+/** Score of one priority level, in dB of RSSI */
+#define NETWORK_PRIORITY_WEIGHT 10
+/** Score bonus in dB for the network of the most recent successful connect */
+#define NETWORK_LAST_SUCCESS_BONUS 3
+/** Access points weaker than this in dBm are not selected */
+#define NETWORK_MIN_RSSI -90
+/** Storage format version written by serialize() */
+#define NETWORK_TABLE_VERSION 1
+/** Largest output of serialize() */
+#define NETWORK_TABLE_MAX_SIZE (5 + MAX_NETWORKS * (4 + (CRED_SSID_SIZE - 1) + (CRED_PW_SIZE - 1) + 4))
+
+struct NetworkEntry {
+	/** SSID, zero terminated, empty if the slot is unused */
+	char ssid[CRED_SSID_SIZE];
+	char pw[CRED_PW_SIZE];
+	/** Higher is preferred */
+	uint8_t priority;
+	/** Table clock when last found by select(), 0 never, only kept in RAM */
+	uint32_t lastSeen;
+	/** Table clock of the last successful connect, 0 never */
+	uint32_t lastSuccess;
+	/** Hash of ssid, speeds up matching scans */
+	uint32_t ssidHash;
+};
+
+class NetworkTable {
+public:
+	NetworkTable();
+
+	void clear();
+	/**
+	 * Set a slot, an empty ssid frees it
+	 * @return bool - false if the index or a value is out of range
+	 */
+	bool set(uint8_t index, const char *ssid, const char *pw, uint8_t priority);
+	/**
+	 * Update the network with this ssid, or put it in a free slot
+	 * Free slots after the legacy ones are used first.
+	 * @return uint8_t - slot of the network, NETWORK_NONE if the table is full
+	 */
+	uint8_t add(const char *ssid, const char *pw, uint8_t priority);
+	/** @return bool - false if no network has this ssid */
+	bool remove(const char *ssid);
+
+	/** Entry in a slot, NULL if the slot is unused */
+	const NetworkEntry *get(uint8_t index) const;
+	/** Slot of a network, NETWORK_NONE if not found */
+	uint8_t find(const char *ssid) const;
+	/** Number of used slots */
+	uint8_t count() const;
+
+	/** Fill the legacy slots from primary/secondary credentials */
+	void setCredentials(const WiFiCredentials &credentials);
+	/** Legacy view of the table, empty fields for unused slots */
+	void getCredentials(WiFiCredentials &credentials) const;
+
+	/**
+	 * Pick the network to connect to from a scan
+	 * The score is the RSSI of the best AP of a network, plus
+	 * NETWORK_PRIORITY_WEIGHT per priority level and NETWORK_LAST_SUCCESS_BONUS
+	 * for the network last connected to. Updates lastSeen of every network found.
+	 * @param bestAp - receives the index in aps of the AP of the selected network, may be NULL
+	 * @return uint8_t - slot of the selected network, NETWORK_NONE if none was found
+	 */
+	uint8_t select(const ScanRecord *aps, uint8_t apCount, uint8_t *bestAp = NULL);
+	/** Check if every network of the table is in a scan */
+	bool allFound(const ScanRecord *aps, uint8_t apCount) const;
+	/**
+	 * Record a successful connect
+	 * @return bool - true if it was not the network of the previous success, the table should be stored
+	 */
+	bool markSuccess(uint8_t index);
+
+	/**
+	 * Encode the used slots for storage
+	 * @return size_t - encoded length, 0 if out is too small
+	 */
+	size_t serialize(uint8_t *out, size_t size) const;
+	/**
+	 * Replace the table with a stored one
+	 * @return bool - false if the data is malformed, the table is then empty
+	 */
+	bool deserialize(const uint8_t *in, size_t length);
+
+private:
+	NetworkEntry entries[MAX_NETWORKS];
+	uint32_t clock;
+	/** lastSuccess of the network last connected to */
+	uint32_t newestSuccess;
+};
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * When the status notification task sends the status
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "notify_schedule.h"
+
+NotifySchedule::NotifySchedule(uint32_t heartbeatMs)
+	: heartbeat(heartbeatMs), lastSent(0) {
+}
+
+bool NotifySchedule::wake(uint32_t reasons, uint32_t now) {
+	if ((reasons & (STATUS_CHANGED | STATUS_SUBSCRIBED)) == 0
+			&& (heartbeat == 0 || now - lastSent < heartbeat)) {
+		// Early or spurious wake up, nothing changed since the last send
+		return false;
+	}
+	lastSent = now;
+	return true;
+}
+
+uint32_t NotifySchedule::nextTimeout(uint32_t now) const {
+	if (heartbeat == 0) {
+		return NOTIFY_NO_TIMEOUT;
+	}
+	uint32_t elapsed = now - lastSent;
+	return elapsed < heartbeat ? heartbeat - elapsed : 0;
+}
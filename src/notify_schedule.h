@@ -0,0 +1,44 @@
+/**
+ * When the status notification task sends the status
+ *
+ * The task sleeps until a status change or a new subscription wakes it,
+ * and sends the status right away. Without a change it only sends a
+ * heartbeat, measured from the last send. Has no platform dependencies,
+ * the task passes in its wake up reasons and the time.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef NOTIFY_SCHEDULE_H
+#define NOTIFY_SCHEDULE_H
+
+#include <stdint.h>
+
+/** Wake up reasons of the notification task */
+#define STATUS_CHANGED 0x01
+#define STATUS_SUBSCRIBED 0x02
+/** nextTimeout() when there is no heartbeat */
+#define NOTIFY_NO_TIMEOUT 0xFFFFFFFFUL
+
+class NotifySchedule {
+public:
+	/** @param heartbeatMs - interval of sends without a change, 0 to only send on changes */
+	NotifySchedule(uint32_t heartbeatMs);
+
+	/**
+	 * Decide whether to send after a wake up
+	 * @param reasons - STATUS_CHANGED and STATUS_SUBSCRIBED bits, 0 after a timeout
+	 * @param now - time in ms
+	 * @return bool - true if the status is to be sent now, which restarts the heartbeat
+	 */
+	bool wake(uint32_t reasons, uint32_t now);
+	/** Time in ms until the next heartbeat is due, NOTIFY_NO_TIMEOUT without heartbeat */
+	uint32_t nextTimeout(uint32_t now) const;
+
+private:
+	uint32_t heartbeat;
+	/** Time of the last send */
+	uint32_t lastSent;
+};
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * Versioned, CRC protected records for NVS blobs
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "nvs_record.h"
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc) {
+	crc = ~crc;
+	while (length--) {
+		crc ^= *data++;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+size_t nvsRecordSeal(uint8_t *record, uint8_t version, uint16_t payloadLength) {
+	uint32_t crc = crc32(record + NVS_RECORD_HEADER_SIZE, payloadLength);
+	record[0] = NVS_RECORD_MAGIC;
+	record[1] = version;
+	record[2] = payloadLength & 0xFF;
+	record[3] = payloadLength >> 8;
+	record[4] = crc & 0xFF;
+	record[5] = (crc >> 8) & 0xFF;
+	record[6] = (crc >> 16) & 0xFF;
+	record[7] = crc >> 24;
+	return NVS_RECORD_HEADER_SIZE + payloadLength;
+}
+
+const uint8_t *nvsRecordOpen(const uint8_t *record, size_t length, uint8_t version, size_t &payloadLength) {
+	if (length < NVS_RECORD_HEADER_SIZE || record[0] != NVS_RECORD_MAGIC || record[1] != version) {
+		return NULL;
+	}
+	payloadLength = record[2] | (record[3] << 8);
+	if (payloadLength != length - NVS_RECORD_HEADER_SIZE) {
+		return NULL;
+	}
+	const uint8_t *payload = record + NVS_RECORD_HEADER_SIZE;
+	if (crc32(payload, payloadLength) != nvsRecordCrc(record)) {
+		return NULL;
+	}
+	return payload;
+}
+
+uint32_t nvsRecordCrc(const uint8_t *record) {
+	return (uint32_t) record[4] | ((uint32_t) record[5] << 8) | ((uint32_t) record[6] << 16) | ((uint32_t) record[7] << 24);
+}
@@ -0,0 +1,49 @@
+/**
+ * Versioned, CRC protected records for NVS blobs
+ *
+ * A record is an 8 byte header followed by the payload:
+ *
+ *   offset  size  field
+ *   0       1     magic (NVS_RECORD_MAGIC)
+ *   1       1     payload version, chosen by the caller
+ *   2       2     payload length, little endian
+ *   4       4     CRC-32 of the payload, little endian
+ *
+ * The caller serializes the payload at NVS_RECORD_HEADER_SIZE into the
+ * record buffer and seals it, so no second buffer is needed. The CRC also
+ * tells whether a record differs from the one last written, without
+ * reading it back from flash.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef NVS_RECORD_H
+#define NVS_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NVS_RECORD_MAGIC 0x57
+#define NVS_RECORD_HEADER_SIZE 8
+
+/** CRC-32 (IEEE 802.3), pass the previous result to continue over several buffers */
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+/**
+ * Fill in the header of a record whose payload is already in place
+ * @param record - buffer with the payload at NVS_RECORD_HEADER_SIZE
+ * @return size_t - record length to store
+ */
+size_t nvsRecordSeal(uint8_t *record, uint8_t version, uint16_t payloadLength);
+
+/**
+ * Check a stored record
+ * @param payloadLength - receives the payload length
+ * @return const uint8_t* - payload, NULL if the record is truncated, corrupted or has another version
+ */
+const uint8_t *nvsRecordOpen(const uint8_t *record, size_t length, uint8_t version, size_t &payloadLength);
+
+/** CRC of a sealed or opened record, to compare it with the stored one */
+uint32_t nvsRecordCrc(const uint8_t *record);
+
+#endif
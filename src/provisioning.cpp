@@ -0,0 +1,221 @@
+/**
+ * Credential provisioning over the WiFi characteristic
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "provisioning.h"
+
+#include "app_log.h"
+#include "json_writer.h"
+#include "tlv_codec.h"
+#include "trace.h"
+
+Provisioning::Provisioning(NetworkTable &networks, const BleCodec &codec, KeyValueStore &store, Lock &lock, ProvisioningHooks &hooks)
+	: networks(networks), codec(codec), store(store), lock(lock), hooks(hooks), networksCrc(0),
+	  listGeneration(0), listTime(0), listSerializationCount(0) {
+}
+
+void Provisioning::load() {
+	LockGuard guard(lock);
+	size_t length = store.getBytes("networks", networksStorage, sizeof(networksStorage));
+	size_t payloadLength;
+	const uint8_t *payload = nvsRecordOpen(networksStorage, length, NETWORKS_RECORD_VERSION, payloadLength);
+	if (payload != NULL) {
+		if (networks.deserialize(payload, payloadLength)) {
+			networksCrc = nvsRecordCrc(networksStorage);
+		} else {
+			LOG_ERROR("Found preferences but credentials are invalid");
+		}
+	} else if (length > 0) {
+		LOG_ERROR("Stored credentials are corrupted");
+	} else if (store.getBool("valid", false)) {
+		WiFiCredentials legacy;
+		store.getString("ssidPrim", legacy.ssidPrim, sizeof(legacy.ssidPrim));
+		store.getString("ssidSec", legacy.ssidSec, sizeof(legacy.ssidSec));
+		store.getString("pwPrim", legacy.pwPrim, sizeof(legacy.pwPrim));
+		store.getString("pwSec", legacy.pwSec, sizeof(legacy.pwSec));
+		networks.setCredentials(legacy);
+		LOG_INFO("Moving stored credentials to a single record");
+		save();
+		// Keys of older versions, only read once
+		store.remove("valid");
+		store.remove("ssidPrim");
+		store.remove("ssidSec");
+		store.remove("pwPrim");
+		store.remove("pwSec");
+		store.remove("lastBssid");
+		store.remove("lastChan");
+		store.remove("lastAuth");
+		store.remove("lastPrim");
+	}
+}
+
+bool Provisioning::save() {
+	size_t payloadLength = networks.serialize(networksStorage + NVS_RECORD_HEADER_SIZE, NETWORK_TABLE_MAX_SIZE);
+	size_t length = nvsRecordSeal(networksStorage, NETWORKS_RECORD_VERSION, payloadLength);
+	uint32_t crc = nvsRecordCrc(networksStorage);
+	if (crc == networksCrc) {
+		return false;
+	}
+	if (store.putBytes("networks", networksStorage, length) != length) {
+		LOG_ERROR("Storing credentials failed");
+		return false;
+	}
+	networksCrc = crc;
+	return true;
+}
+
+CredCommand Provisioning::write(BleClient *client, uint8_t *data, size_t length) {
+	// Decode and parse in place, the fields go straight into the credential slots
+	codecApply(codec, data, length);
+	bool usesTlv = isTlvFrame(data, length);
+	if (client != NULL) {
+		client->usesTlv = usesTlv;
+	}
+	WiFiCredentials credentials;
+	{
+		LockGuard guard(lock);
+		networks.getCredentials(credentials);
+	}
+	CredCommand command = usesTlv
+		? parseTlvCredentials(data, length, credentials)
+		: parseCredentials((char *)data, length, credentials);
+	TRACE(TRACE_CRED_DECODED, command);
+	switch (command) {
+		case CRED_SET:
+		case CRED_ADD_NETWORK:
+		case CRED_REMOVE_NETWORK: {
+			TlvNetwork network;
+			if (command != CRED_SET && !parseTlvNetwork(data, length, network)) {
+				LOG_WARN("Received invalid TLV frame");
+				return CRED_INVALID;
+			}
+			bool changed = true;
+			bool hasCredentials;
+			{
+				LockGuard guard(lock);
+				if (command == CRED_SET) {
+					networks.setCredentials(credentials);
+					// Passwords are never logged
+					LOG_INFO("Received primary SSID: %s secondary SSID: %s", credentials.ssidPrim, credentials.ssidSec);
+				} else if (command == CRED_REMOVE_NETWORK) {
+					LOG_INFO("Removing network %s", network.ssid);
+					changed = networks.remove(network.ssid);
+				} else if (networks.add(network.ssid, network.pw, network.priority) == NETWORK_NONE) {
+					LOG_WARN("Network table is full");
+					changed = false;
+				} else {
+					LOG_INFO("Added network %s priority %d", network.ssid, network.priority);
+				}
+				// Nothing is written, and the connection is kept, if the same credentials are sent again
+				if (changed) {
+					changed = save();
+					TRACE(TRACE_CRED_PERSISTED, changed);
+					if (!changed) {
+						LOG_INFO("Credentials unchanged");
+					}
+				}
+				hasCredentials = networks.count() > 0;
+			}
+			if (changed) {
+				hooks.credentialsChanged(hasCredentials);
+			}
+			break;
+		}
+		case CRED_ERASE: {
+			LOG_INFO("Received erase command");
+			{
+				LockGuard guard(lock);
+				store.clear();
+				networks.clear();
+				networksCrc = 0;
+			}
+			hooks.erased();
+			break;
+		}
+		case CRED_RESET:
+			hooks.reset();
+			break;
+		case CRED_NONE:
+			break;
+		case CRED_INVALID:
+			LOG_WARN("Received invalid %s", usesTlv ? "TLV frame" : "JSON");
+			break;
+	}
+	return command;
+}
+
+void Provisioning::readCredentials(const BleClient *client, GattValue &value) {
+	WiFiCredentials credentials;
+	{
+		LockGuard guard(lock);
+		networks.getCredentials(credentials);
+	}
+	if (client != NULL && client->usesTlv) {
+		uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+		size_t length = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_CREDENTIALS, credentials);
+		codecApply(codec, frame, length);
+		value.setValue(frame, length);
+		return;
+	}
+
+	/** Json object for outgoing data */
+	JsonWriter json(credentialsJson, sizeof(credentialsJson));
+	json.beginObject();
+	json.key("ssidPrim");
+	json.value(credentials.ssidPrim);
+	json.key("pwPrim");
+	json.value(credentials.pwPrim);
+	json.key("ssidSec");
+	json.value(credentials.ssidSec);
+	json.key("pwSec");
+	json.value(credentials.pwSec);
+	json.endObject();
+	if (json.overflow()) {
+		// Only control characters escape to more than 2 bytes
+		LOG_ERROR("Stored settings do not fit the response");
+		value.setValue((const uint8_t *)"{}", 2);
+		return;
+	}
+
+	// encode the data
+	LOG_INFO("Stored settings sent, primary SSID: %s secondary SSID: %s", credentials.ssidPrim, credentials.ssidSec);
+	codecApply(codec, (uint8_t *)credentialsJson, json.length());
+	value.setValue((const uint8_t *)credentialsJson, json.length());
+}
+
+void Provisioning::readList(const ScanSnapshot &scan, GattValue &value) {
+	/** Json object for outgoing data */
+	JsonWriter json(listJson, sizeof(listJson));
+	json.beginObject();
+	json.key("SSID");
+	json.beginArray();
+	for (int i = 0; i < scan.count && i < LIST_MAX_SSIDS; i++) {
+		// Leave room for a comma and the closing "]}"
+		if (scan.aps[i].authMode != SCAN_AUTH_OPEN
+				&& JsonWriter::quotedSize(scan.aps[i].ssid) + 3 <= json.remaining()) {
+			json.value(scan.aps[i].ssid);
+		}
+	}
+	json.endArray();
+	json.endObject();
+
+	// encode the data (doesn't seem necessary, if added should be added to web app as well)
+	LOG_DEBUG("Found SSIDs (generation %u): %s", scan.generation, listJson);
+	// codecApply(codec, (uint8_t *)listJson, json.length());
+	value.setValue((const uint8_t *)listJson, json.length());
+}
+
+bool Provisioning::serveList(const ScanSnapshot &scan, uint32_t now, GattValue &value) {
+	if (listGeneration != 0
+			&& (scan.generation == listGeneration || now - listTime < LIST_HOLD_TIME)) {
+		// Current value is still valid, or a long read of it may be in progress
+		return false;
+	}
+	listGeneration = scan.generation;
+	listTime = now;
+	listSerializationCount++;
+	readList(scan, value);
+	return true;
+}
@@ -0,0 +1,126 @@
+/**
+ * Credential provisioning over the WiFi characteristic
+ *
+ * Decodes and applies writes of the credentials characteristic, stores the
+ * network table and builds the values of the credentials and SSID list
+ * characteristics. Reaches the platform only through hal.h and
+ * ProvisioningHooks, so the same code runs in the sketch and in the native
+ * build.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef PROVISIONING_H
+#define PROVISIONING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hal.h"
+#include "ble_codec.h"
+#include "client_table.h"
+#include "cred_parser.h"
+#include "network_table.h"
+#include "nvs_record.h"
+#include "scan_cache.h"
+
+/** Version of the stored networks record */
+#define NETWORKS_RECORD_VERSION 1
+/** Size of the credentials JSON: {"ssidPrim":"","pwPrim":"","ssidSec":"","pwSec":""}
+ * and 2 SSIDs and 2 passwords with every character escaped by a backslash */
+#define CREDENTIALS_JSON_SIZE (52 + 4 * (CRED_SSID_SIZE - 1) + 4 * (CRED_PW_SIZE - 1))
+/** Number of SSIDs in the SSID list */
+#define LIST_MAX_SSIDS 10
+/** Size of the SSID list JSON: {"SSID":[]} and LIST_MAX_SSIDS quoted SSIDs with commas */
+#define LIST_JSON_SIZE (12 + LIST_MAX_SSIDS * (2 * (CRED_SSID_SIZE - 1) + 3))
+/** Time in ms a served SSID list is kept, so a long read is not torn by a new scan */
+#define LIST_HOLD_TIME 1000
+
+/**
+ * ProvisioningHooks
+ * Implemented by the platform, called from Provisioning only, without its lock held.
+ */
+class ProvisioningHooks {
+public:
+	virtual ~ProvisioningHooks() {}
+	/**
+	 * The stored networks changed, the cached AP belongs to the old ones
+	 * @param hasCredentials - at least one network is stored
+	 */
+	virtual void credentialsChanged(bool hasCredentials) = 0;
+	/** Everything stored was erased */
+	virtual void erased() = 0;
+	/** A client asked for a restart */
+	virtual void reset() = 0;
+};
+
+class Provisioning {
+public:
+	/**
+	 * @param networks - table changed under lock only
+	 * @param codec - payload codec of the characteristic
+	 * @param store - namespace of the stored networks
+	 * @param lock - guards networks and the stored record
+	 */
+	Provisioning(NetworkTable &networks, const BleCodec &codec, KeyValueStore &store, Lock &lock, ProvisioningHooks &hooks);
+
+	/** Read the stored networks in a single read, credentials of older versions are taken over */
+	void load();
+	/**
+	 * Store the network table as one record, unless it is identical to the stored one
+	 * Caller holds the lock.
+	 * @return bool - true if the record was written
+	 */
+	bool save();
+
+	/**
+	 * Handle a write of the credentials characteristic
+	 * @param client - connection of the write, its protocol is set to the one of the payload, NULL if unknown
+	 * @param data - encoded payload, decoded in place
+	 * @return CredCommand - command of the payload
+	 */
+	CredCommand write(BleClient *client, uint8_t *data, size_t length);
+	/**
+	 * Set the credentials characteristic, in the protocol of the connection
+	 * @param client - connection of the read, NULL or a client that never wrote is answered in JSON
+	 */
+	void readCredentials(const BleClient *client, GattValue &value);
+	/** Set the list characteristic to the protected networks of a scan */
+	void readList(const ScanSnapshot &scan, GattValue &value);
+	/**
+	 * Handle a read of the list characteristic
+	 * The list is serialized once per scan generation and kept as the value until
+	 * a newer scan is published. A list longer than the MTU is read in several read
+	 * blob requests, the value is held for LIST_HOLD_TIME after it was set so all
+	 * offsets of one long read come from the same serialization.
+	 * @param now - time in ms
+	 * @return bool - true if the list was serialized, false if value was left as it is
+	 */
+	bool serveList(const ScanSnapshot &scan, uint32_t now, GattValue &value);
+
+	/** Number of times serveList() serialized the list */
+	uint32_t listSerializations() const {
+		return listSerializationCount;
+	}
+
+private:
+	NetworkTable &networks;
+	const BleCodec &codec;
+	KeyValueStore &store;
+	Lock &lock;
+	ProvisioningHooks &hooks;
+	/** CRC of the stored networks record, a record with the same CRC is not written again */
+	uint32_t networksCrc;
+	/** Stored record of networks, too large for the stack of the BLE task */
+	uint8_t networksStorage[NVS_RECORD_HEADER_SIZE + NETWORK_TABLE_MAX_SIZE];
+	/** Response buffers, reads are handled one at a time */
+	char credentialsJson[CREDENTIALS_JSON_SIZE];
+	char listJson[LIST_JSON_SIZE];
+	/** Scan generation the list value was built from, 0 if none */
+	uint32_t listGeneration;
+	/** Time in ms the list value was last replaced */
+	uint32_t listTime;
+	uint32_t listSerializationCount;
+};
+
+#endif
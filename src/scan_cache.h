@@ -0,0 +1,119 @@
+/**
+ * Double-buffered cache of WiFi scan results
+ *
+ * The scan task fills the back buffer and publishes it by flipping the
+ * front index, so BLE callbacks can copy the latest complete result set
+ * without waiting for a scan to finish.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef SCAN_CACHE_H
+#define SCAN_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/** Maximum number of access points kept from a single scan */
+#define SCAN_CACHE_MAX_AP 20
+/** authMode of an open network, WIFI_AUTH_OPEN */
+#define SCAN_AUTH_OPEN 0
+
+/** Single access point found by a scan */
+struct ScanRecord {
+	/** SSID, zero terminated */
+	char ssid[33];
+	int8_t rssi;
+	uint8_t channel;
+	/** wifi_auth_mode_t of the access point */
+	uint8_t authMode;
+	uint8_t bssid[6];
+};
+
+/** Result set of one completed scan */
+struct ScanSnapshot {
+	/** Incremented on every publish, 0 if no scan has completed yet */
+	uint32_t generation;
+	/** millis() when the scan completed */
+	unsigned long scanTime;
+	/** Number of valid entries in aps */
+	uint8_t count;
+	/** Not every channel was scanned, e.g. the scan stopped early */
+	bool partial;
+	ScanRecord aps[SCAN_CACHE_MAX_AP];
+};
+
+/**
+ * ScanCache
+ * Single writer (the scan task), any number of readers.
+ * The writer starts rewriting the old front buffer right after the next
+ * publish, so readers never keep a reference: read() copies the front
+ * buffer and checks its sequence number, odd while the writer owns the
+ * buffer, and copies again if the writer took it over in the meantime.
+ */
+class ScanCache {
+public:
+	ScanCache() : frontIndex(0), published(0) {
+		memset(buffers, 0, sizeof(buffers));
+		sequence[0].store(0, std::memory_order_relaxed);
+		sequence[1].store(0, std::memory_order_relaxed);
+	}
+
+	/** Copy the latest published result set, never blocks */
+	void read(ScanSnapshot &out) const {
+		while (true) {
+			uint8_t index = frontIndex.load(std::memory_order_acquire);
+			uint32_t before = sequence[index].load(std::memory_order_acquire);
+			if (before & 1) {
+				// Taken over by the writer after a newer publish, reload the front
+				continue;
+			}
+			memcpy(&out, &buffers[index], sizeof(out));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence[index].load(std::memory_order_relaxed) == before) {
+				return;
+			}
+		}
+	}
+
+	/** Buffer the writer fills before calling publish(), readers skip it from now on */
+	ScanSnapshot& back() {
+		uint8_t index = frontIndex.load(std::memory_order_relaxed) ^ 1;
+		uint32_t current = sequence[index].load(std::memory_order_relaxed);
+		// Still odd if the last fill was not published
+		if (!(current & 1)) {
+			sequence[index].store(current + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+		return buffers[index];
+	}
+
+	/** Make the back buffer the new front, stamping its generation */
+	void publish(unsigned long now) {
+		uint8_t current = frontIndex.load(std::memory_order_relaxed);
+		uint8_t index = current ^ 1;
+		ScanSnapshot& next = buffers[index];
+		next.generation = buffers[current].generation + 1;
+		next.scanTime = now;
+		// Even again, and never the value a reader saw before the fill
+		uint32_t filling = sequence[index].load(std::memory_order_relaxed);
+		sequence[index].store((filling | 1) + 1, std::memory_order_release);
+		frontIndex.store(index, std::memory_order_release);
+		published.store(next.generation, std::memory_order_release);
+	}
+
+	/** Generation of the front buffer, 0 if nothing was published */
+	uint32_t generation() const {
+		return published.load(std::memory_order_acquire);
+	}
+
+private:
+	ScanSnapshot buffers[2];
+	/** Per buffer, odd while the writer fills it */
+	std::atomic<uint32_t> sequence[2];
+	std::atomic<uint8_t> frontIndex;
+	std::atomic<uint32_t> published;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * WiFi scan policy
+ *
+ * Describes how the scan task visits the channels: active or passive,
+ * dwell time per channel, which channels, and whether to stop as soon
+ * as all configured networks were seen.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef SCAN_POLICY_H
+#define SCAN_POLICY_H
+
+#include <stdint.h>
+
+/** Channel mask bit for a 2.4 GHz channel (1-14) */
+#define SCAN_CHANNEL(ch) ((uint16_t)(1 << (ch)))
+/** Channels 1-13 */
+#define SCAN_ALL_CHANNELS ((uint16_t)0x3FFE)
+/** Highest channel the mask can hold */
+#define SCAN_MAX_CHANNEL 14
+
+struct ScanPolicy {
+	/** Listen for beacons instead of sending probe requests */
+	bool passive;
+	/** Time in ms spent on each channel */
+	uint16_t dwellMs;
+	/** Channels to visit, see SCAN_CHANNEL() */
+	uint16_t channelMask;
+	/** Stop after the channel on which the last configured network was found */
+	bool stopWhenKnownFound;
+};
+
+/** Scan used for the SSID list, every channel */
+const ScanPolicy listScanPolicy = { false, 300, SCAN_ALL_CHANNELS, false };
+/** Scan used by the connection manager, stops as soon as every stored network was seen */
+const ScanPolicy connectScanPolicy = { false, 300, SCAN_ALL_CHANNELS, true };
+
+/** Number of channels visited by a policy */
+inline uint8_t scanPolicyChannels(const ScanPolicy &policy) {
+	uint8_t channels = 0;
+	for (uint8_t ch = 1; ch <= SCAN_MAX_CHANNEL; ch++) {
+		if (policy.channelMask & SCAN_CHANNEL(ch)) {
+			channels++;
+		}
+	}
+	return channels;
+}
+
+/** Upper bound in ms for a scan with this policy, without early termination */
+inline uint32_t scanPolicyDuration(const ScanPolicy &policy) {
+	return (uint32_t)scanPolicyChannels(policy) * policy.dwellMs;
+}
+
+/** True if the policy can be done with a single all-channel scan */
+inline bool scanPolicySinglePass(const ScanPolicy &policy) {
+	return !policy.stopWhenKnownFound && (policy.channelMask & SCAN_ALL_CHANNELS) == SCAN_ALL_CHANNELS;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * Packed connection status record
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "status_record.h"
+
+#include <string.h>
+
+size_t encodeStatusRecord(const StatusRecord &record, uint8_t *out, size_t size) {
+	if (size < STATUS_RECORD_SIZE) {
+		return 0;
+	}
+	out[0] = STATUS_RECORD_VERSION;
+	out[1] = record.state;
+	out[2] = record.profile;
+	out[3] = (uint8_t) record.rssi;
+	out[4] = record.channel;
+	out[5] = record.lastDisconnectReason;
+	out[6] = record.reconnectCount & 0xFF;
+	out[7] = record.reconnectCount >> 8;
+	memcpy(out + 8, record.ipv4, 4);
+	out[12] = record.uptime & 0xFF;
+	out[13] = (record.uptime >> 8) & 0xFF;
+	out[14] = (record.uptime >> 16) & 0xFF;
+	out[15] = record.uptime >> 24;
+	return STATUS_RECORD_SIZE;
+}
+
+bool decodeStatusRecord(const uint8_t *in, size_t length, StatusRecord &record) {
+	if (length < STATUS_RECORD_SIZE || in[0] < 1) {
+		return false;
+	}
+	record.state = in[1];
+	record.profile = in[2];
+	record.rssi = (int8_t) in[3];
+	record.channel = in[4];
+	record.lastDisconnectReason = in[5];
+	record.reconnectCount = in[6] | (in[7] << 8);
+	memcpy(record.ipv4, in + 8, 4);
+	record.uptime = in[12] | (in[13] << 8) | ((uint32_t) in[14] << 16) | ((uint32_t) in[15] << 24);
+	return true;
+}
+
+uint16_t legacyStatusValue(const StatusRecord &record) {
+	return record.profile > 2 ? 2 : record.profile;
+}
@@ -0,0 +1,74 @@
+/**
+ * Packed connection status record
+ *
+ * Served on the extended status characteristic next to the legacy 2 byte
+ * status value. All multi byte fields are little endian, the IPv4 address
+ * is in network order (first octet first):
+ *
+ *   offset  size  field
+ *   0       1     version (STATUS_RECORD_VERSION)
+ *   1       1     state, see ConnState
+ *   2       1     profile, 0 none, else slot of the network + 1 (1 primary, 2 secondary)
+ *   3       1     RSSI in dBm (signed)
+ *   4       1     channel
+ *   5       1     last disconnect reason (wifi_err_reason_t, 0 if none)
+ *   6       2     reconnect count since boot
+ *   8       4     IPv4 address
+ *   12      4     uptime in seconds
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef STATUS_RECORD_H
+#define STATUS_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Layout version, bumped when fields are added */
+#define STATUS_RECORD_VERSION 1
+/** Encoded size of version 1, fits a default 20 byte notification */
+#define STATUS_RECORD_SIZE 16
+
+/** WiFi connection state */
+enum ConnState {
+	CONN_STATE_DISCONNECTED = 0,
+	CONN_STATE_CONNECTING = 1,
+	CONN_STATE_CONNECTED = 2,
+	CONN_STATE_NO_CREDENTIALS = 3
+};
+
+/** Decoded status record */
+struct StatusRecord {
+	uint8_t state;
+	/** 0 none, else slot of the network + 1 */
+	uint8_t profile;
+	int8_t rssi;
+	uint8_t channel;
+	uint8_t lastDisconnectReason;
+	uint16_t reconnectCount;
+	/** IPv4 address as 4 octets, first octet in ipv4[0] */
+	uint8_t ipv4[4];
+	uint32_t uptime;
+};
+
+/**
+ * Encode a status record
+ * @return size_t - STATUS_RECORD_SIZE, 0 if out is too small
+ */
+size_t encodeStatusRecord(const StatusRecord &record, uint8_t *out, size_t size);
+
+/**
+ * Decode a status record, newer versions with more fields are accepted
+ * @return bool - false if the buffer is too short or the version is unknown
+ */
+bool decodeStatusRecord(const uint8_t *in, size_t length, StatusRecord &record);
+
+/**
+ * Value of the legacy 2 byte status characteristic
+ * Old clients only know 0 (disconnected), 1 (primary) and 2 (secondary), a
+ * network in any later slot is reported as 2.
+ */
+uint16_t legacyStatusValue(const StatusRecord &record);
+
+#endif
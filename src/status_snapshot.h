@@ -0,0 +1,91 @@
+/**
+ * Sequence locked snapshot of a small, trivially copyable value
+ *
+ * Readers copy the value and retry if a write overlapped the copy, so
+ * they never block and never see a half written value. The value is held
+ * in relaxed atomic words, which keeps the concurrent copy well defined.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef STATUS_SNAPSHOT_H
+#define STATUS_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/**
+ * Snapshot
+ * Any number of readers. Writers must not overlap, callers serialize
+ * them, e.g. with a critical section; write sections are a few words long.
+ */
+template <typename T>
+class Snapshot {
+public:
+	Snapshot() : sequence(0) {
+		T initial;
+		memset(&initial, 0, sizeof(initial));
+		store(initial);
+	}
+
+	/** Consistent copy of the value, never blocks */
+	T read() const {
+		T value;
+		while (!tryRead(value)) {
+		}
+		return value;
+	}
+
+	/** Replace the value */
+	void write(const T &value) {
+		uint32_t current = sequence.load(std::memory_order_relaxed);
+		// Odd while the write is in progress
+		sequence.store(current + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		store(value);
+		sequence.store(current + 2, std::memory_order_release);
+	}
+
+	/** Number of completed writes, lets readers detect a change cheaply */
+	uint32_t version() const {
+		return sequence.load(std::memory_order_acquire) >> 1;
+	}
+
+private:
+	static const size_t WORDS = (sizeof(T) + 3) / 4;
+
+	/**
+	 * Single read attempt
+	 * @return bool - false if a write overlapped, value is then undefined
+	 */
+	bool tryRead(T &value) const {
+		uint32_t before = sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			return false;
+		}
+		uint32_t copy[WORDS];
+		for (size_t index = 0; index < WORDS; index++) {
+			copy[index] = words[index].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence.load(std::memory_order_relaxed) != before) {
+			return false;
+		}
+		memcpy(&value, copy, sizeof(T));
+		return true;
+	}
+
+	void store(const T &value) {
+		uint32_t copy[WORDS] = {0};
+		memcpy(copy, &value, sizeof(T));
+		for (size_t index = 0; index < WORDS; index++) {
+			words[index].store(copy[index], std::memory_order_relaxed);
+		}
+	}
+
+	std::atomic<uint32_t> sequence;
+	std::atomic<uint32_t> words[WORDS];
+};
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Binary TLV provisioning format
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "tlv_codec.h"
+
+#include <string.h>
+
+namespace {
+
+/** Copy a field value into a slot, fails if it does not fit */
+bool copyField(char *slot, size_t size, const uint8_t *value, uint8_t valueLength) {
+	if (valueLength >= size || memchr(value, 0, valueLength) != NULL) {
+		return false;
+	}
+	memcpy(slot, value, valueLength);
+	slot[valueLength] = 0;
+	return true;
+}
+
+/** Append one field, advancing pos */
+bool putField(uint8_t *out, size_t size, size_t &pos, TlvTag tag, const char *value) {
+	size_t valueLength = strlen(value);
+	if (valueLength > 0xFF || pos + 2 + valueLength > size) {
+		return false;
+	}
+	out[pos++] = tag;
+	out[pos++] = (uint8_t) valueLength;
+	memcpy(out + pos, value, valueLength);
+	pos += valueLength;
+	return true;
+}
+
+}
+
+CredCommand parseTlvCredentials(const uint8_t *frame, size_t length, WiFiCredentials &credentials) {
+	if (length < TLV_HEADER_SIZE || frame[0] != TLV_MAGIC || frame[1] == 0 || frame[1] > TLV_VERSION) {
+		return CRED_INVALID;
+	}
+
+	WiFiCredentials received = credentials;
+	bool hasField = false;
+	size_t pos = TLV_HEADER_SIZE;
+	while (pos < length) {
+		if (length - pos < 2 || length - pos - 2 < frame[pos + 1]) {
+			return CRED_INVALID;
+		}
+		uint8_t tag = frame[pos];
+		uint8_t valueLength = frame[pos + 1];
+		const uint8_t *value = frame + pos + 2;
+		pos += 2 + valueLength;
+
+		bool fits = true;
+		switch (tag) {
+			case TLV_TAG_SSID_PRIM: fits = copyField(received.ssidPrim, sizeof(received.ssidPrim), value, valueLength); break;
+			case TLV_TAG_PW_PRIM: fits = copyField(received.pwPrim, sizeof(received.pwPrim), value, valueLength); break;
+			case TLV_TAG_SSID_SEC: fits = copyField(received.ssidSec, sizeof(received.ssidSec), value, valueLength); break;
+			case TLV_TAG_PW_SEC: fits = copyField(received.pwSec, sizeof(received.pwSec), value, valueLength); break;
+			default:
+				// Field of a newer version
+				continue;
+		}
+		if (!fits) {
+			return CRED_INVALID;
+		}
+		hasField = true;
+	}
+
+	switch (frame[2]) {
+		case TLV_OP_SET_CREDENTIALS:
+			if (!hasField) {
+				return CRED_NONE;
+			}
+			credentials = received;
+			return CRED_SET;
+		case TLV_OP_ERASE:
+			return CRED_ERASE;
+		case TLV_OP_RESET:
+			return CRED_RESET;
+		case TLV_OP_ADD_NETWORK:
+			return CRED_ADD_NETWORK;
+		case TLV_OP_REMOVE_NETWORK:
+			return CRED_REMOVE_NETWORK;
+		default:
+			return CRED_NONE;
+	}
+}
+
+bool parseTlvNetwork(const uint8_t *frame, size_t length, TlvNetwork &network) {
+	memset(&network, 0, sizeof(network));
+	if (length < TLV_HEADER_SIZE) {
+		return false;
+	}
+	size_t pos = TLV_HEADER_SIZE;
+	while (pos < length) {
+		if (length - pos < 2 || length - pos - 2 < frame[pos + 1]) {
+			return false;
+		}
+		uint8_t tag = frame[pos];
+		uint8_t valueLength = frame[pos + 1];
+		const uint8_t *value = frame + pos + 2;
+		pos += 2 + valueLength;
+
+		bool fits = true;
+		switch (tag) {
+			case TLV_TAG_SSID: fits = copyField(network.ssid, sizeof(network.ssid), value, valueLength); break;
+			case TLV_TAG_PW: fits = copyField(network.pw, sizeof(network.pw), value, valueLength); break;
+			case TLV_TAG_PRIORITY:
+				fits = valueLength == 1;
+				if (fits) network.priority = value[0];
+				break;
+			default:
+				break;
+		}
+		if (!fits) {
+			return false;
+		}
+	}
+	return network.ssid[0] != 0;
+}
+
+size_t tlvEncodeCommand(uint8_t *out, size_t size, TlvOpcode opcode) {
+	if (size < TLV_HEADER_SIZE) {
+		return 0;
+	}
+	out[0] = TLV_MAGIC;
+	out[1] = TLV_VERSION;
+	out[2] = opcode;
+	return TLV_HEADER_SIZE;
+}
+
+size_t tlvEncodeCredentials(uint8_t *out, size_t size, TlvOpcode opcode, const WiFiCredentials &credentials) {
+	size_t pos = tlvEncodeCommand(out, size, opcode);
+	if (pos == 0
+			|| !putField(out, size, pos, TLV_TAG_SSID_PRIM, credentials.ssidPrim)
+			|| !putField(out, size, pos, TLV_TAG_PW_PRIM, credentials.pwPrim)
+			|| !putField(out, size, pos, TLV_TAG_SSID_SEC, credentials.ssidSec)
+			|| !putField(out, size, pos, TLV_TAG_PW_SEC, credentials.pwSec)) {
+		return 0;
+	}
+	return pos;
+}
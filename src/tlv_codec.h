@@ -0,0 +1,106 @@
+/**
+ * Binary TLV provisioning format
+ *
+ * Compact alternative to the JSON credential writes, accepted on the same
+ * characteristic and told apart by its leading magic byte:
+ *
+ *   magic (0xA5) | version | opcode | tag | length | value | tag | ...
+ *
+ * The frame is XOR encoded like the JSON form. Unknown tags are skipped,
+ * so newer clients can add fields.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef TLV_CODEC_H
+#define TLV_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "credentials.h"
+#include "cred_parser.h"
+
+/** First byte of a TLV frame, never the start of a JSON text */
+#define TLV_MAGIC 0xA5
+/** Format version written by the encoder, frames with a newer version are rejected */
+#define TLV_VERSION 1
+/** Magic, version and opcode */
+#define TLV_HEADER_SIZE 3
+
+/** Operation of a TLV frame */
+enum TlvOpcode {
+	/** Update the credential fields present in the frame */
+	TLV_OP_SET_CREDENTIALS = 0x01,
+	/** Erase stored credentials */
+	TLV_OP_ERASE = 0x02,
+	/** Restart the device */
+	TLV_OP_RESET = 0x03,
+	/** Credentials sent back on a read */
+	TLV_OP_CREDENTIALS = 0x04,
+	/** Add a network to the table, or update the one with the same SSID */
+	TLV_OP_ADD_NETWORK = 0x05,
+	/** Remove the network with the SSID of the frame */
+	TLV_OP_REMOVE_NETWORK = 0x06
+};
+
+/** Field tags */
+enum TlvTag {
+	TLV_TAG_SSID_PRIM = 0x01,
+	TLV_TAG_PW_PRIM = 0x02,
+	TLV_TAG_SSID_SEC = 0x03,
+	TLV_TAG_PW_SEC = 0x04,
+	/** Fields of TLV_OP_ADD_NETWORK and TLV_OP_REMOVE_NETWORK */
+	TLV_TAG_SSID = 0x05,
+	TLV_TAG_PW = 0x06,
+	/** 1 byte, higher is preferred */
+	TLV_TAG_PRIORITY = 0x07
+};
+
+/** Network carried by an add or remove frame */
+struct TlvNetwork {
+	char ssid[CRED_SSID_SIZE];
+	char pw[CRED_PW_SIZE];
+	uint8_t priority;
+};
+
+/** Check if a decoded payload is a TLV frame */
+inline bool isTlvFrame(const uint8_t *frame, size_t length) {
+	return length >= 1 && frame[0] == TLV_MAGIC;
+}
+
+/**
+ * Parse a decoded TLV frame
+ * @param frame - decoded payload starting with TLV_MAGIC
+ * @param length - payload length in bytes
+ * @param credentials - current credentials, fields present in a set frame
+ *                      replace their slots if CRED_SET is returned
+ * @return CredCommand - command carried by the frame
+ */
+CredCommand parseTlvCredentials(const uint8_t *frame, size_t length, WiFiCredentials &credentials);
+
+/**
+ * Parse the network of a frame for which parseTlvCredentials() returned
+ * CRED_ADD_NETWORK or CRED_REMOVE_NETWORK
+ * @param network - receives the fields, missing ones are empty or 0
+ * @return bool - false if the frame has no SSID or a value does not fit
+ */
+bool parseTlvNetwork(const uint8_t *frame, size_t length, TlvNetwork &network);
+
+/**
+ * Encode a frame without fields, e.g. erase or reset
+ * @return size_t - frame length, 0 if out is too small
+ */
+size_t tlvEncodeCommand(uint8_t *out, size_t size, TlvOpcode opcode);
+
+/**
+ * Encode all four credential fields
+ * @param opcode - TLV_OP_SET_CREDENTIALS for writes, TLV_OP_CREDENTIALS for read responses
+ * @return size_t - frame length, 0 if out is too small
+ */
+size_t tlvEncodeCredentials(uint8_t *out, size_t size, TlvOpcode opcode, const WiFiCredentials &credentials);
+
+/** Largest frame tlvEncodeCredentials() can produce */
+#define TLV_MAX_CREDENTIALS_FRAME (TLV_HEADER_SIZE + 4 * 2 + 2 * (CRED_SSID_SIZE - 1) + 2 * (CRED_PW_SIZE - 1))
+
+#endif
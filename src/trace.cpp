@@ -0,0 +1,136 @@
+/**
+ * Provisioning latency trace
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "trace.h"
+
+#if APP_TRACE
+
+#include <stdio.h>
+#include <atomic>
+
+namespace {
+
+#define TRACK_BLE 1
+#define TRACK_SCAN 2
+#define TRACK_WIFI 3
+#define TRACKS 3
+
+const char * const trackNames[TRACKS] = { "BLE", "scan", "WiFi" };
+
+struct PointInfo {
+	const char *name;
+	/** Chrome phase: B begins a span, E ends it, i is an instant */
+	char phase;
+	uint8_t track;
+};
+
+const PointInfo points[TRACE_POINTS] = {
+	{ "BLE connect", 'i', TRACK_BLE },
+	{ "credential write", 'B', TRACK_BLE },
+	{ "decoded", 'i', TRACK_BLE },
+	{ "persisted", 'i', TRACK_BLE },
+	{ "credential write", 'E', TRACK_BLE },
+	{ "scan", 'B', TRACK_SCAN },
+	{ "scan", 'E', TRACK_SCAN },
+	{ "connect", 'i', TRACK_WIFI },
+	{ "associated", 'i', TRACK_WIFI },
+	{ "got IP", 'i', TRACK_WIFI },
+	{ "status notified", 'i', TRACK_BLE }
+};
+
+struct Event {
+	uint32_t time;
+	int32_t arg;
+	uint8_t point;
+};
+
+/**
+ * Slots are claimed in order and overwritten round after round. The sequence
+ * is the position + 1 once the event is complete, 0 while it is written, so
+ * the exporter can tell a slot that changed under it.
+ */
+struct Slot {
+	std::atomic<uint32_t> sequence;
+	Event event;
+};
+
+Slot slots[TRACE_EVENTS];
+std::atomic<uint32_t> recorded(0);
+uint32_t (*traceClock)() = NULL;
+
+/** Copy the event of a position, false if it was overwritten or is being written */
+bool readSlot(uint32_t position, Event &event) {
+	Slot &slot = slots[position % TRACE_EVENTS];
+	if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+		return false;
+	}
+	event = slot.event;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == position + 1;
+}
+
+}
+
+void traceBegin(uint32_t (*clock)()) {
+	traceClock = clock;
+}
+
+void traceEvent(uint8_t point, int32_t arg) {
+	if (traceClock == NULL || point >= TRACE_POINTS) {
+		return;
+	}
+	uint32_t position = recorded.fetch_add(1, std::memory_order_relaxed);
+	Slot &slot = slots[position % TRACE_EVENTS];
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.event.time = traceClock();
+	slot.event.arg = arg;
+	slot.event.point = point;
+	slot.sequence.store(position + 1, std::memory_order_release);
+}
+
+TraceExport::TraceExport() : stage(0), first(true) {
+	end = recorded.load(std::memory_order_acquire);
+	position = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+}
+
+size_t TraceExport::next(char *out, size_t size) {
+	const char *separator = first ? "" : ",";
+	int length = 0;
+	if (stage == 0) {
+		length = snprintf(out, size, "{\"traceEvents\":[\n");
+		stage++;
+	} else if (stage <= TRACKS) {
+		// Names of the tracks
+		length = snprintf(out, size, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}\n",
+			separator, (unsigned)stage, trackNames[stage - 1]);
+		first = false;
+		stage++;
+	} else if (stage == TRACKS + 1) {
+		Event event = {};
+		while (position < end && !readSlot(position, event)) {
+			position++;
+		}
+		if (position == end) {
+			stage++;
+			return next(out, size);
+		}
+		position++;
+		const PointInfo &info = points[event.point];
+		length = snprintf(out, size, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%u,%s\"args\":{\"arg\":%d}}\n",
+			separator, info.name, info.phase, (unsigned)event.time, (unsigned)info.track, info.phase == 'i' ? "\"s\":\"t\"," : "", (int)event.arg);
+		first = false;
+	} else if (stage == TRACKS + 2) {
+		length = snprintf(out, size, "]}\n");
+		stage++;
+	}
+	if (length < 0) {
+		return 0;
+	}
+	return (size_t)length < size ? length : size - 1;
+}
+
+#endif
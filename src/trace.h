@@ -0,0 +1,90 @@
+/**
+ * Provisioning latency trace
+ *
+ * Time stamped events at the steps of provisioning, from the BLE
+ * connection over the credential write, scan and association to the first
+ * status notification, kept in a ring of the last TRACE_EVENTS events.
+ * TraceExport writes them as Chrome trace-event JSON, which
+ * chrome://tracing and ui.perfetto.dev open as a timeline.
+ *
+ * Off unless built with -DAPP_TRACE=1: TRACE() then compiles to nothing,
+ * arguments included, and the ring takes no memory.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef APP_TRACE
+#define APP_TRACE 0
+#endif
+
+/** Number of events kept, a power of 2 */
+#define TRACE_EVENTS 128
+/** Buffer size TraceExport::next() needs, one event per line */
+#define TRACE_LINE_SIZE 160
+
+/** Trace points, each has a fixed name, phase and track */
+enum TracePoint {
+	/** Track BLE */
+	TRACE_BLE_CONNECT = 0,
+	/** Begins the credential write span, arg is the length */
+	TRACE_CRED_RECEIVED,
+	TRACE_CRED_DECODED,
+	/** arg is 1 if the networks were stored, 0 if unchanged */
+	TRACE_CRED_PERSISTED,
+	/** Ends the credential write span, arg is the CredCommand */
+	TRACE_CRED_DONE,
+	/** Track scan, begins and ends the scan span, arg of the end is the AP count or -1 */
+	TRACE_SCAN_START,
+	TRACE_SCAN_END,
+	/** Track WiFi */
+	TRACE_CONNECT_START,
+	TRACE_ASSOCIATED,
+	TRACE_GOT_IP,
+	/** arg is the status value notified */
+	TRACE_STATUS_NOTIFIED,
+	TRACE_POINTS
+};
+
+#if APP_TRACE
+#define TRACE(point, arg) traceEvent(point, arg)
+#else
+#define TRACE(point, arg) do { } while (0)
+#endif
+
+/** @param clock - time stamp source in us */
+void traceBegin(uint32_t (*clock)());
+/** Record an event, use TRACE() instead */
+void traceEvent(uint8_t point, int32_t arg);
+
+/**
+ * TraceExport
+ * Writes the recorded events as one JSON document, a line at a time.
+ * Events recorded after the export started are left out; events that are
+ * overwritten while it runs are skipped.
+ */
+class TraceExport {
+public:
+	TraceExport();
+
+	/**
+	 * Write the next line
+	 * @param out - at least TRACE_LINE_SIZE bytes
+	 * @return size_t - length of the line, 0 once the document is complete
+	 */
+	size_t next(char *out, size_t size);
+
+private:
+	uint32_t position;
+	uint32_t end;
+	uint8_t stage;
+	/** Nothing was written into the array yet */
+	bool first;
+};
+
+#endif
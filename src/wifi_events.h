@@ -0,0 +1,71 @@
+/**
+ * Dispatch table for WiFi events
+ *
+ * The platform registers one callback for all events and passes each
+ * event to dispatch(). Every event has at most one handler, so setting a
+ * handler again replaces it instead of adding a second call, and each
+ * event is counted for the diagnostics.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef WIFI_EVENTS_H
+#define WIFI_EVENTS_H
+
+#include <stdint.h>
+#include <string.h>
+
+/** Event ids below this have a slot, must cover system_event_id_t */
+#define WIFI_EVENT_SLOTS 32
+
+/**
+ * EventDispatcher
+ * Info is the event data of the platform, passed through to the handler.
+ * Handlers are set before the platform delivers events. The counts are
+ * only written by dispatch(), which the platform calls from one task.
+ */
+template <typename Info>
+class EventDispatcher {
+public:
+	typedef void (*Handler)(uint16_t event, const Info &info);
+
+	EventDispatcher() {
+		memset(handlers, 0, sizeof(handlers));
+		memset(counts, 0, sizeof(counts));
+	}
+
+	/**
+	 * Set the handler of an event
+	 * @param handler - replaces the previous one, NULL to only count the event
+	 * @return bool - false if the event id has no slot
+	 */
+	bool on(uint16_t event, Handler handler) {
+		if (event >= WIFI_EVENT_SLOTS) {
+			return false;
+		}
+		handlers[event] = handler;
+		return true;
+	}
+
+	/** Count an event and run its handler, events without a slot are ignored */
+	void dispatch(uint16_t event, const Info &info) {
+		if (event >= WIFI_EVENT_SLOTS) {
+			return;
+		}
+		counts[event]++;
+		if (handlers[event] != NULL) {
+			handlers[event](event, info);
+		}
+	}
+
+	/** Number of times an event was dispatched */
+	uint32_t count(uint16_t event) const {
+		return event < WIFI_EVENT_SLOTS ? counts[event] : 0;
+	}
+
+private:
+	Handler handlers[WIFI_EVENT_SLOTS];
+	uint32_t counts[WIFI_EVENT_SLOTS];
+};
+
+#endif
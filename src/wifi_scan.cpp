@@ -0,0 +1,53 @@
+/**
+ * Scan of the scan task
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include "wifi_scan.h"
+
+#include "app_log.h"
+
+int runScan(const ScanPolicy &policy, ScanRadio &radio, ScanSnapshot &result) {
+	result.count = 0;
+	result.partial = false;
+
+	if (scanPolicySinglePass(policy)) {
+		int found = radio.scanChannel(policy, 0);
+		if (found < 0) {
+			// e.g. the station is in the middle of connecting, keep the last results
+			LOG_WARN("WiFi scan failed");
+			return -1;
+		}
+		radio.copyResults(result, found);
+		return result.count;
+	}
+
+	uint8_t scanned = 0;
+	uint8_t failed = 0;
+	for (uint8_t channel = 1; channel <= SCAN_MAX_CHANNEL; channel++) {
+		if (!(policy.channelMask & SCAN_CHANNEL(channel))) {
+			continue;
+		}
+		scanned++;
+		int found = radio.scanChannel(policy, channel);
+		if (found < 0) {
+			failed++;
+			continue;
+		}
+		radio.copyResults(result, found);
+		if (policy.stopWhenKnownFound && radio.knownNetworksFound(result)) {
+			LOG_INFO("Known networks found, stopping after channel %d", channel);
+			result.partial = scanned < scanPolicyChannels(policy);
+			break;
+		}
+	}
+	if (scanned > 0 && failed == scanned) {
+		LOG_WARN("WiFi scan failed");
+		return -1;
+	}
+	if (failed > 0) {
+		result.partial = true;
+	}
+	return result.count;
+}
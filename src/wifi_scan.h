@@ -0,0 +1,55 @@
+/**
+ * Scan of the scan task
+ *
+ * Runs a ScanPolicy on the radio: a single pass over all channels if the
+ * policy allows it, else channel by channel, stopping early once every
+ * stored network was seen if the policy asks for it. Scans never take the
+ * station down, a scan while connected keeps the association and the IP
+ * address. Only a connect to another network drops the link.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#ifndef WIFI_SCAN_H
+#define WIFI_SCAN_H
+
+#include <stdint.h>
+
+#include "scan_cache.h"
+#include "scan_policy.h"
+
+/** Age in ms after which a SSID list read requests a new scan */
+#define SCAN_MAX_AGE 10000
+
+/**
+ * ScanRadio
+ * Implemented by the platform, called from the scan task only.
+ */
+class ScanRadio {
+public:
+	virtual ~ScanRadio() {}
+	/**
+	 * Scan a single channel, or all channels of the policy if channel is 0, and wait for the results
+	 * @return int - number of found access points, -1 if the scan failed
+	 */
+	virtual int scanChannel(const ScanPolicy &policy, uint8_t channel) = 0;
+	/** Append the results of the last scanChannel() to result, until SCAN_CACHE_MAX_AP entries */
+	virtual void copyResults(ScanSnapshot &result, int count) = 0;
+	/** Every stored network is in result */
+	virtual bool knownNetworksFound(const ScanSnapshot &result) = 0;
+};
+
+/**
+ * Scan with a policy
+ * @param result - filled with the found access points, partial is set if channels were skipped or failed
+ * @return int - number of found access points, -1 if the scan could not run
+ */
+int runScan(const ScanPolicy &policy, ScanRadio &radio, ScanSnapshot &result);
+
+/** A SSID list read serves scan, but asks for a new one as it is missing, partial or old */
+inline bool listNeedsScan(const ScanSnapshot &scan, uint32_t now) {
+	// scanTime is a millis() value, 32 bits on the device
+	return scan.generation == 0 || scan.partial || (uint32_t)(now - scan.scanTime) > SCAN_MAX_AGE;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * Unit and stress tests of the asynchronous logger
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "../../src/app_log.h"
+
+#define WRITERS 4
+#define LINES_PER_WRITER 50000
+
+LogRing *ring;
+
+uint32_t fixedClock() {
+	return 4242;
+}
+
+void setUp(void) {
+	ring = new LogRing();
+}
+
+void tearDown(void) {
+	delete ring;
+}
+
+bool pushText(uint32_t time, const char *text) {
+	return ring->push(time, LOG_LEVEL_INFO, text, strlen(text));
+}
+
+void test_lines_come_out_in_order(void) {
+	char text[16];
+	for (uint32_t round = 0; round < 3; round++) {
+		for (uint32_t index = 0; index < LOG_SLOTS / 2; index++) {
+			snprintf(text, sizeof(text), "line %u", index);
+			TEST_ASSERT_TRUE(pushText(index, text));
+		}
+		LogLine line;
+		for (uint32_t index = 0; index < LOG_SLOTS / 2; index++) {
+			snprintf(text, sizeof(text), "line %u", index);
+			TEST_ASSERT_TRUE(ring->pop(line));
+			TEST_ASSERT_EQUAL_UINT32(index, line.time);
+			TEST_ASSERT_EQUAL(strlen(text), line.length);
+			TEST_ASSERT_EQUAL_MEMORY(text, line.text, line.length);
+		}
+		TEST_ASSERT_FALSE(ring->pop(line));
+	}
+}
+
+void test_full_ring_drops_and_counts(void) {
+	for (uint32_t index = 0; index < LOG_SLOTS; index++) {
+		TEST_ASSERT_TRUE(pushText(index, "kept"));
+	}
+	TEST_ASSERT_FALSE(pushText(LOG_SLOTS, "dropped"));
+	TEST_ASSERT_FALSE(pushText(LOG_SLOTS, "dropped"));
+	TEST_ASSERT_EQUAL_UINT32(2, ring->dropped());
+
+	// One pop frees one slot
+	LogLine line;
+	TEST_ASSERT_TRUE(ring->pop(line));
+	TEST_ASSERT_EQUAL_UINT32(0, line.time);
+	TEST_ASSERT_TRUE(pushText(LOG_SLOTS + 1, "after"));
+	TEST_ASSERT_FALSE(pushText(LOG_SLOTS + 2, "dropped"));
+	TEST_ASSERT_EQUAL_UINT32(3, ring->dropped());
+}
+
+void test_long_lines_are_truncated(void) {
+	char text[LOG_LINE_SIZE * 2];
+	memset(text, 'x', sizeof(text));
+	TEST_ASSERT_TRUE(ring->push(0, LOG_LEVEL_WARN, text, sizeof(text)));
+	LogLine line;
+	TEST_ASSERT_TRUE(ring->pop(line));
+	TEST_ASSERT_EQUAL(LOG_LINE_SIZE, line.length);
+	TEST_ASSERT_EQUAL_UINT8(LOG_LEVEL_WARN, line.level);
+}
+
+void test_concurrent_writers_lose_nothing_silently(void) {
+	std::atomic<int> finished(0);
+	std::vector<std::thread> writers;
+	for (int writer = 0; writer < WRITERS; writer++) {
+		writers.push_back(std::thread([writer, &finished]() {
+			char text[32];
+			for (uint32_t index = 0; index < LINES_PER_WRITER; index++) {
+				int length = snprintf(text, sizeof(text), "%d:%u", writer, index);
+				ring->push(index, LOG_LEVEL_INFO, text, length);
+			}
+			finished++;
+		}));
+	}
+
+	// Single reader, concurrent with the writers
+	uint32_t popped = 0;
+	uint32_t malformed = 0;
+	int64_t last[WRITERS];
+	for (int writer = 0; writer < WRITERS; writer++) {
+		last[writer] = -1;
+	}
+	LogLine line;
+	while (true) {
+		bool done = finished.load() == WRITERS;
+		if (!ring->pop(line)) {
+			if (done) {
+				break;
+			}
+			continue;
+		}
+		popped++;
+		char text[LOG_LINE_SIZE + 1];
+		memcpy(text, line.text, line.length);
+		text[line.length] = 0;
+		int writer;
+		unsigned index;
+		// Each line belongs to one writer, its lines arrive in order
+		if (sscanf(text, "%d:%u", &writer, &index) != 2 || writer < 0 || writer >= WRITERS
+				|| index != line.time || (int64_t)index <= last[writer]) {
+			malformed++;
+			continue;
+		}
+		last[writer] = index;
+	}
+	for (size_t writer = 0; writer < writers.size(); writer++) {
+		writers[writer].join();
+	}
+
+	TEST_ASSERT_EQUAL_UINT32(0, malformed);
+	TEST_ASSERT_GREATER_THAN(0, popped);
+	// Every line was either delivered or counted as dropped
+	TEST_ASSERT_EQUAL_UINT32(WRITERS * LINES_PER_WRITER, popped + ring->dropped());
+}
+
+void test_lines_are_formatted_with_time_and_level(void) {
+	char out[LOG_OUTPUT_SIZE];
+	// Drain what other code logged before
+	while (appLogNext(out, sizeof(out)) > 0) {
+	}
+	appLogBegin(fixedClock, NULL);
+	LOG_WARN("Network %s priority %d", "warehouse", 3);
+	size_t length = appLogNext(out, sizeof(out));
+	TEST_ASSERT_EQUAL(strlen(out), length);
+	TEST_ASSERT_EQUAL_STRING("4242 W Network warehouse priority 3\n", out);
+	TEST_ASSERT_EQUAL(0, appLogNext(out, sizeof(out)));
+	appLogBegin(NULL, NULL);
+}
+
+void test_levels_above_build_level_are_compiled_out(void) {
+	char out[LOG_OUTPUT_SIZE];
+	while (appLogNext(out, sizeof(out)) > 0) {
+	}
+	int evaluated = 0;
+#if APP_LOG_LEVEL < LOG_LEVEL_DEBUG
+	// Arguments are not even evaluated
+	LOG_DEBUG("%d", ++evaluated);
+	TEST_ASSERT_EQUAL(0, evaluated);
+	TEST_ASSERT_EQUAL(0, appLogNext(out, sizeof(out)));
+#endif
+	LOG_ERROR("%d", ++evaluated);
+	TEST_ASSERT_EQUAL(1, evaluated);
+	TEST_ASSERT_GREATER_THAN(0, appLogNext(out, sizeof(out)));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_lines_come_out_in_order);
+	RUN_TEST(test_full_ring_drops_and_counts);
+	RUN_TEST(test_long_lines_are_truncated);
+	RUN_TEST(test_concurrent_writers_lose_nothing_silently);
+	RUN_TEST(test_lines_are_formatted_with_time_and_level);
+	RUN_TEST(test_levels_above_build_level_are_compiled_out);
+	return UNITY_END();
+}
@@ -0,0 +1,100 @@
+/**
+ * Unit tests of the payload codec
+ *
+ * codecApply() has to give the same bytes as the byte loop of older
+ * versions, which the web app mirrors, for every key length, payload
+ * length and alignment.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/ble_codec.h"
+
+/** Longest payload tested, longer than the longest keystream period */
+#define TEST_MAX_PAYLOAD (2 * CODEC_MAX_PERIOD + 7)
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+/** Decoding loop of older versions */
+void referenceApply(const char *key, uint8_t *data, size_t length) {
+	size_t keyIndex = 0;
+	for (size_t index = 0; index < length; index++) {
+		data[index] = data[index] ^ key[keyIndex];
+		keyIndex++;
+		if (keyIndex >= strlen(key)) keyIndex = 0;
+	}
+}
+
+/** Compare against the byte loop for every length and alignment, with one key */
+void checkKey(const char *key) {
+	BleCodec codec;
+	codecInit(codec, key);
+	// Offsets into the buffers give every alignment of the payload
+	uint8_t expected[TEST_MAX_PAYLOAD + 4];
+	uint8_t actual[TEST_MAX_PAYLOAD + 4];
+	for (size_t offset = 0; offset < 4; offset++) {
+		for (size_t length = 0; length <= TEST_MAX_PAYLOAD; length++) {
+			for (size_t index = 0; index < sizeof(expected); index++) {
+				expected[index] = (uint8_t)(index * 31 + length);
+			}
+			memcpy(actual, expected, sizeof(actual));
+			referenceApply(key, expected + offset, length);
+			codecApply(codec, actual + offset, length);
+			TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, sizeof(actual));
+		}
+	}
+}
+
+void test_matches_byte_loop_for_device_names(void) {
+	checkKey("ESP32-8C0A2F3B");
+	checkKey("ESP32-Bedroom");
+}
+
+void test_matches_byte_loop_for_every_key_length(void) {
+	char key[CODEC_MAX_KEY + 1];
+	for (size_t length = 1; length <= CODEC_MAX_KEY; length++) {
+		for (size_t index = 0; index < length; index++) {
+			key[index] = (char)('A' + (index * 7 + length) % 58);
+		}
+		key[length] = 0;
+		checkKey(key);
+	}
+}
+
+void test_applying_twice_restores_payload(void) {
+	BleCodec codec;
+	codecInit(codec, "ESP32-8C0A2F3B");
+	const char json[] = "{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"office\",\"pwSec\":\"secret2\"}";
+	uint8_t payload[sizeof(json)];
+	memcpy(payload, json, sizeof(json));
+	codecApply(codec, payload, sizeof(json) - 1);
+	TEST_ASSERT_FALSE(memcmp(payload, json, sizeof(json) - 1) == 0);
+	codecApply(codec, payload, sizeof(json) - 1);
+	TEST_ASSERT_EQUAL_STRING(json, (const char *)payload);
+}
+
+void test_empty_key_leaves_payload_unchanged(void) {
+	BleCodec codec;
+	codecInit(codec, "");
+	TEST_ASSERT_EQUAL_UINT16(0, codec.period);
+	uint8_t payload[] = { 1, 2, 3, 4, 5 };
+	const uint8_t expected[] = { 1, 2, 3, 4, 5 };
+	codecApply(codec, payload, sizeof(payload));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, payload, sizeof(payload));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_matches_byte_loop_for_device_names);
+	RUN_TEST(test_matches_byte_loop_for_every_key_length);
+	RUN_TEST(test_applying_twice_restores_payload);
+	RUN_TEST(test_empty_key_leaves_payload_unchanged);
+	return UNITY_END();
+}
@@ -0,0 +1,258 @@
+/**
+ * Unit tests of the table of connected BLE clients
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/client_table.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+/** Address of the n-th test client */
+const uint8_t *address(uint8_t n) {
+	static uint8_t addresses[8][6];
+	for (uint8_t byte = 0; byte < 6; byte++) {
+		addresses[n][byte] = (uint8_t)(0x10 * n + byte);
+	}
+	return addresses[n];
+}
+
+void test_add_until_full(void) {
+	ClientTable table;
+	TEST_ASSERT_EQUAL_UINT8(0, table.count());
+	for (uint8_t n = 0; n < MAX_BLE_CLIENTS; n++) {
+		TEST_ASSERT_TRUE(table.hasFreeSlot());
+		BleClient *client = table.add(n, address(n));
+		TEST_ASSERT_NOT_NULL(client);
+		TEST_ASSERT_EQUAL_UINT16(n, client->connId);
+		TEST_ASSERT_EQUAL_UINT16(BLE_DEFAULT_MTU, client->mtu);
+		TEST_ASSERT_EQUAL_UINT8(n + 1, table.count());
+	}
+	TEST_ASSERT_FALSE(table.hasFreeSlot());
+	TEST_ASSERT_NULL(table.add(MAX_BLE_CLIENTS, address(MAX_BLE_CLIENTS)));
+	TEST_ASSERT_EQUAL_UINT8(MAX_BLE_CLIENTS, table.count());
+}
+
+void test_readding_known_client_resets_it(void) {
+	ClientTable table;
+	BleClient *client = table.add(7, address(0));
+	client->subscriptions = SUB_STATUS;
+	client->mtu = 185;
+	BleClient *again = table.add(7, address(0));
+	TEST_ASSERT_EQUAL_PTR(client, again);
+	TEST_ASSERT_EQUAL_UINT8(1, table.count());
+	TEST_ASSERT_EQUAL_UINT8(0, again->subscriptions);
+	TEST_ASSERT_EQUAL_UINT16(BLE_DEFAULT_MTU, again->mtu);
+}
+
+void test_remove_frees_slot(void) {
+	ClientTable table;
+	for (uint8_t n = 0; n < MAX_BLE_CLIENTS; n++) {
+		table.add(n, address(n));
+	}
+	TEST_ASSERT_TRUE(table.remove(1));
+	TEST_ASSERT_FALSE(table.remove(1));
+	TEST_ASSERT_EQUAL_UINT8(MAX_BLE_CLIENTS - 1, table.count());
+	TEST_ASSERT_NULL(table.find(1));
+	TEST_ASSERT_NOT_NULL(table.find(0));
+
+	TEST_ASSERT_NOT_NULL(table.add(MAX_BLE_CLIENTS, address(MAX_BLE_CLIENTS)));
+	TEST_ASSERT_EQUAL_UINT8(MAX_BLE_CLIENTS, table.count());
+	TEST_ASSERT_NULL(table.add(MAX_BLE_CLIENTS + 1, address(MAX_BLE_CLIENTS + 1)));
+}
+
+void test_remove_of_unknown_client_keeps_count(void) {
+	ClientTable table;
+	TEST_ASSERT_FALSE(table.remove(3));
+	TEST_ASSERT_EQUAL_UINT8(0, table.count());
+	table.add(3, address(0));
+	TEST_ASSERT_FALSE(table.remove(4));
+	TEST_ASSERT_EQUAL_UINT8(1, table.count());
+}
+
+void test_connect_disconnect_cycles_keep_count(void) {
+	ClientTable table;
+	for (uint16_t round = 0; round < 1000; round++) {
+		uint16_t connId = round % 50;
+		TEST_ASSERT_NOT_NULL(table.add(connId, address(round % MAX_BLE_CLIENTS)));
+		TEST_ASSERT_EQUAL_UINT8(1, table.count());
+		TEST_ASSERT_TRUE(table.remove(connId));
+		TEST_ASSERT_EQUAL_UINT8(0, table.count());
+	}
+}
+
+void test_find_by_address(void) {
+	ClientTable table;
+	table.add(4, address(0));
+	table.add(5, address(1));
+	BleClient *client = table.findByAddress(address(1));
+	TEST_ASSERT_NOT_NULL(client);
+	TEST_ASSERT_EQUAL_UINT16(5, client->connId);
+	TEST_ASSERT_NULL(table.findByAddress(address(2)));
+	table.remove(5);
+	TEST_ASSERT_NULL(table.findByAddress(address(1)));
+}
+
+void test_subscribers_counts_used_slots_only(void) {
+	ClientTable table;
+	table.add(0, address(0))->subscriptions = SUB_STATUS;
+	table.add(1, address(1))->subscriptions = SUB_STATUS | SUB_STATUS_EXT;
+	table.add(2, address(2));
+	TEST_ASSERT_EQUAL_UINT8(2, table.subscribers(SUB_STATUS));
+	TEST_ASSERT_EQUAL_UINT8(1, table.subscribers(SUB_STATUS_EXT));
+	TEST_ASSERT_EQUAL_UINT8(2, table.subscribers(SUB_STATUS | SUB_STATUS_EXT));
+	table.remove(1);
+	TEST_ASSERT_EQUAL_UINT8(1, table.subscribers(SUB_STATUS));
+	TEST_ASSERT_EQUAL_UINT8(0, table.subscribers(SUB_STATUS_EXT));
+}
+
+/** Run an advertising change the way updateAdvertising() does */
+void applyAdvertising(const ClientTable &table, bool &advertising) {
+	switch (advertisingChange(table, advertising)) {
+		case ADVERTISING_START:
+			advertising = true;
+			break;
+		case ADVERTISING_STOP:
+			advertising = false;
+			break;
+		case ADVERTISING_KEEP:
+			break;
+	}
+}
+
+void test_advertising_resumes_below_the_limit(void) {
+	ClientTable table;
+	bool advertising = true;
+	TEST_ASSERT_EQUAL(ADVERTISING_KEEP, advertisingChange(table, advertising));
+	for (uint8_t n = 0; n < MAX_BLE_CLIENTS; n++) {
+		table.add(n, address(n));
+		// The controller stopped advertising for the connection
+		advertising = false;
+		TEST_ASSERT_EQUAL(n + 1 < MAX_BLE_CLIENTS ? ADVERTISING_START : ADVERTISING_KEEP, advertisingChange(table, advertising));
+		applyAdvertising(table, advertising);
+	}
+	TEST_ASSERT_FALSE(advertising);
+
+	// A disconnect of a full table frees a slot, advertising starts again
+	table.remove(1);
+	TEST_ASSERT_EQUAL(ADVERTISING_START, advertisingChange(table, advertising));
+	applyAdvertising(table, advertising);
+	table.remove(2);
+	TEST_ASSERT_EQUAL(ADVERTISING_KEEP, advertisingChange(table, advertising));
+
+	// Full while advertising is stopped
+	table.add(1, address(1));
+	table.add(2, address(2));
+	TEST_ASSERT_EQUAL(ADVERTISING_STOP, advertisingChange(table, true));
+}
+
+/** Clients connecting and disconnecting at once, more than fit the table */
+#define CHURN_CLIENTS (2 * MAX_BLE_CLIENTS)
+#define CHURN_ROUNDS 2000
+
+void test_concurrent_connect_disconnect_churn(void) {
+	ClientTable table;
+	// Serializes the table like clientsSemaphore in the sketch
+	std::mutex tableMutex;
+	bool advertising = true;
+	std::atomic<int> finished(0);
+	std::atomic<uint32_t> connected(0);
+	std::atomic<uint32_t> rejected(0);
+	std::atomic<uint32_t> errors(0);
+	std::vector<std::thread> clients;
+	for (uint8_t n = 0; n < CHURN_CLIENTS; n++) {
+		clients.push_back(std::thread([n, &table, &tableMutex, &advertising, &finished, &connected, &rejected, &errors]() {
+			for (uint16_t round = 0; round < CHURN_ROUNDS; round++) {
+				uint16_t connId = (uint16_t)(n * CHURN_ROUNDS + round);
+				bool added;
+				{
+					std::lock_guard<std::mutex> guard(tableMutex);
+					BleClient *client = table.add(connId, address(n));
+					added = client != NULL;
+					if (added) {
+						client->usesTlv = n & 1;
+						client->subscriptions = SUB_STATUS;
+					}
+					advertising = false;
+					applyAdvertising(table, advertising);
+					if (table.count() > MAX_BLE_CLIENTS || advertising != table.hasFreeSlot()) {
+						errors++;
+					}
+				}
+				if (!added) {
+					rejected++;
+					std::this_thread::yield();
+					continue;
+				}
+				connected++;
+				std::this_thread::yield();
+				{
+					std::lock_guard<std::mutex> guard(tableMutex);
+					// No other connection changed this client
+					BleClient *client = table.find(connId);
+					if (client == NULL || memcmp(client->address, address(n), 6) || client->usesTlv != (bool)(n & 1)
+							|| table.findByAddress(address(n)) != client) {
+						errors++;
+					}
+					if (!table.remove(connId)) {
+						errors++;
+					}
+					applyAdvertising(table, advertising);
+					if (!advertising) {
+						errors++;
+					}
+				}
+			}
+			finished++;
+		}));
+	}
+
+	// Notification task, walks the slots while clients come and go
+	uint32_t walks = 0;
+	while (finished.load() < CHURN_CLIENTS) {
+		std::lock_guard<std::mutex> guard(tableMutex);
+		uint8_t used = 0;
+		for (size_t index = 0; index < MAX_BLE_CLIENTS; index++) {
+			used += table.slot(index).used ? 1 : 0;
+		}
+		if (used != table.count() || table.subscribers(SUB_STATUS) != used) {
+			errors++;
+		}
+		walks++;
+	}
+	for (size_t n = 0; n < clients.size(); n++) {
+		clients[n].join();
+	}
+
+	TEST_ASSERT_EQUAL_UINT32(0, errors.load());
+	TEST_ASSERT_EQUAL_UINT32(CHURN_CLIENTS * CHURN_ROUNDS, connected.load() + rejected.load());
+	TEST_ASSERT_GREATER_THAN(0, connected.load());
+	TEST_ASSERT_GREATER_THAN(0, walks);
+	TEST_ASSERT_EQUAL_UINT8(0, table.count());
+	TEST_ASSERT_TRUE(advertising);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_add_until_full);
+	RUN_TEST(test_readding_known_client_resets_it);
+	RUN_TEST(test_remove_frees_slot);
+	RUN_TEST(test_remove_of_unknown_client_keeps_count);
+	RUN_TEST(test_connect_disconnect_cycles_keep_count);
+	RUN_TEST(test_find_by_address);
+	RUN_TEST(test_subscribers_counts_used_slots_only);
+	RUN_TEST(test_advertising_resumes_below_the_limit);
+	RUN_TEST(test_concurrent_connect_disconnect_churn);
+	return UNITY_END();
+}
@@ -0,0 +1,263 @@
+/**
+ * Unit tests of the WiFi connection state machine
+ *
+ * The radio is replaced by RecordingActions, time is passed in by the
+ * tests.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <unity.h>
+
+#include "../../src/conn_manager.h"
+
+/**
+ * RecordingActions
+ * Counts the calls of the manager, answers with the configured results
+ */
+class RecordingActions: public ConnActions {
+public:
+	RecordingActions()
+		: hasCachedAp(false), networkFound(true), scans(0), connects(0), cachedConnects(0), disconnects(0),
+		  connections(0), fastConnections(0), lastState(CM_IDLE), lastTimeout(0) {}
+
+	void startScan() {
+		scans++;
+	}
+
+	bool selectNetwork() {
+		return networkFound;
+	}
+
+	bool connectCached() {
+		if (hasCachedAp) {
+			cachedConnects++;
+		}
+		return hasCachedAp;
+	}
+
+	void connect() {
+		connects++;
+	}
+
+	void disconnect() {
+		disconnects++;
+	}
+
+	void connected(bool fast) {
+		connections++;
+		if (fast) {
+			fastConnections++;
+		}
+	}
+
+	void stateChanged(ConnManagerState state, uint32_t timeout) {
+		lastState = state;
+		lastTimeout = timeout;
+	}
+
+	bool hasCachedAp;
+	bool networkFound;
+	uint32_t scans;
+	uint32_t connects;
+	uint32_t cachedConnects;
+	uint32_t disconnects;
+	uint32_t connections;
+	uint32_t fastConnections;
+	ConnManagerState lastState;
+	uint32_t lastTimeout;
+};
+
+RecordingActions *actions;
+ConnManagerConfig config;
+ConnManager *manager;
+
+void setUp(void) {
+	actions = new RecordingActions();
+	config.debounceMs = CM_DEBOUNCE_TIME;
+	config.quickRetry = true;
+	config.backoffMinMs = CM_BACKOFF_MIN;
+	config.backoffMaxMs = CM_BACKOFF_MAX;
+	config.jitterPercent = 0;
+	manager = new ConnManager(*actions, config);
+}
+
+void tearDown(void) {
+	delete manager;
+	delete actions;
+}
+
+void post(uint8_t type, uint32_t now) {
+	ConnEvent event = { type, 0 };
+	manager->handle(event, now);
+}
+
+/** Scan, connect and get an IP, at time 0 */
+void connectByScan() {
+	manager->begin(true, 0);
+	TEST_ASSERT_EQUAL(CM_SCANNING, manager->state());
+	post(CM_EVT_SCAN_DONE, 0);
+	TEST_ASSERT_EQUAL(CM_CONNECTING, manager->state());
+	post(CM_EVT_GOT_IP, 0);
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+}
+
+void test_scan_done_while_connected_keeps_connection(void) {
+	connectByScan();
+	uint32_t connects = actions->connects;
+	// SSID list reads scan while associated
+	for (uint32_t scan = 0; scan < 100; scan++) {
+		post(CM_EVT_SCAN_DONE, 1000 + scan);
+	}
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(0, actions->disconnects);
+	TEST_ASSERT_EQUAL_UINT32(connects, actions->connects);
+	TEST_ASSERT_EQUAL_UINT32(1, actions->connections);
+	TEST_ASSERT_EQUAL_UINT32(CM_NO_TIMEOUT, manager->nextTimeout(2000));
+}
+
+void test_scan_done_while_connecting_keeps_attempt(void) {
+	manager->begin(true, 0);
+	post(CM_EVT_SCAN_DONE, 0);
+	TEST_ASSERT_EQUAL(CM_CONNECTING, manager->state());
+	post(CM_EVT_SCAN_DONE, 100);
+	TEST_ASSERT_EQUAL(CM_CONNECTING, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(1, actions->connects);
+	TEST_ASSERT_EQUAL_UINT32(CM_CONNECT_TIMEOUT - 100, manager->nextTimeout(100));
+}
+
+/** Let the pending timeout expire, returns the time it expired at */
+uint32_t expire(uint32_t now) {
+	uint32_t timeout = manager->nextTimeout(now);
+	TEST_ASSERT_TRUE(timeout != CM_NO_TIMEOUT);
+	manager->tick(now + timeout);
+	return now + timeout;
+}
+
+void test_backoff_doubles_up_to_maximum(void) {
+	actions->networkFound = false;
+	manager->begin(true, 0);
+	uint32_t now = 0;
+	uint32_t expected = CM_BACKOFF_MIN;
+	for (int attempt = 0; attempt < 10; attempt++) {
+		post(CM_EVT_SCAN_DONE, now);
+		TEST_ASSERT_EQUAL(CM_BACKOFF, manager->state());
+		TEST_ASSERT_EQUAL_UINT32(expected, actions->lastTimeout);
+		TEST_ASSERT_EQUAL_UINT8(attempt + 1, manager->failures());
+		now = expire(now);
+		TEST_ASSERT_EQUAL(CM_SCANNING, manager->state());
+		expected = expected * 2 < CM_BACKOFF_MAX ? expected * 2 : CM_BACKOFF_MAX;
+	}
+	// The last attempts waited the maximum
+	TEST_ASSERT_EQUAL_UINT32(CM_BACKOFF_MAX, expected);
+}
+
+void test_success_resets_backoff(void) {
+	actions->networkFound = false;
+	manager->begin(true, 0);
+	post(CM_EVT_SCAN_DONE, 0);
+	uint32_t now = expire(0);
+	post(CM_EVT_SCAN_DONE, now);
+	TEST_ASSERT_EQUAL_UINT32(2 * CM_BACKOFF_MIN, actions->lastTimeout);
+	now = expire(now);
+
+	actions->networkFound = true;
+	post(CM_EVT_SCAN_DONE, now);
+	post(CM_EVT_GOT_IP, now);
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+	TEST_ASSERT_EQUAL_UINT8(0, manager->failures());
+
+	config.debounceMs = 0;
+	actions->networkFound = false;
+	post(CM_EVT_LOST, now);
+	post(CM_EVT_SCAN_DONE, now);
+	TEST_ASSERT_EQUAL_UINT32(CM_BACKOFF_MIN, actions->lastTimeout);
+}
+
+void test_connect_timeout_backs_off(void) {
+	manager->begin(true, 0);
+	post(CM_EVT_SCAN_DONE, 0);
+	TEST_ASSERT_EQUAL(CM_CONNECTING, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(CM_CONNECT_TIMEOUT, manager->nextTimeout(0));
+	expire(0);
+	TEST_ASSERT_EQUAL(CM_BACKOFF, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(CM_BACKOFF_MIN, actions->lastTimeout);
+}
+
+void test_link_back_within_debounce_is_not_a_reconnect(void) {
+	connectByScan();
+	uint32_t scans = actions->scans;
+	post(CM_EVT_LOST, 5000);
+	TEST_ASSERT_EQUAL(CM_DEBOUNCE, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(CM_DEBOUNCE_TIME, manager->nextTimeout(5000));
+	post(CM_EVT_GOT_IP, 5000 + CM_DEBOUNCE_TIME / 2);
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(scans, actions->scans);
+	TEST_ASSERT_EQUAL_UINT32(1, actions->fastConnections);
+	TEST_ASSERT_EQUAL_UINT32(0, actions->disconnects);
+}
+
+void test_debounce_expiry_retries_cached_ap_first(void) {
+	connectByScan();
+	actions->hasCachedAp = true;
+	uint32_t scans = actions->scans;
+	post(CM_EVT_LOST, 5000);
+	uint32_t now = expire(5000);
+	TEST_ASSERT_EQUAL(CM_CONNECTING, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(1, actions->cachedConnects);
+	TEST_ASSERT_EQUAL_UINT32(CM_FAST_CONNECT_TIMEOUT, actions->lastTimeout);
+	// The cached AP does not answer, fall back to a scan
+	expire(now);
+	TEST_ASSERT_EQUAL(CM_SCANNING, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(scans + 1, actions->scans);
+}
+
+void test_without_debounce_or_quick_retry_scans_at_once(void) {
+	config.debounceMs = 0;
+	config.quickRetry = false;
+	actions->hasCachedAp = true;
+	manager->begin(true, 0);
+	post(CM_EVT_GOT_IP, 0);
+	uint32_t scans = actions->scans;
+	post(CM_EVT_LOST, 1000);
+	TEST_ASSERT_EQUAL(CM_SCANNING, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(scans + 1, actions->scans);
+	TEST_ASSERT_EQUAL_UINT32(1, actions->cachedConnects);
+}
+
+void test_jitter_spreads_delay_within_bounds(void) {
+	config.jitterPercent = CM_BACKOFF_JITTER;
+	uint32_t spread = CM_BACKOFF_MIN / 100 * CM_BACKOFF_JITTER;
+	uint32_t lowest = CM_NO_TIMEOUT;
+	uint32_t highest = 0;
+	for (uint32_t seed = 1; seed <= 200; seed++) {
+		RecordingActions device;
+		device.networkFound = false;
+		ConnManager other(device, config);
+		other.seed(seed * 2654435761UL);
+		other.begin(true, 0);
+		ConnEvent event = { CM_EVT_SCAN_DONE, 0 };
+		other.handle(event, 0);
+		TEST_ASSERT_EQUAL(CM_BACKOFF, other.state());
+		TEST_ASSERT_GREATER_OR_EQUAL(CM_BACKOFF_MIN - spread, device.lastTimeout);
+		TEST_ASSERT_LESS_OR_EQUAL(CM_BACKOFF_MIN + spread, device.lastTimeout);
+		lowest = device.lastTimeout < lowest ? device.lastTimeout : lowest;
+		highest = device.lastTimeout > highest ? device.lastTimeout : highest;
+	}
+	// Devices do not retry in lockstep
+	TEST_ASSERT_GREATER_THAN(spread, highest - lowest);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_scan_done_while_connected_keeps_connection);
+	RUN_TEST(test_scan_done_while_connecting_keeps_attempt);
+	RUN_TEST(test_backoff_doubles_up_to_maximum);
+	RUN_TEST(test_success_resets_backoff);
+	RUN_TEST(test_connect_timeout_backs_off);
+	RUN_TEST(test_link_back_within_debounce_is_not_a_reconnect);
+	RUN_TEST(test_debounce_expiry_retries_cached_ap_first);
+	RUN_TEST(test_without_debounce_or_quick_retry_scans_at_once);
+	RUN_TEST(test_jitter_spreads_delay_within_bounds);
+	return UNITY_END();
+}
@@ -0,0 +1,153 @@
+/**
+ * Unit tests of the credential write parser
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/cred_parser.h"
+
+/** Credentials the parser must leave alone unless it returns CRED_SET */
+WiFiCredentials credentials;
+
+void setUp(void) {
+	memset(&credentials, 0, sizeof(credentials));
+	strcpy(credentials.ssidPrim, "stored");
+}
+
+void tearDown(void) {
+}
+
+/** Parse a copy of text, the parser writes into its buffer */
+CredCommand parse(const char *text, size_t length) {
+	static char buffer[512];
+	memcpy(buffer, text, length);
+	return parseCredentials(buffer, length, credentials);
+}
+
+CredCommand parse(const char *text) {
+	return parse(text, strlen(text));
+}
+
+void test_all_fields_set_credentials(void) {
+	TEST_ASSERT_EQUAL(CRED_SET, parse("{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"office\",\"pwSec\":\"secret2\"}"));
+	TEST_ASSERT_EQUAL_STRING("home", credentials.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("secret", credentials.pwPrim);
+	TEST_ASSERT_EQUAL_STRING("office", credentials.ssidSec);
+	TEST_ASSERT_EQUAL_STRING("secret2", credentials.pwSec);
+}
+
+void test_field_order_whitespace_and_unknown_keys(void) {
+	TEST_ASSERT_EQUAL(CRED_SET, parse(" {\n\t\"pwSec\" : \"\", \"version\": 2, \"ssidSec\":\"\",\r\n"
+		"\"pwPrim\":\"p\", \"flag\":true, \"ssidPrim\":\"s\" } "));
+	TEST_ASSERT_EQUAL_STRING("s", credentials.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("", credentials.ssidSec);
+}
+
+void test_missing_field_leaves_credentials(void) {
+	TEST_ASSERT_EQUAL(CRED_NONE, parse("{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"office\"}"));
+	TEST_ASSERT_EQUAL_STRING("stored", credentials.ssidPrim);
+	TEST_ASSERT_EQUAL(CRED_NONE, parse("{}"));
+}
+
+void test_erase_and_reset(void) {
+	TEST_ASSERT_EQUAL(CRED_ERASE, parse("{\"erase\":true}"));
+	TEST_ASSERT_EQUAL(CRED_RESET, parse("{\"reset\":true}"));
+	TEST_ASSERT_EQUAL_STRING("stored", credentials.ssidPrim);
+}
+
+void test_escapes_are_unescaped(void) {
+	TEST_ASSERT_EQUAL(CRED_SET, parse("{\"ssidPrim\":\"a\\\"b\\\\c\\/d\",\"pwPrim\":\"\\t\\n\",\"ssidSec\":\"caf\\u00e9\",\"pwSec\":\"\\ud83d\\ude00\"}"));
+	TEST_ASSERT_EQUAL_STRING("a\"b\\c/d", credentials.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("\t\n", credentials.pwPrim);
+	TEST_ASSERT_EQUAL_STRING("caf\xC3\xA9", credentials.ssidSec);
+	TEST_ASSERT_EQUAL_STRING("\xF0\x9F\x98\x80", credentials.pwSec);
+}
+
+void test_bad_escapes_are_invalid(void) {
+	const char *payloads[] = {
+		"{\"ssidPrim\":\"\\x\"}",
+		"{\"ssidPrim\":\"\\u12\"}",
+		"{\"ssidPrim\":\"\\u12G4\"}",
+		"{\"ssidPrim\":\"\\ud83d\"}",
+		"{\"ssidPrim\":\"\\ude00\"}",
+		"{\"ssidPrim\":\"\\ud83d\\u0041\"}",
+		"{\"ssidPrim\":\"\\u0000\",\"pwPrim\":\"\",\"ssidSec\":\"\",\"pwSec\":\"\"}"
+	};
+	for (size_t index = 0; index < sizeof(payloads) / sizeof(payloads[0]); index++) {
+		TEST_ASSERT_EQUAL_MESSAGE(CRED_INVALID, parse(payloads[index]), payloads[index]);
+	}
+	TEST_ASSERT_EQUAL_STRING("stored", credentials.ssidPrim);
+}
+
+void test_longest_values_fit_and_longer_are_invalid(void) {
+	char json[256];
+	char ssid[CRED_SSID_SIZE + 1];
+	char pw[CRED_PW_SIZE];
+	memset(ssid, 's', CRED_SSID_SIZE - 1);
+	ssid[CRED_SSID_SIZE - 1] = 0;
+	memset(pw, 'p', CRED_PW_SIZE - 1);
+	pw[CRED_PW_SIZE - 1] = 0;
+	snprintf(json, sizeof(json), "{\"ssidPrim\":\"%s\",\"pwPrim\":\"%s\",\"ssidSec\":\"\",\"pwSec\":\"\"}", ssid, pw);
+	TEST_ASSERT_EQUAL(CRED_SET, parse(json));
+	TEST_ASSERT_EQUAL_STRING(ssid, credentials.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING(pw, credentials.pwPrim);
+
+	strcat(ssid, "s");
+	snprintf(json, sizeof(json), "{\"ssidPrim\":\"%s\",\"pwPrim\":\"%s\",\"ssidSec\":\"\",\"pwSec\":\"\"}", ssid, pw);
+	TEST_ASSERT_EQUAL(CRED_INVALID, parse(json));
+	// Untouched by the rejected write
+	TEST_ASSERT_EQUAL(CRED_SSID_SIZE - 1, strlen(credentials.ssidPrim));
+}
+
+void test_malformed_objects_are_invalid(void) {
+	const char *payloads[] = {
+		"",
+		"[]",
+		"{",
+		"{\"erase\"}",
+		"{\"erase\":}",
+		"{\"erase\":true",
+		"{\"erase\":true,}",
+		"{\"erase\":true;\"reset\":true}",
+		"{\"erase\":{\"nested\":true}}",
+		"{\"erase\":[1]}",
+		"{\"erase\":true} x",
+		"{erase:true}",
+		"{\"ssidPrim\":\"line\nbreak\"}"
+	};
+	for (size_t index = 0; index < sizeof(payloads) / sizeof(payloads[0]); index++) {
+		TEST_ASSERT_EQUAL_MESSAGE(CRED_INVALID, parse(payloads[index]), payloads[index]);
+	}
+}
+
+void test_zero_padding_is_accepted(void) {
+	const char payload[] = "{\"reset\":true}\0\0\0";
+	TEST_ASSERT_EQUAL(CRED_RESET, parse(payload, sizeof(payload)));
+}
+
+void test_every_truncation_is_rejected(void) {
+	const char *json = "{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"office\",\"pwSec\":\"secret2\"}";
+	for (size_t length = 0; length < strlen(json); length++) {
+		TEST_ASSERT_EQUAL(CRED_INVALID, parse(json, length));
+	}
+	TEST_ASSERT_EQUAL_STRING("stored", credentials.ssidPrim);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_all_fields_set_credentials);
+	RUN_TEST(test_field_order_whitespace_and_unknown_keys);
+	RUN_TEST(test_missing_field_leaves_credentials);
+	RUN_TEST(test_erase_and_reset);
+	RUN_TEST(test_escapes_are_unescaped);
+	RUN_TEST(test_bad_escapes_are_invalid);
+	RUN_TEST(test_longest_values_fit_and_longer_are_invalid);
+	RUN_TEST(test_malformed_objects_are_invalid);
+	RUN_TEST(test_zero_padding_is_accepted);
+	RUN_TEST(test_every_truncation_is_rejected);
+	return UNITY_END();
+}
@@ -0,0 +1,139 @@
+/**
+ * Unit tests of the packed diagnostics record
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/diag_record.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+DiagRecord makeRecord(uint8_t taskCount) {
+	DiagRecord record;
+	memset(&record, 0, sizeof(record));
+	record.fragmentation = 37;
+	record.freeHeap = 0x0001A2B3;
+	record.minFreeHeap = 0x00019876;
+	record.largestBlock = 0x0000F123;
+	record.bleConnects = 0x0102;
+	record.bleDisconnects = 0x0304;
+	record.bleWrites = 0x0506;
+	record.bleReads = 0x0708;
+	record.wifiScans = 0x090A;
+	record.wifiGotIP = 0x0B0C;
+	record.wifiDisconnects = 0x0D0E;
+	record.logDropped = 0xFFFF;
+	record.taskCount = taskCount;
+	for (uint8_t task = 0; task < taskCount; task++) {
+		record.stackFree[task] = 1000 + 100 * task;
+	}
+	return record;
+}
+
+void assertEqualRecords(const DiagRecord &expected, const DiagRecord &actual) {
+	TEST_ASSERT_EQUAL_UINT8(expected.fragmentation, actual.fragmentation);
+	TEST_ASSERT_EQUAL_UINT32(expected.freeHeap, actual.freeHeap);
+	TEST_ASSERT_EQUAL_UINT32(expected.minFreeHeap, actual.minFreeHeap);
+	TEST_ASSERT_EQUAL_UINT32(expected.largestBlock, actual.largestBlock);
+	TEST_ASSERT_EQUAL_UINT16(expected.bleConnects, actual.bleConnects);
+	TEST_ASSERT_EQUAL_UINT16(expected.bleDisconnects, actual.bleDisconnects);
+	TEST_ASSERT_EQUAL_UINT16(expected.bleWrites, actual.bleWrites);
+	TEST_ASSERT_EQUAL_UINT16(expected.bleReads, actual.bleReads);
+	TEST_ASSERT_EQUAL_UINT16(expected.wifiScans, actual.wifiScans);
+	TEST_ASSERT_EQUAL_UINT16(expected.wifiGotIP, actual.wifiGotIP);
+	TEST_ASSERT_EQUAL_UINT16(expected.wifiDisconnects, actual.wifiDisconnects);
+	TEST_ASSERT_EQUAL_UINT16(expected.logDropped, actual.logDropped);
+	TEST_ASSERT_EQUAL_UINT8(expected.taskCount, actual.taskCount);
+	for (uint8_t task = 0; task < expected.taskCount; task++) {
+		TEST_ASSERT_EQUAL_UINT16(expected.stackFree[task], actual.stackFree[task]);
+	}
+}
+
+void test_encoded_layout(void) {
+	DiagRecord record = makeRecord(2);
+	record.stackFree[1] = DIAG_NO_TASK;
+	uint8_t out[DIAG_RECORD_MAX_SIZE];
+	TEST_ASSERT_EQUAL(DIAG_RECORD_HEADER_SIZE + 4, encodeDiagRecord(record, out, sizeof(out)));
+	const uint8_t expected[DIAG_RECORD_HEADER_SIZE + 4] = {
+		DIAG_RECORD_VERSION, 37, 0xB3, 0xA2, 0x01, 0x00, 0x76, 0x98, 0x01, 0x00, 0x23, 0xF1, 0x00, 0x00,
+		0x02, 0x01, 0x04, 0x03, 0x06, 0x05, 0x08, 0x07, 0x0A, 0x09, 0x0C, 0x0B, 0x0E, 0x0D, 0xFF, 0xFF,
+		2, 0xE8, 0x03, 0xFF, 0xFF
+	};
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, sizeof(expected));
+}
+
+void test_round_trip_of_every_task_count(void) {
+	for (uint8_t taskCount = 0; taskCount <= DIAG_MAX_TASKS; taskCount++) {
+		DiagRecord record = makeRecord(taskCount);
+		uint8_t out[DIAG_RECORD_MAX_SIZE];
+		size_t length = encodeDiagRecord(record, out, sizeof(out));
+		TEST_ASSERT_EQUAL(DIAG_RECORD_HEADER_SIZE + 2 * taskCount, length);
+		DiagRecord decoded;
+		memset(&decoded, 0xFF, sizeof(decoded));
+		TEST_ASSERT_TRUE(decodeDiagRecord(out, length, decoded));
+		assertEqualRecords(record, decoded);
+	}
+}
+
+void test_encode_checks_size_and_task_count(void) {
+	DiagRecord record = makeRecord(3);
+	uint8_t out[DIAG_RECORD_MAX_SIZE];
+	TEST_ASSERT_EQUAL(0, encodeDiagRecord(record, out, DIAG_RECORD_HEADER_SIZE + 5));
+	TEST_ASSERT_EQUAL(DIAG_RECORD_HEADER_SIZE + 6, encodeDiagRecord(record, out, DIAG_RECORD_HEADER_SIZE + 6));
+	record.taskCount = DIAG_MAX_TASKS + 1;
+	TEST_ASSERT_EQUAL(0, encodeDiagRecord(record, out, sizeof(out)));
+}
+
+void test_short_records_are_rejected(void) {
+	DiagRecord record = makeRecord(3);
+	uint8_t out[DIAG_RECORD_MAX_SIZE];
+	size_t length = encodeDiagRecord(record, out, sizeof(out));
+	DiagRecord decoded;
+	// Every truncation, in the header and in the task list
+	for (size_t truncated = 0; truncated < length; truncated++) {
+		TEST_ASSERT_FALSE(decodeDiagRecord(out, truncated, decoded));
+	}
+	TEST_ASSERT_TRUE(decodeDiagRecord(out, length, decoded));
+}
+
+void test_task_count_above_maximum_is_rejected(void) {
+	DiagRecord record = makeRecord(DIAG_MAX_TASKS);
+	uint8_t out[DIAG_RECORD_MAX_SIZE + 2];
+	memset(out, 0, sizeof(out));
+	encodeDiagRecord(record, out, sizeof(out));
+	out[30] = DIAG_MAX_TASKS + 1;
+	DiagRecord decoded;
+	TEST_ASSERT_FALSE(decodeDiagRecord(out, sizeof(out), decoded));
+}
+
+void test_version_zero_is_rejected_and_newer_accepted(void) {
+	DiagRecord record = makeRecord(2);
+	// A newer version appends fields, the known prefix still decodes
+	uint8_t out[DIAG_RECORD_MAX_SIZE + 4];
+	memset(out, 0x5A, sizeof(out));
+	size_t length = encodeDiagRecord(record, out, sizeof(out));
+	out[0] = DIAG_RECORD_VERSION + 1;
+	DiagRecord decoded;
+	TEST_ASSERT_TRUE(decodeDiagRecord(out, length + 4, decoded));
+	assertEqualRecords(record, decoded);
+	out[0] = 0;
+	TEST_ASSERT_FALSE(decodeDiagRecord(out, length + 4, decoded));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_encoded_layout);
+	RUN_TEST(test_round_trip_of_every_task_count);
+	RUN_TEST(test_encode_checks_size_and_task_count);
+	RUN_TEST(test_short_records_are_rejected);
+	RUN_TEST(test_task_count_above_maximum_is_rejected);
+	RUN_TEST(test_version_zero_is_rejected_and_newer_accepted);
+	return UNITY_END();
+}
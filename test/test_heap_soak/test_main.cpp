@@ -0,0 +1,231 @@
+/**
+ * Soak test of the hot paths without heap use
+ *
+ * Counts every operator new and, with glibc, every malloc of the test
+ * binary. After a warm-up the status, SSID list and credential paths run
+ * many thousand times and must not allocate once.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <atomic>
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/native/memory_hal.h"
+#include "../../src/app_log.h"
+#include "../../src/provisioning.h"
+#include "../../src/status_record.h"
+#include "../../src/status_snapshot.h"
+#include "../../src/tlv_codec.h"
+
+/** Rounds of the soak, each one reads every characteristic */
+#define SOAK_ROUNDS 20000
+/** Rounds before counting, fills the buffers that grow once */
+#define WARM_UP_ROUNDS 100
+
+std::atomic<uint32_t> allocations(0);
+
+void *operator new(size_t size) {
+	allocations++;
+	void *memory = malloc(size > 0 ? size : 1);
+	if (memory == NULL) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	allocations++;
+	return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+	return operator new(size, tag);
+}
+
+void operator delete(void *memory) noexcept {
+	free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+	free(memory);
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *memory, size_t size);
+
+/** Allocations of C code, e.g. stdio, are counted as well */
+extern "C" void *malloc(size_t size) {
+	allocations++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+	allocations++;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *memory, size_t size) {
+	allocations++;
+	return __libc_realloc(memory, size);
+}
+#endif
+
+/** Characteristic value in a fixed buffer, like the attribute value of the BLE stack */
+class FixedValue: public GattValue {
+public:
+	FixedValue() : length(0) {
+	}
+
+	void setValue(const uint8_t *data, size_t size) {
+		length = size < sizeof(value) ? size : sizeof(value);
+		memcpy(value, data, length);
+	}
+
+	uint8_t value[600];
+	size_t length;
+};
+
+uint32_t soakClock = 0;
+
+uint32_t readSoakClock() {
+	return soakClock;
+}
+
+void setUp(void) {
+	appLogBegin(readSoakClock, NULL);
+}
+
+void tearDown(void) {
+	appLogBegin(NULL, NULL);
+}
+
+/** Fill a scan with count protected APs */
+void fillScan(ScanSnapshot &scan, uint8_t count, uint32_t variant) {
+	scan.count = count;
+	for (uint8_t index = 0; index < count; index++) {
+		ScanRecord &record = scan.aps[index];
+		memset(&record, 0, sizeof(record));
+		snprintf(record.ssid, sizeof(record.ssid), "network-%u-%u", index, variant % 7);
+		record.rssi = -40 - index;
+		record.channel = 1 + index % 13;
+		record.authMode = index == 0 ? SCAN_AUTH_OPEN : SCAN_AUTH_OPEN + 3;
+	}
+}
+
+void test_hot_paths_do_not_allocate(void) {
+	NetworkTable networks;
+	BleCodec codec;
+	codecInit(codec, "ESP32-8C0A2F3B");
+	MemoryStore store;
+	StdLock lock;
+	CountingHooks hooks;
+	Provisioning provisioning(networks, codec, store, lock, hooks);
+	ScanCache scanCache;
+	Snapshot<StatusRecord> status;
+
+	ClientTable clients;
+	const uint8_t addressJson[6] = { 1, 2, 3, 4, 5, 6 };
+	const uint8_t addressTlv[6] = { 6, 5, 4, 3, 2, 1 };
+	BleClient *json = clients.add(0, addressJson);
+	BleClient *tlv = clients.add(1, addressTlv);
+
+	// The same credentials in both protocols, stored once and written again every round
+	const char credentialsJson[] = "{\"ssidPrim\":\"network-1-0\",\"pwPrim\":\"secret\",\"ssidSec\":\"network-2-0\",\"pwSec\":\"other\"}";
+	WiFiCredentials credentials;
+	memset(&credentials, 0, sizeof(credentials));
+	strcpy(credentials.ssidPrim, "network-1-0");
+	strcpy(credentials.pwPrim, "secret");
+	strcpy(credentials.ssidSec, "network-2-0");
+	strcpy(credentials.pwSec, "other");
+	uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+	size_t frameLength = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS, credentials);
+	codecApply(codec, frame, frameLength);
+	uint8_t payload[TLV_MAX_CREDENTIALS_FRAME + sizeof(credentialsJson)];
+	memcpy(payload, frame, frameLength);
+	provisioning.write(tlv, payload, frameLength);
+
+	ScanSnapshot scan;
+	FixedValue listValue;
+	FixedValue credentialsValue;
+	uint8_t statusValue[STATUS_RECORD_SIZE];
+	char logLine[LOG_OUTPUT_SIZE];
+	uint32_t before = 0;
+	for (uint32_t round = 0; round < WARM_UP_ROUNDS + SOAK_ROUNDS; round++) {
+		if (round == WARM_UP_ROUNDS) {
+			before = allocations.load();
+		}
+		soakClock += 10;
+
+		// A new scan every 50 rounds
+		if (round % 50 == 0) {
+			fillScan(scanCache.back(), 1 + round % LIST_MAX_SSIDS, round);
+			scanCache.publish(soakClock);
+		}
+		scanCache.read(scan);
+		provisioning.serveList(scan, soakClock, listValue);
+		provisioning.readList(scan, listValue);
+		{
+			LockGuard guard(lock);
+			networks.select(scan.aps, scan.count);
+		}
+
+		StatusRecord record = status.read();
+		record.state = CONN_STATE_CONNECTED;
+		record.profile = 1 + round % 2;
+		record.rssi = -40 - round % 30;
+		record.uptime = soakClock;
+		status.write(record);
+		TEST_ASSERT_EQUAL(STATUS_RECORD_SIZE, encodeStatusRecord(status.read(), statusValue, sizeof(statusValue)));
+		legacyStatusValue(record);
+
+		BleClient *client = round & 1 ? tlv : json;
+		if (client->usesTlv) {
+			memcpy(payload, frame, frameLength);
+			provisioning.write(client, payload, frameLength);
+		} else {
+			memcpy(payload, credentialsJson, sizeof(credentialsJson) - 1);
+			codecApply(codec, payload, sizeof(credentialsJson) - 1);
+			provisioning.write(client, payload, sizeof(credentialsJson) - 1);
+		}
+		provisioning.readCredentials(client, credentialsValue);
+
+		LOG_INFO("Soak round %u, %u networks in scan", round, scan.count);
+		while (appLogNext(logLine, sizeof(logLine)) > 0) {
+		}
+	}
+	uint32_t allocated = allocations.load() - before;
+
+	TEST_ASSERT_TRUE(tlv->usesTlv);
+	TEST_ASSERT_FALSE(json->usesTlv);
+	TEST_ASSERT_EQUAL_UINT32(1, store.writes);
+	TEST_ASSERT_GREATER_THAN(0, provisioning.listSerializations());
+	TEST_ASSERT_EQUAL_UINT32(0, allocated);
+}
+
+/** The counter sees allocations, so a zero above is not a hook that never ran */
+void test_allocations_are_counted(void) {
+	uint32_t before = allocations.load();
+	{
+		std::vector<uint8_t> grown(16);
+		grown.resize(1024);
+	}
+	TEST_ASSERT_TRUE(allocations.load() - before >= 2);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_allocations_are_counted);
+	RUN_TEST(test_hot_paths_do_not_allocate);
+	return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/**
+ * Unit tests of the fixed-buffer JSON writer
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/cred_parser.h"
+#include "../../src/json_writer.h"
+
+char buffer[256];
+
+void setUp(void) {
+	memset(buffer, 0x55, sizeof(buffer));
+}
+
+void tearDown(void) {
+}
+
+void test_objects_arrays_and_commas(void) {
+	JsonWriter json(buffer, sizeof(buffer));
+	json.beginObject();
+	json.key("SSID");
+	json.beginArray();
+	json.value("home");
+	json.value("office");
+	json.endArray();
+	json.key("empty");
+	json.beginArray();
+	json.endArray();
+	json.key("nested");
+	json.beginObject();
+	json.key("a");
+	json.value("");
+	json.endObject();
+	json.endObject();
+	TEST_ASSERT_FALSE(json.overflow());
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[\"home\",\"office\"],\"empty\":[],\"nested\":{\"a\":\"\"}}", buffer);
+	TEST_ASSERT_EQUAL(strlen(buffer), json.length());
+}
+
+void test_escaping(void) {
+	JsonWriter json(buffer, sizeof(buffer));
+	json.value("q\"b\\s/\n\x01\x1f\xc3\xa9");
+	TEST_ASSERT_EQUAL_STRING("\"q\\\"b\\\\s/\\u000a\\u0001\\u001f\xc3\xa9\"", buffer);
+}
+
+void test_quoted_size_matches_output(void) {
+	const char *texts[] = { "", "home", "q\"b\\s", "\t\r\n", "\xc3\xa9t\xc3\xa9" };
+	for (size_t index = 0; index < sizeof(texts) / sizeof(texts[0]); index++) {
+		JsonWriter json(buffer, sizeof(buffer));
+		json.value(texts[index]);
+		TEST_ASSERT_EQUAL(JsonWriter::quotedSize(texts[index]), json.length());
+	}
+}
+
+void test_overflow_at_exact_boundary(void) {
+	// "home" takes 6 bytes, plus the zero terminator
+	JsonWriter fits(buffer, 7);
+	fits.value("home");
+	TEST_ASSERT_FALSE(fits.overflow());
+	TEST_ASSERT_EQUAL(0, fits.remaining());
+	TEST_ASSERT_EQUAL_STRING("\"home\"", buffer);
+
+	memset(buffer, 0x55, sizeof(buffer));
+	JsonWriter tooSmall(buffer, 6);
+	tooSmall.value("home");
+	TEST_ASSERT_TRUE(tooSmall.overflow());
+	// Never written past the buffer, always terminated
+	TEST_ASSERT_EQUAL(5, strlen(buffer));
+	TEST_ASSERT_EQUAL_HEX8(0x55, buffer[6]);
+	// Stays overflowed, even if a shorter value would fit
+	tooSmall.endObject();
+	TEST_ASSERT_TRUE(tooSmall.overflow());
+	TEST_ASSERT_EQUAL(5, tooSmall.length());
+}
+
+void test_zero_size_buffer(void) {
+	JsonWriter json(buffer, 0);
+	TEST_ASSERT_TRUE(json.overflow());
+	json.beginObject();
+	TEST_ASSERT_EQUAL(0, json.length());
+	TEST_ASSERT_EQUAL_HEX8(0x55, buffer[0]);
+}
+
+void test_credentials_round_trip_through_parser(void) {
+	WiFiCredentials sent;
+	memset(&sent, 0, sizeof(sent));
+	strcpy(sent.ssidPrim, "caf\xc3\xa9 \"guest\"");
+	strcpy(sent.pwPrim, "back\\slash\ttab");
+	strcpy(sent.ssidSec, "");
+	strcpy(sent.pwSec, "\x01\x02");
+
+	JsonWriter json(buffer, sizeof(buffer));
+	json.beginObject();
+	json.key("ssidPrim");
+	json.value(sent.ssidPrim);
+	json.key("pwPrim");
+	json.value(sent.pwPrim);
+	json.key("ssidSec");
+	json.value(sent.ssidSec);
+	json.key("pwSec");
+	json.value(sent.pwSec);
+	json.endObject();
+	TEST_ASSERT_FALSE(json.overflow());
+
+	WiFiCredentials received;
+	TEST_ASSERT_EQUAL(CRED_SET, parseCredentials(buffer, json.length(), received));
+	TEST_ASSERT_EQUAL_STRING(sent.ssidPrim, received.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING(sent.pwPrim, received.pwPrim);
+	TEST_ASSERT_EQUAL_STRING(sent.ssidSec, received.ssidSec);
+	TEST_ASSERT_EQUAL_STRING(sent.pwSec, received.pwSec);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_objects_arrays_and_commas);
+	RUN_TEST(test_escaping);
+	RUN_TEST(test_quoted_size_matches_output);
+	RUN_TEST(test_overflow_at_exact_boundary);
+	RUN_TEST(test_zero_size_buffer);
+	RUN_TEST(test_credentials_round_trip_through_parser);
+	return UNITY_END();
+}
@@ -0,0 +1,264 @@
+/**
+ * Unit tests of the table of candidate WiFi networks
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/network_table.h"
+
+NetworkTable *networks;
+
+void setUp(void) {
+	networks = new NetworkTable();
+}
+
+void tearDown(void) {
+	delete networks;
+}
+
+ScanRecord makeAp(const char *ssid, int8_t rssi) {
+	ScanRecord ap;
+	memset(&ap, 0, sizeof(ap));
+	strncpy(ap.ssid, ssid, sizeof(ap.ssid) - 1);
+	ap.rssi = rssi;
+	ap.channel = 6;
+	ap.authMode = 3;
+	return ap;
+}
+
+void test_add_fills_slots_after_legacy_ones_first(void) {
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_SECONDARY + 1, networks->add("warehouse", "forklift", 0));
+	char ssid[CRED_SSID_SIZE];
+	for (uint8_t index = NETWORK_SECONDARY + 2; index < MAX_NETWORKS; index++) {
+		snprintf(ssid, sizeof(ssid), "network-%u", index);
+		TEST_ASSERT_EQUAL_UINT8(index, networks->add(ssid, "password", 0));
+	}
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_PRIMARY, networks->add("spill-1", "password", 0));
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_SECONDARY, networks->add("spill-2", "password", 0));
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->add("one-too-many", "password", 0));
+	TEST_ASSERT_EQUAL_UINT8(MAX_NETWORKS, networks->count());
+}
+
+void test_add_updates_known_network(void) {
+	uint8_t index = networks->add("warehouse", "forklift", 1);
+	TEST_ASSERT_EQUAL_UINT8(index, networks->add("warehouse", "pallet", 4));
+	TEST_ASSERT_EQUAL_UINT8(1, networks->count());
+	TEST_ASSERT_EQUAL_STRING("pallet", networks->get(index)->pw);
+	TEST_ASSERT_EQUAL_UINT8(4, networks->get(index)->priority);
+}
+
+void test_add_rejects_empty_and_overlong_values(void) {
+	char ssid[CRED_SSID_SIZE + 1];
+	memset(ssid, 's', CRED_SSID_SIZE);
+	ssid[CRED_SSID_SIZE] = 0;
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->add("", "password", 0));
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->add(ssid, "password", 0));
+	TEST_ASSERT_EQUAL_UINT8(0, networks->count());
+}
+
+void test_remove_and_find(void) {
+	networks->add("warehouse", "forklift", 0);
+	uint8_t office = networks->add("office", "desk", 0);
+	TEST_ASSERT_EQUAL_UINT8(office, networks->find("office"));
+	TEST_ASSERT_TRUE(networks->remove("warehouse"));
+	TEST_ASSERT_FALSE(networks->remove("warehouse"));
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->find("warehouse"));
+	TEST_ASSERT_EQUAL_UINT8(office, networks->find("office"));
+	TEST_ASSERT_EQUAL_UINT8(1, networks->count());
+	TEST_ASSERT_NULL(networks->get(MAX_NETWORKS));
+}
+
+void test_legacy_credentials_use_first_slots(void) {
+	WiFiCredentials credentials;
+	memset(&credentials, 0, sizeof(credentials));
+	strcpy(credentials.ssidPrim, "home");
+	strcpy(credentials.pwPrim, "secret");
+	networks->add("warehouse", "forklift", 0);
+	networks->setCredentials(credentials);
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_PRIMARY, networks->find("home"));
+	TEST_ASSERT_NULL(networks->get(NETWORK_SECONDARY));
+	TEST_ASSERT_EQUAL_UINT8(2, networks->count());
+
+	WiFiCredentials read;
+	networks->getCredentials(read);
+	TEST_ASSERT_EQUAL_STRING("home", read.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("secret", read.pwPrim);
+	TEST_ASSERT_EQUAL_STRING("", read.ssidSec);
+}
+
+void test_select_prefers_strongest_known_ap(void) {
+	networks->add("warehouse", "forklift", 0);
+	networks->add("office", "desk", 0);
+	ScanRecord aps[] = { makeAp("neighbour", -30), makeAp("warehouse", -70), makeAp("office", -55), makeAp("warehouse", -60) };
+	uint8_t bestAp = 0xFF;
+	TEST_ASSERT_EQUAL_UINT8(networks->find("office"), networks->select(aps, 4, &bestAp));
+	TEST_ASSERT_EQUAL_UINT8(2, bestAp);
+	aps[3].rssi = -50;
+	TEST_ASSERT_EQUAL_UINT8(networks->find("warehouse"), networks->select(aps, 4, &bestAp));
+	TEST_ASSERT_EQUAL_UINT8(3, bestAp);
+}
+
+void test_select_weighs_priority(void) {
+	networks->add("warehouse", "forklift", 2);
+	networks->add("office", "desk", 0);
+	// 2 priority levels outweigh up to 2 * NETWORK_PRIORITY_WEIGHT dB
+	ScanRecord aps[] = { makeAp("warehouse", -70), makeAp("office", -70 + 2 * NETWORK_PRIORITY_WEIGHT - 1) };
+	TEST_ASSERT_EQUAL_UINT8(networks->find("warehouse"), networks->select(aps, 2));
+	aps[1].rssi += 2;
+	TEST_ASSERT_EQUAL_UINT8(networks->find("office"), networks->select(aps, 2));
+}
+
+void test_select_prefers_last_success_on_close_signals(void) {
+	uint8_t warehouse = networks->add("warehouse", "forklift", 0);
+	uint8_t office = networks->add("office", "desk", 0);
+	ScanRecord aps[] = { makeAp("warehouse", -60), makeAp("office", -60 + NETWORK_LAST_SUCCESS_BONUS - 1) };
+	TEST_ASSERT_EQUAL_UINT8(office, networks->select(aps, 2));
+	networks->markSuccess(warehouse);
+	TEST_ASSERT_EQUAL_UINT8(warehouse, networks->select(aps, 2));
+	networks->markSuccess(office);
+	TEST_ASSERT_EQUAL_UINT8(office, networks->select(aps, 2));
+}
+
+void test_select_skips_weak_and_unknown_aps(void) {
+	networks->add("warehouse", "forklift", 0);
+	ScanRecord aps[] = { makeAp("warehouse", NETWORK_MIN_RSSI - 1), makeAp("neighbour", -40) };
+	uint8_t bestAp = 0xFF;
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->select(aps, 2, &bestAp));
+	TEST_ASSERT_EQUAL_UINT8(0xFF, bestAp);
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->select(aps, 0));
+}
+
+void test_select_marks_found_networks_seen(void) {
+	uint8_t warehouse = networks->add("warehouse", "forklift", 0);
+	uint8_t office = networks->add("office", "desk", 0);
+	ScanRecord aps[] = { makeAp("warehouse", -60), makeAp("neighbour", -40) };
+	networks->select(aps, 2);
+	uint32_t seen = networks->get(warehouse)->lastSeen;
+	TEST_ASSERT_GREATER_THAN(0, seen);
+	TEST_ASSERT_EQUAL_UINT32(0, networks->get(office)->lastSeen);
+
+	// Too weak to select is still seen, later scans are later
+	ScanRecord weak[] = { makeAp("office", NETWORK_MIN_RSSI - 1) };
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_NONE, networks->select(weak, 1));
+	TEST_ASSERT_GREATER_THAN(seen, networks->get(office)->lastSeen);
+	TEST_ASSERT_EQUAL_UINT32(seen, networks->get(warehouse)->lastSeen);
+}
+
+void test_scans_do_not_change_stored_form(void) {
+	uint8_t warehouse = networks->add("warehouse", "forklift", 0);
+	networks->add("office", "desk", 0);
+	TEST_ASSERT_TRUE(networks->markSuccess(warehouse));
+	uint8_t before[NETWORK_TABLE_MAX_SIZE];
+	size_t beforeLength = networks->serialize(before, sizeof(before));
+
+	ScanRecord aps[] = { makeAp("warehouse", -60), makeAp("office", -70) };
+	for (int scan = 0; scan < 100; scan++) {
+		networks->select(aps, 2);
+	}
+	uint8_t after[NETWORK_TABLE_MAX_SIZE];
+	TEST_ASSERT_EQUAL(beforeLength, networks->serialize(after, sizeof(after)));
+	TEST_ASSERT_EQUAL_MEMORY(before, after, beforeLength);
+
+	// lastSeen is not stored, success times stay ordered after the scans
+	NetworkTable loaded;
+	TEST_ASSERT_TRUE(loaded.deserialize(after, beforeLength));
+	TEST_ASSERT_EQUAL_UINT32(0, loaded.get(warehouse)->lastSeen);
+	TEST_ASSERT_TRUE(networks->markSuccess(networks->find("office")));
+	TEST_ASSERT_GREATER_THAN(networks->get(warehouse)->lastSuccess, networks->get(networks->find("office"))->lastSuccess);
+}
+
+void test_all_found(void) {
+	ScanRecord aps[] = { makeAp("warehouse", -60), makeAp("neighbour", -40) };
+	TEST_ASSERT_FALSE(networks->allFound(aps, 2));
+	networks->add("warehouse", "forklift", 0);
+	TEST_ASSERT_TRUE(networks->allFound(aps, 2));
+	networks->add("office", "desk", 0);
+	TEST_ASSERT_FALSE(networks->allFound(aps, 2));
+}
+
+void test_serialize_round_trip(void) {
+	networks->add("warehouse", "forklift", 2);
+	networks->add("office", "", 0);
+	networks->set(NETWORK_PRIMARY, "home", "secret", 1);
+	uint8_t stored[NETWORK_TABLE_MAX_SIZE];
+	size_t length = networks->serialize(stored, sizeof(stored));
+	TEST_ASSERT_GREATER_THAN(0, length);
+
+	NetworkTable loaded;
+	TEST_ASSERT_TRUE(loaded.deserialize(stored, length));
+	TEST_ASSERT_EQUAL_UINT8(3, loaded.count());
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		const NetworkEntry *expected = networks->get(index);
+		const NetworkEntry *actual = loaded.get(index);
+		if (expected == NULL) {
+			TEST_ASSERT_NULL(actual);
+			continue;
+		}
+		TEST_ASSERT_NOT_NULL(actual);
+		TEST_ASSERT_EQUAL_STRING(expected->ssid, actual->ssid);
+		TEST_ASSERT_EQUAL_STRING(expected->pw, actual->pw);
+		TEST_ASSERT_EQUAL_UINT8(expected->priority, actual->priority);
+	}
+	// Lookups work on the loaded table
+	TEST_ASSERT_EQUAL_UINT8(networks->find("office"), loaded.find("office"));
+}
+
+void test_full_table_fits_max_size(void) {
+	char ssid[CRED_SSID_SIZE];
+	char pw[CRED_PW_SIZE];
+	memset(pw, 'p', sizeof(pw) - 1);
+	pw[sizeof(pw) - 1] = 0;
+	for (uint8_t index = 0; index < MAX_NETWORKS; index++) {
+		memset(ssid, 'a' + index, sizeof(ssid) - 1);
+		ssid[sizeof(ssid) - 1] = 0;
+		networks->set(index, ssid, pw, 1);
+		networks->markSuccess(index);
+	}
+	uint8_t stored[NETWORK_TABLE_MAX_SIZE];
+	TEST_ASSERT_EQUAL(NETWORK_TABLE_MAX_SIZE, networks->serialize(stored, sizeof(stored)));
+	TEST_ASSERT_EQUAL(0, networks->serialize(stored, sizeof(stored) - 1));
+}
+
+void test_malformed_data_leaves_empty_table(void) {
+	networks->add("warehouse", "forklift", 2);
+	uint8_t stored[NETWORK_TABLE_MAX_SIZE];
+	size_t length = networks->serialize(stored, sizeof(stored));
+
+	NetworkTable loaded;
+	for (size_t cut = 0; cut < length; cut++) {
+		loaded.add("stale", "password", 0);
+		// A cut right after the header is an empty table, every other one is malformed
+		TEST_ASSERT_EQUAL(cut == 5, loaded.deserialize(stored, cut));
+		TEST_ASSERT_EQUAL_UINT8(0, loaded.count());
+	}
+	stored[0] = NETWORK_TABLE_VERSION + 1;
+	TEST_ASSERT_FALSE(loaded.deserialize(stored, length));
+	stored[0] = NETWORK_TABLE_VERSION;
+	stored[5] = MAX_NETWORKS;
+	TEST_ASSERT_FALSE(loaded.deserialize(stored, length));
+	TEST_ASSERT_EQUAL_UINT8(0, loaded.count());
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_add_fills_slots_after_legacy_ones_first);
+	RUN_TEST(test_add_updates_known_network);
+	RUN_TEST(test_add_rejects_empty_and_overlong_values);
+	RUN_TEST(test_remove_and_find);
+	RUN_TEST(test_legacy_credentials_use_first_slots);
+	RUN_TEST(test_select_prefers_strongest_known_ap);
+	RUN_TEST(test_select_weighs_priority);
+	RUN_TEST(test_select_prefers_last_success_on_close_signals);
+	RUN_TEST(test_select_skips_weak_and_unknown_aps);
+	RUN_TEST(test_select_marks_found_networks_seen);
+	RUN_TEST(test_scans_do_not_change_stored_form);
+	RUN_TEST(test_all_found);
+	RUN_TEST(test_serialize_round_trip);
+	RUN_TEST(test_full_table_fits_max_size);
+	RUN_TEST(test_malformed_data_leaves_empty_table);
+	return UNITY_END();
+}
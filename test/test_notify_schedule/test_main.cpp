@@ -0,0 +1,113 @@
+/**
+ * Unit tests of the status notification schedule
+ *
+ * The simulation runs the task loop of the sketch on a virtual clock: it
+ * sleeps for nextTimeout() unless a status change comes first.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <unity.h>
+
+#include "../../src/notify_schedule.h"
+
+#define HEARTBEAT 10000
+/** Interval of the polling loop the task used before */
+#define POLL_INTERVAL 1000
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_change_and_subscription_send_at_once(void) {
+	NotifySchedule schedule(HEARTBEAT);
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED, 100));
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED, 101));
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_SUBSCRIBED, 102));
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED | STATUS_SUBSCRIBED, 103));
+	TEST_ASSERT_EQUAL_UINT32(HEARTBEAT, schedule.nextTimeout(103));
+}
+
+void test_heartbeat_is_measured_from_last_send(void) {
+	NotifySchedule schedule(HEARTBEAT);
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED, 1000));
+	TEST_ASSERT_EQUAL_UINT32(HEARTBEAT - 500, schedule.nextTimeout(1500));
+	// A spurious wake up before the heartbeat sends nothing
+	TEST_ASSERT_FALSE(schedule.wake(0, 1500));
+	TEST_ASSERT_FALSE(schedule.wake(0, 1000 + HEARTBEAT - 1));
+	TEST_ASSERT_EQUAL_UINT32(1, schedule.nextTimeout(1000 + HEARTBEAT - 1));
+	TEST_ASSERT_TRUE(schedule.wake(0, 1000 + HEARTBEAT));
+	TEST_ASSERT_EQUAL_UINT32(HEARTBEAT, schedule.nextTimeout(1000 + HEARTBEAT));
+	// Overslept, due at once
+	TEST_ASSERT_EQUAL_UINT32(0, schedule.nextTimeout(1000 + 3 * HEARTBEAT));
+}
+
+void test_heartbeat_across_clock_wrap(void) {
+	NotifySchedule schedule(HEARTBEAT);
+	uint32_t now = 0xFFFFFFFFUL - HEARTBEAT / 2;
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED, now));
+	now += HEARTBEAT - 1;
+	TEST_ASSERT_FALSE(schedule.wake(0, now));
+	TEST_ASSERT_EQUAL_UINT32(1, schedule.nextTimeout(now));
+	now++;
+	TEST_ASSERT_TRUE(schedule.wake(0, now));
+}
+
+void test_without_heartbeat_only_changes_send(void) {
+	NotifySchedule schedule(0);
+	TEST_ASSERT_EQUAL_UINT32(NOTIFY_NO_TIMEOUT, schedule.nextTimeout(0));
+	TEST_ASSERT_FALSE(schedule.wake(0, 1000000));
+	TEST_ASSERT_TRUE(schedule.wake(STATUS_CHANGED, 1000001));
+	TEST_ASSERT_EQUAL_UINT32(NOTIFY_NO_TIMEOUT, schedule.nextTimeout(1000001));
+}
+
+void test_sends_only_on_change_or_heartbeat(void) {
+	// Changes at irregular times over an hour, some closer than a heartbeat
+	const uint32_t changes[] = { 1234, 1300, 15000, 15010, 47000, 600000, 601000, 3000000 };
+	const uint32_t changeCount = sizeof(changes) / sizeof(changes[0]);
+	const uint32_t end = 3600000;
+
+	NotifySchedule schedule(HEARTBEAT);
+	uint32_t now = 0;
+	uint32_t next = 0;
+	uint32_t sends = 0;
+	uint32_t heartbeats = 0;
+	uint32_t lastSend = 0;
+	while (now < end) {
+		uint32_t timeout = schedule.nextTimeout(now);
+		uint32_t reasons = 0;
+		if (next < changeCount && changes[next] <= now + timeout) {
+			now = changes[next++];
+			reasons = STATUS_CHANGED;
+		} else {
+			now += timeout;
+		}
+		if (schedule.wake(reasons, now)) {
+			if (reasons == 0) {
+				// A heartbeat is never closer than its interval to the last send
+				TEST_ASSERT_GREATER_OR_EQUAL(HEARTBEAT, now - lastSend);
+				heartbeats++;
+			}
+			sends++;
+			lastSend = now;
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(changeCount, next);
+	TEST_ASSERT_EQUAL_UINT32(changeCount + heartbeats, sends);
+	// Changes restart the heartbeat, so there are fewer than one per interval
+	TEST_ASSERT_LESS_THAN(end / HEARTBEAT + 1, heartbeats);
+	// Polling sent the status every POLL_INTERVAL whether it changed or not
+	TEST_ASSERT_LESS_THAN(end / POLL_INTERVAL / 9, sends);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_change_and_subscription_send_at_once);
+	RUN_TEST(test_heartbeat_is_measured_from_last_send);
+	RUN_TEST(test_heartbeat_across_clock_wrap);
+	RUN_TEST(test_without_heartbeat_only_changes_send);
+	RUN_TEST(test_sends_only_on_change_or_heartbeat);
+	return UNITY_END();
+}
@@ -0,0 +1,106 @@
+/**
+ * Unit tests of the CRC protected NVS records
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/nvs_record.h"
+
+#define TEST_VERSION 3
+
+uint8_t record[NVS_RECORD_HEADER_SIZE + 64];
+
+void setUp(void) {
+	memset(record, 0, sizeof(record));
+}
+
+void tearDown(void) {
+}
+
+/** Seal a payload of length bytes, returns the record length */
+size_t sealPayload(size_t length) {
+	for (size_t index = 0; index < length; index++) {
+		record[NVS_RECORD_HEADER_SIZE + index] = (uint8_t)(index * 7 + 1);
+	}
+	return nvsRecordSeal(record, TEST_VERSION, length);
+}
+
+void test_crc32_check_value(void) {
+	const char *check = "123456789";
+	TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32((const uint8_t *)check, 9));
+	TEST_ASSERT_EQUAL_HEX32(0, crc32(NULL, 0));
+	// Continued over two buffers
+	uint32_t crc = crc32((const uint8_t *)check, 4);
+	TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32((const uint8_t *)check + 4, 5, crc));
+}
+
+void test_seal_and_open(void) {
+	size_t length = sealPayload(40);
+	TEST_ASSERT_EQUAL(NVS_RECORD_HEADER_SIZE + 40, length);
+	TEST_ASSERT_EQUAL_HEX8(NVS_RECORD_MAGIC, record[0]);
+	size_t payloadLength = 0;
+	const uint8_t *payload = nvsRecordOpen(record, length, TEST_VERSION, payloadLength);
+	TEST_ASSERT_EQUAL_PTR(record + NVS_RECORD_HEADER_SIZE, payload);
+	TEST_ASSERT_EQUAL(40, payloadLength);
+	TEST_ASSERT_EQUAL_HEX32(crc32(payload, 40), nvsRecordCrc(record));
+}
+
+void test_empty_payload(void) {
+	size_t length = sealPayload(0);
+	size_t payloadLength = 1;
+	TEST_ASSERT_NOT_NULL(nvsRecordOpen(record, length, TEST_VERSION, payloadLength));
+	TEST_ASSERT_EQUAL(0, payloadLength);
+}
+
+void test_every_bit_flip_is_detected(void) {
+	size_t length = sealPayload(24);
+	size_t payloadLength;
+	for (size_t byte = 0; byte < length; byte++) {
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			record[byte] ^= 1 << bit;
+			TEST_ASSERT_NULL(nvsRecordOpen(record, length, TEST_VERSION, payloadLength));
+			record[byte] ^= 1 << bit;
+		}
+	}
+	TEST_ASSERT_NOT_NULL(nvsRecordOpen(record, length, TEST_VERSION, payloadLength));
+}
+
+void test_truncated_or_padded_record_is_rejected(void) {
+	size_t length = sealPayload(24);
+	size_t payloadLength;
+	for (size_t cut = 0; cut < length; cut++) {
+		TEST_ASSERT_NULL(nvsRecordOpen(record, cut, TEST_VERSION, payloadLength));
+	}
+	TEST_ASSERT_NULL(nvsRecordOpen(record, length + 1, TEST_VERSION, payloadLength));
+}
+
+void test_other_version_is_rejected(void) {
+	size_t length = sealPayload(24);
+	size_t payloadLength;
+	TEST_ASSERT_NULL(nvsRecordOpen(record, length, TEST_VERSION + 1, payloadLength));
+}
+
+void test_crc_tells_changed_payloads_apart(void) {
+	sealPayload(24);
+	uint32_t before = nvsRecordCrc(record);
+	sealPayload(24);
+	TEST_ASSERT_EQUAL_HEX32(before, nvsRecordCrc(record));
+	record[NVS_RECORD_HEADER_SIZE + 3] ^= 0x10;
+	nvsRecordSeal(record, TEST_VERSION, 24);
+	TEST_ASSERT_FALSE(before == nvsRecordCrc(record));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_crc32_check_value);
+	RUN_TEST(test_seal_and_open);
+	RUN_TEST(test_empty_payload);
+	RUN_TEST(test_every_bit_flip_is_detected);
+	RUN_TEST(test_truncated_or_padded_record_is_rejected);
+	RUN_TEST(test_other_version_is_rejected);
+	RUN_TEST(test_crc_tells_changed_payloads_apart);
+	return UNITY_END();
+}
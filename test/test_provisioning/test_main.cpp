@@ -0,0 +1,333 @@
+/**
+ * Unit tests of credential provisioning, over the in-memory backends
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unity.h>
+
+#include "../../src/native/memory_hal.h"
+#include "../../src/provisioning.h"
+#include "../../src/tlv_codec.h"
+
+NetworkTable *networks;
+BleCodec codec;
+MemoryStore *store;
+StdLock *lock;
+CountingHooks *hooks;
+Provisioning *provisioning;
+
+void setUp(void) {
+	networks = new NetworkTable();
+	codecInit(codec, "ESP32-8C0A2F3B");
+	store = new MemoryStore();
+	lock = new StdLock();
+	hooks = new CountingHooks();
+	provisioning = new Provisioning(*networks, codec, *store, *lock, *hooks);
+}
+
+void tearDown(void) {
+	delete provisioning;
+	delete hooks;
+	delete lock;
+	delete store;
+	delete networks;
+}
+
+/** Add an AP to a scan */
+void addAp(ScanSnapshot &scan, const char *ssid, uint8_t authMode) {
+	ScanRecord &record = scan.aps[scan.count++];
+	memset(&record, 0, sizeof(record));
+	strncpy(record.ssid, ssid, sizeof(record.ssid) - 1);
+	record.rssi = -50;
+	record.channel = 6;
+	record.authMode = authMode;
+}
+
+ScanSnapshot emptyScan() {
+	ScanSnapshot scan;
+	memset(&scan, 0, sizeof(scan));
+	scan.generation = 1;
+	return scan;
+}
+
+std::string listOf(const ScanSnapshot &scan) {
+	MemoryValue value;
+	provisioning->readList(scan, value);
+	return std::string(value.value.begin(), value.value.end());
+}
+
+void test_list_skips_open_networks(void) {
+	ScanSnapshot scan = emptyScan();
+	addAp(scan, "home", 3);
+	addAp(scan, "cafe", SCAN_AUTH_OPEN);
+	addAp(scan, "office", 4);
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[\"home\",\"office\"]}", listOf(scan).c_str());
+}
+
+void test_empty_scan_gives_empty_list(void) {
+	ScanSnapshot scan = emptyScan();
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[]}", listOf(scan).c_str());
+}
+
+void test_list_escapes_ssids(void) {
+	ScanSnapshot scan = emptyScan();
+	addAp(scan, "a\"b\\c", 3);
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[\"a\\\"b\\\\c\"]}", listOf(scan).c_str());
+}
+
+void test_list_is_capped(void) {
+	ScanSnapshot scan = emptyScan();
+	char ssid[CRED_SSID_SIZE];
+	for (uint8_t ap = 0; ap < SCAN_CACHE_MAX_AP; ap++) {
+		snprintf(ssid, sizeof(ssid), "ap-%02u", ap);
+		addAp(scan, ssid, 3);
+	}
+	std::string list = listOf(scan);
+	TEST_ASSERT_TRUE(list.find("\"ap-09\"]}") != std::string::npos);
+	TEST_ASSERT_TRUE(list.find("ap-10") == std::string::npos);
+}
+
+void test_longest_ssids_fit(void) {
+	ScanSnapshot scan = emptyScan();
+	char ssid[CRED_SSID_SIZE];
+	for (uint8_t ap = 0; ap < SCAN_CACHE_MAX_AP; ap++) {
+		// Every character but the first escaped, close to the worst case of LIST_JSON_SIZE
+		memset(ssid, '"', sizeof(ssid) - 1);
+		ssid[sizeof(ssid) - 1] = 0;
+		ssid[0] = 'a' + ap;
+		addAp(scan, ssid, 3);
+	}
+	std::string list = listOf(scan);
+	// {"SSID":[ and ]}, 10 SSIDs of 1 + 2 * 31 characters in quotes, 9 commas
+	TEST_ASSERT_EQUAL(9 + LIST_MAX_SSIDS * (2 + 1 + 2 * (CRED_SSID_SIZE - 2)) + LIST_MAX_SSIDS - 1 + 2, list.size());
+	TEST_ASSERT_LESS_THAN(LIST_JSON_SIZE, list.size());
+	TEST_ASSERT_EQUAL_STRING("\"]}", list.c_str() + list.size() - 3);
+}
+
+void test_same_scan_gives_same_value(void) {
+	// The sketch keeps the value of a generation for all offsets of a long read
+	ScanSnapshot scan = emptyScan();
+	addAp(scan, "home", 3);
+	addAp(scan, "office", 4);
+	std::string first = listOf(scan);
+	TEST_ASSERT_EQUAL_STRING(first.c_str(), listOf(scan).c_str());
+	addAp(scan, "warehouse", 3);
+	scan.generation++;
+	TEST_ASSERT_FALSE(first == listOf(scan));
+}
+
+/** Number of 22 byte read blob requests of one long read of a list */
+#define LIST_CHUNKS(list) (((list).size() + 21) / 22)
+
+void test_long_read_serializes_once(void) {
+	ScanSnapshot scan = emptyScan();
+	char ssid[CRED_SSID_SIZE];
+	for (uint8_t ap = 0; ap < SCAN_CACHE_MAX_AP; ap++) {
+		snprintf(ssid, sizeof(ssid), "network-%02u", ap);
+		addAp(scan, ssid, 3);
+	}
+	MemoryValue value;
+	TEST_ASSERT_TRUE(provisioning->serveList(scan, 0, value));
+	std::string list(value.value.begin(), value.value.end());
+	// Every read blob request of the long read, and reads long after it
+	uint32_t now = 0;
+	for (size_t chunk = 1; chunk < LIST_CHUNKS(list); chunk++) {
+		now += 30;
+		TEST_ASSERT_FALSE(provisioning->serveList(scan, now, value));
+	}
+	TEST_ASSERT_FALSE(provisioning->serveList(scan, 60000, value));
+	TEST_ASSERT_EQUAL_UINT32(1, provisioning->listSerializations());
+	TEST_ASSERT_EQUAL_STRING(list.c_str(), std::string(value.value.begin(), value.value.end()).c_str());
+}
+
+void test_new_scan_is_served_after_hold_time(void) {
+	ScanSnapshot scan = emptyScan();
+	addAp(scan, "home", 3);
+	MemoryValue value;
+	TEST_ASSERT_TRUE(provisioning->serveList(scan, 1000, value));
+
+	// A scan published during a long read does not tear it
+	addAp(scan, "office", 4);
+	scan.generation++;
+	TEST_ASSERT_FALSE(provisioning->serveList(scan, 1000 + LIST_HOLD_TIME - 1, value));
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[\"home\"]}", std::string(value.value.begin(), value.value.end()).c_str());
+
+	TEST_ASSERT_TRUE(provisioning->serveList(scan, 1000 + LIST_HOLD_TIME, value));
+	TEST_ASSERT_EQUAL_STRING("{\"SSID\":[\"home\",\"office\"]}", std::string(value.value.begin(), value.value.end()).c_str());
+	TEST_ASSERT_EQUAL_UINT32(2, provisioning->listSerializations());
+
+	// Once per generation, also across a wrap of the clock
+	uint32_t wrap = 0xFFFFFF00UL;
+	scan.generation++;
+	TEST_ASSERT_TRUE(provisioning->serveList(scan, wrap, value));
+	scan.generation++;
+	TEST_ASSERT_FALSE(provisioning->serveList(scan, wrap + LIST_HOLD_TIME - 1, value));
+	TEST_ASSERT_TRUE(provisioning->serveList(scan, wrap + LIST_HOLD_TIME, value));
+	TEST_ASSERT_EQUAL_UINT32(4, provisioning->listSerializations());
+}
+
+/** Write credentials the way the web app does, encoded JSON */
+CredCommand writeJson(const char *ssidPrim, const char *pwPrim, const char *ssidSec, const char *pwSec, BleClient *client = NULL) {
+	char json[256];
+	int length = snprintf(json, sizeof(json), "{\"ssidPrim\":\"%s\",\"pwPrim\":\"%s\",\"ssidSec\":\"%s\",\"pwSec\":\"%s\"}",
+		ssidPrim, pwPrim, ssidSec, pwSec);
+	codecApply(codec, (uint8_t *)json, length);
+	return provisioning->write(client, (uint8_t *)json, length);
+}
+
+/** Write credentials as an encoded TLV frame */
+CredCommand writeTlv(const char *ssidPrim, const char *pwPrim, BleClient *client) {
+	WiFiCredentials credentials;
+	memset(&credentials, 0, sizeof(credentials));
+	strcpy(credentials.ssidPrim, ssidPrim);
+	strcpy(credentials.pwPrim, pwPrim);
+	uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+	size_t length = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS, credentials);
+	codecApply(codec, frame, length);
+	return provisioning->write(client, frame, length);
+}
+
+/** Decoded credentials value as read by a client */
+std::string credentialsFor(const BleClient *client) {
+	MemoryValue value;
+	provisioning->readCredentials(client, value);
+	codecApply(codec, value.value.data(), value.value.size());
+	return std::string(value.value.begin(), value.value.end());
+}
+
+void test_each_client_reads_its_own_protocol(void) {
+	ClientTable clients;
+	uint8_t addressJson[6] = { 1, 2, 3, 4, 5, 6 };
+	uint8_t addressTlv[6] = { 6, 5, 4, 3, 2, 1 };
+	BleClient *json = clients.add(1, addressJson);
+	BleClient *tlv = clients.add(2, addressTlv);
+	TEST_ASSERT_EQUAL(CRED_SET, writeTlv("home", "secret", tlv));
+	TEST_ASSERT_TRUE(tlv->usesTlv);
+	TEST_ASSERT_FALSE(json->usesTlv);
+
+	// The TLV write does not switch the other client, or an unknown one
+	TEST_ASSERT_EQUAL_STRING("{\"ssidPrim\":\"home\",\"pwPrim\":\"secret\",\"ssidSec\":\"\",\"pwSec\":\"\"}", credentialsFor(json).c_str());
+	TEST_ASSERT_EQUAL('{', credentialsFor(NULL)[0]);
+	std::string frame = credentialsFor(tlv);
+	TEST_ASSERT_TRUE(isTlvFrame((const uint8_t *)frame.data(), frame.size()));
+
+	// A new client in the slot of a disconnected TLV client starts with JSON
+	TEST_ASSERT_TRUE(clients.remove(2));
+	BleClient *next = clients.add(3, addressTlv);
+	TEST_ASSERT_FALSE(next->usesTlv);
+	TEST_ASSERT_EQUAL('{', credentialsFor(next)[0]);
+
+	// A JSON write switches the client back
+	TEST_ASSERT_EQUAL(CRED_SET, writeTlv("home", "secret", next));
+	TEST_ASSERT_EQUAL(CRED_SET, writeJson("home", "secret", "", "", next));
+	TEST_ASSERT_FALSE(next->usesTlv);
+}
+
+void test_same_credentials_are_stored_once(void) {
+	TEST_ASSERT_EQUAL(CRED_SET, writeJson("home", "secret", "office", "secret2"));
+	TEST_ASSERT_EQUAL_UINT32(1, store->writes);
+	TEST_ASSERT_EQUAL_UINT32(1, hooks->changes);
+	TEST_ASSERT_TRUE(hooks->hasCredentials);
+	for (int again = 0; again < 10; again++) {
+		TEST_ASSERT_EQUAL(CRED_SET, writeJson("home", "secret", "office", "secret2"));
+	}
+	// No flash write and no reconnect
+	TEST_ASSERT_EQUAL_UINT32(1, store->writes);
+	TEST_ASSERT_EQUAL_UINT32(1, hooks->changes);
+
+	TEST_ASSERT_EQUAL(CRED_SET, writeJson("home", "changed", "office", "secret2"));
+	TEST_ASSERT_EQUAL_UINT32(2, store->writes);
+	TEST_ASSERT_EQUAL_UINT32(2, hooks->changes);
+}
+
+void test_stored_networks_are_loaded(void) {
+	writeJson("home", "secret", "office", "secret2");
+	NetworkTable loadedNetworks;
+	Provisioning loaded(loadedNetworks, codec, *store, *lock, *hooks);
+	loaded.load();
+	WiFiCredentials credentials;
+	loadedNetworks.getCredentials(credentials);
+	TEST_ASSERT_EQUAL_STRING("home", credentials.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("secret2", credentials.pwSec);
+	// The loaded record is known, sending it again writes nothing
+	uint32_t writes = store->writes;
+	TEST_ASSERT_FALSE(loaded.save());
+	TEST_ASSERT_EQUAL_UINT32(writes, store->writes);
+}
+
+void test_corrupted_record_loads_nothing(void) {
+	writeJson("home", "secret", "office", "secret2");
+	uint8_t stored[NVS_RECORD_HEADER_SIZE + NETWORK_TABLE_MAX_SIZE];
+	size_t length = store->getBytes("networks", stored, sizeof(stored));
+	stored[length - 1] ^= 0x01;
+	store->putBytes("networks", stored, length);
+
+	NetworkTable loadedNetworks;
+	Provisioning loaded(loadedNetworks, codec, *store, *lock, *hooks);
+	loaded.load();
+	TEST_ASSERT_EQUAL_UINT8(0, loadedNetworks.count());
+}
+
+void test_legacy_keys_are_moved_to_one_record(void) {
+	store->putBool("valid", true);
+	store->putString("ssidPrim", "home");
+	store->putString("pwPrim", "secret");
+	store->putString("ssidSec", "office");
+	store->putString("pwSec", "secret2");
+	provisioning->load();
+	TEST_ASSERT_EQUAL_UINT8(2, networks->count());
+	TEST_ASSERT_EQUAL_STRING("office", networks->get(NETWORK_SECONDARY)->ssid);
+	TEST_ASSERT_FALSE(store->getBool("valid", false));
+
+	NetworkTable loadedNetworks;
+	Provisioning loaded(loadedNetworks, codec, *store, *lock, *hooks);
+	loaded.load();
+	TEST_ASSERT_EQUAL_STRING("secret", loadedNetworks.get(NETWORK_PRIMARY)->pw);
+}
+
+void test_last_success_survives_restart(void) {
+	writeJson("home", "secret", "office", "secret2");
+	{
+		LockGuard guard(*lock);
+		TEST_ASSERT_TRUE(networks->markSuccess(NETWORK_SECONDARY));
+		TEST_ASSERT_TRUE(provisioning->save());
+		// Connecting to the same network again changes nothing stored
+		TEST_ASSERT_FALSE(networks->markSuccess(NETWORK_SECONDARY));
+	}
+
+	NetworkTable loadedNetworks;
+	Provisioning loaded(loadedNetworks, codec, *store, *lock, *hooks);
+	loaded.load();
+	ScanRecord aps[2];
+	memset(aps, 0, sizeof(aps));
+	strcpy(aps[0].ssid, "home");
+	aps[0].rssi = -60;
+	strcpy(aps[1].ssid, "office");
+	aps[1].rssi = -60 - NETWORK_LAST_SUCCESS_BONUS + 1;
+	TEST_ASSERT_EQUAL_UINT8(NETWORK_SECONDARY, loadedNetworks.select(aps, 2));
+	TEST_ASSERT_FALSE(loadedNetworks.markSuccess(NETWORK_SECONDARY));
+	TEST_ASSERT_TRUE(loadedNetworks.markSuccess(NETWORK_PRIMARY));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_list_skips_open_networks);
+	RUN_TEST(test_empty_scan_gives_empty_list);
+	RUN_TEST(test_list_escapes_ssids);
+	RUN_TEST(test_list_is_capped);
+	RUN_TEST(test_longest_ssids_fit);
+	RUN_TEST(test_same_scan_gives_same_value);
+	RUN_TEST(test_long_read_serializes_once);
+	RUN_TEST(test_new_scan_is_served_after_hold_time);
+	RUN_TEST(test_same_credentials_are_stored_once);
+	RUN_TEST(test_stored_networks_are_loaded);
+	RUN_TEST(test_corrupted_record_loads_nothing);
+	RUN_TEST(test_legacy_keys_are_moved_to_one_record);
+	RUN_TEST(test_last_success_survives_restart);
+	RUN_TEST(test_each_client_reads_its_own_protocol);
+	return UNITY_END();
+}
@@ -0,0 +1,213 @@
+/**
+ * Unit and stress tests of the double-buffered scan cache
+ *
+ * The stress test runs the scan task as one writer thread against several
+ * reader threads on the host. Every field of a result set is derived from
+ * its generation, so a copy that mixes two fills is detected. A fake
+ * scanner that holds the back buffer for the time of a full scan checks
+ * that readers get the previous result set without waiting for it.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "../../src/scan_cache.h"
+
+#define PUBLISHES 300000
+#define READERS 3
+/** Time in ms the fake scanner holds the back buffer per scan, like a scan of all channels */
+#define SLOW_SCAN_TIME 300
+#define SLOW_SCANS 3
+/** Longest a copy may take, far below SLOW_SCAN_TIME even with a preemption */
+#define MAX_READ_TIME_US 20000
+
+/** Fill a result set the way the scan task would, for scan number serial */
+void fill(ScanSnapshot &scan, uint32_t serial) {
+	scan.count = serial % SCAN_CACHE_MAX_AP + 1;
+	scan.partial = serial & 1;
+	for (uint8_t ap = 0; ap < SCAN_CACHE_MAX_AP; ap++) {
+		ScanRecord &record = scan.aps[ap];
+		memset(record.ssid, 0, sizeof(record.ssid));
+		memset(record.ssid, 'a' + (serial + ap) % 26, 1 + (serial + ap) % 32);
+		record.rssi = -(int8_t)((serial + ap) % 90);
+		record.channel = 1 + (serial + ap) % 13;
+		record.authMode = (serial + ap) % 5;
+		memset(record.bssid, (uint8_t)(serial + ap), sizeof(record.bssid));
+	}
+}
+
+/** Check a copy against the fill of its generation */
+bool isConsistent(const ScanSnapshot &scan) {
+	ScanSnapshot expected;
+	memset(&expected, 0, sizeof(expected));
+	fill(expected, scan.generation);
+	expected.generation = scan.generation;
+	expected.scanTime = scan.generation;
+	return scan.scanTime == expected.scanTime
+		&& scan.count == expected.count
+		&& scan.partial == expected.partial
+		&& memcmp(scan.aps, expected.aps, sizeof(scan.aps)) == 0;
+}
+
+/** Results of one reader */
+struct ReaderResult {
+	uint32_t reads;
+	uint32_t torn;
+	uint32_t backwards;
+};
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_nothing_published_reads_generation_zero(void) {
+	ScanCache cache;
+	ScanSnapshot scan;
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(0, scan.generation);
+	TEST_ASSERT_EQUAL_UINT8(0, scan.count);
+	TEST_ASSERT_EQUAL_UINT32(0, cache.generation());
+}
+
+void test_fill_is_visible_after_publish_only(void) {
+	ScanCache cache;
+	fill(cache.back(), 1);
+	ScanSnapshot scan;
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(0, scan.generation);
+
+	cache.publish(1);
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(1, scan.generation);
+	TEST_ASSERT_EQUAL_UINT32(1, cache.generation());
+	TEST_ASSERT_TRUE(isConsistent(scan));
+
+	// An abandoned fill is not published, the next one replaces it
+	fill(cache.back(), 99);
+	fill(cache.back(), 2);
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(1, scan.generation);
+	cache.publish(2);
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(2, scan.generation);
+	TEST_ASSERT_TRUE(isConsistent(scan));
+}
+
+void test_readers_never_see_torn_result(void) {
+	ScanCache cache;
+	std::atomic<int> started(0);
+	std::atomic<bool> done(false);
+	ReaderResult results[READERS];
+	memset(results, 0, sizeof(results));
+
+	std::vector<std::thread> readers;
+	for (int reader = 0; reader < READERS; reader++) {
+		readers.push_back(std::thread([&cache, &started, &done, &results, reader]() {
+			ReaderResult &result = results[reader];
+			ScanSnapshot scan;
+			uint32_t last = 0;
+			started++;
+			while (!done.load(std::memory_order_acquire)) {
+				cache.read(scan);
+				result.reads++;
+				if (scan.generation == 0) {
+					continue;
+				}
+				if (!isConsistent(scan)) {
+					result.torn++;
+				}
+				if (scan.generation < last) {
+					result.backwards++;
+				}
+				last = scan.generation;
+			}
+		}));
+	}
+	std::thread writer([&cache, &started, &done]() {
+		// Overlap the fills with the reads
+		while (started.load() < READERS) {
+		}
+		for (uint32_t serial = 1; serial <= PUBLISHES; serial++) {
+			fill(cache.back(), serial);
+			cache.publish(serial);
+		}
+		done.store(true, std::memory_order_release);
+	});
+	writer.join();
+	for (size_t reader = 0; reader < readers.size(); reader++) {
+		readers[reader].join();
+	}
+
+	for (int reader = 0; reader < READERS; reader++) {
+		TEST_ASSERT_GREATER_THAN(0, results[reader].reads);
+		TEST_ASSERT_EQUAL_UINT32(0, results[reader].torn);
+		TEST_ASSERT_EQUAL_UINT32(0, results[reader].backwards);
+	}
+	TEST_ASSERT_EQUAL_UINT32(PUBLISHES, cache.generation());
+}
+
+void test_reads_do_not_wait_for_a_slow_scan(void) {
+	ScanCache cache;
+	fill(cache.back(), 1);
+	cache.publish(1);
+	std::atomic<uint32_t> scanning(0);
+	std::atomic<bool> done(false);
+
+	// Holds the back buffer half filled for the time of a scan
+	std::thread scanner([&cache, &scanning, &done]() {
+		for (uint32_t serial = 2; serial < 2 + SLOW_SCANS; serial++) {
+			ScanSnapshot &back = cache.back();
+			back.count = 0;
+			scanning.store(serial, std::memory_order_release);
+			std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_SCAN_TIME));
+			fill(back, serial);
+			scanning.store(0, std::memory_order_release);
+			cache.publish(serial);
+		}
+		done.store(true, std::memory_order_release);
+	});
+
+	uint32_t readsDuringScan = 0;
+	uint32_t torn = 0;
+	int64_t slowest = 0;
+	ScanSnapshot scan;
+	while (!done.load(std::memory_order_acquire)) {
+		uint32_t before = scanning.load(std::memory_order_acquire);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		cache.read(scan);
+		int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		slowest = us > slowest ? us : slowest;
+		if (!isConsistent(scan)) {
+			torn++;
+		}
+		if (before != 0 && scanning.load(std::memory_order_acquire) == before) {
+			// Served the previous scan while this one was still running
+			TEST_ASSERT_EQUAL_UINT32(before - 1, scan.generation);
+			readsDuringScan++;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	scanner.join();
+
+	TEST_ASSERT_EQUAL_UINT32(0, torn);
+	TEST_ASSERT_GREATER_THAN(SLOW_SCANS * 100, readsDuringScan);
+	TEST_ASSERT_LESS_THAN(MAX_READ_TIME_US, slowest);
+	cache.read(scan);
+	TEST_ASSERT_EQUAL_UINT32(1 + SLOW_SCANS, scan.generation);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_nothing_published_reads_generation_zero);
+	RUN_TEST(test_fill_is_visible_after_publish_only);
+	RUN_TEST(test_readers_never_see_torn_result);
+	RUN_TEST(test_reads_do_not_wait_for_a_slow_scan);
+	return UNITY_END();
+}
@@ -0,0 +1,55 @@
+/**
+ * Unit tests of the WiFi scan policy helpers
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <unity.h>
+
+#include "../../src/scan_policy.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+ScanPolicy makePolicy(uint16_t channelMask, uint16_t dwellMs, bool stopWhenKnownFound) {
+	ScanPolicy policy;
+	policy.passive = false;
+	policy.dwellMs = dwellMs;
+	policy.channelMask = channelMask;
+	policy.stopWhenKnownFound = stopWhenKnownFound;
+	return policy;
+}
+
+void test_channel_count(void) {
+	TEST_ASSERT_EQUAL_UINT8(13, scanPolicyChannels(makePolicy(SCAN_ALL_CHANNELS, 100, false)));
+	TEST_ASSERT_EQUAL_UINT8(3, scanPolicyChannels(makePolicy(SCAN_CHANNEL(1) | SCAN_CHANNEL(6) | SCAN_CHANNEL(11), 100, false)));
+	TEST_ASSERT_EQUAL_UINT8(1, scanPolicyChannels(makePolicy(SCAN_CHANNEL(SCAN_MAX_CHANNEL), 100, false)));
+	TEST_ASSERT_EQUAL_UINT8(0, scanPolicyChannels(makePolicy(0, 100, false)));
+	// Bit 0 and bits past channel 14 are no channels
+	TEST_ASSERT_EQUAL_UINT8(0, scanPolicyChannels(makePolicy(0x8001, 100, false)));
+}
+
+void test_duration_is_channels_times_dwell(void) {
+	TEST_ASSERT_EQUAL_UINT32(13 * 120, scanPolicyDuration(makePolicy(SCAN_ALL_CHANNELS, 120, false)));
+	TEST_ASSERT_EQUAL_UINT32(3 * 300, scanPolicyDuration(makePolicy(SCAN_CHANNEL(1) | SCAN_CHANNEL(6) | SCAN_CHANNEL(11), 300, true)));
+	// No overflow of the 16 bit dwell time
+	TEST_ASSERT_EQUAL_UINT32(14UL * 65535, scanPolicyDuration(makePolicy(SCAN_ALL_CHANNELS | SCAN_CHANNEL(14), 65535, false)));
+}
+
+void test_single_pass_needs_all_channels_without_early_stop(void) {
+	TEST_ASSERT_TRUE(scanPolicySinglePass(makePolicy(SCAN_ALL_CHANNELS, 120, false)));
+	TEST_ASSERT_TRUE(scanPolicySinglePass(makePolicy(SCAN_ALL_CHANNELS | SCAN_CHANNEL(14), 120, false)));
+	TEST_ASSERT_FALSE(scanPolicySinglePass(makePolicy(SCAN_ALL_CHANNELS, 120, true)));
+	TEST_ASSERT_FALSE(scanPolicySinglePass(makePolicy(SCAN_ALL_CHANNELS & ~SCAN_CHANNEL(13), 120, false)));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_channel_count);
+	RUN_TEST(test_duration_is_channels_times_dwell);
+	RUN_TEST(test_single_pass_needs_all_channels_without_early_stop);
+	return UNITY_END();
+}
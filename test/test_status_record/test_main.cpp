@@ -0,0 +1,105 @@
+/**
+ * Unit tests of the packed connection status record
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/network_table.h"
+#include "../../src/status_record.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+StatusRecord makeRecord() {
+	StatusRecord record;
+	memset(&record, 0, sizeof(record));
+	record.state = CONN_STATE_CONNECTED;
+	record.profile = 2;
+	record.rssi = -67;
+	record.channel = 11;
+	record.lastDisconnectReason = 201;
+	record.reconnectCount = 0x1234;
+	record.ipv4[0] = 192;
+	record.ipv4[1] = 168;
+	record.ipv4[2] = 4;
+	record.ipv4[3] = 21;
+	record.uptime = 0xA1B2C3D4;
+	return record;
+}
+
+void test_encoded_layout(void) {
+	StatusRecord record = makeRecord();
+	uint8_t out[STATUS_RECORD_SIZE];
+	TEST_ASSERT_EQUAL(STATUS_RECORD_SIZE, encodeStatusRecord(record, out, sizeof(out)));
+	const uint8_t expected[STATUS_RECORD_SIZE] = {
+		STATUS_RECORD_VERSION, CONN_STATE_CONNECTED, 2, 0xBD, 11, 201, 0x34, 0x12,
+		192, 168, 4, 21, 0xD4, 0xC3, 0xB2, 0xA1
+	};
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, STATUS_RECORD_SIZE);
+}
+
+void test_round_trip(void) {
+	StatusRecord record = makeRecord();
+	uint8_t out[STATUS_RECORD_SIZE];
+	encodeStatusRecord(record, out, sizeof(out));
+	StatusRecord decoded;
+	memset(&decoded, 0xFF, sizeof(decoded));
+	TEST_ASSERT_TRUE(decodeStatusRecord(out, sizeof(out), decoded));
+	TEST_ASSERT_EQUAL_UINT8(record.state, decoded.state);
+	TEST_ASSERT_EQUAL_UINT8(record.profile, decoded.profile);
+	TEST_ASSERT_EQUAL_INT8(record.rssi, decoded.rssi);
+	TEST_ASSERT_EQUAL_UINT8(record.channel, decoded.channel);
+	TEST_ASSERT_EQUAL_UINT8(record.lastDisconnectReason, decoded.lastDisconnectReason);
+	TEST_ASSERT_EQUAL_UINT16(record.reconnectCount, decoded.reconnectCount);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(record.ipv4, decoded.ipv4, 4);
+	TEST_ASSERT_EQUAL_UINT32(record.uptime, decoded.uptime);
+}
+
+void test_small_buffers_are_rejected(void) {
+	StatusRecord record = makeRecord();
+	uint8_t out[STATUS_RECORD_SIZE];
+	TEST_ASSERT_EQUAL(0, encodeStatusRecord(record, out, sizeof(out) - 1));
+	encodeStatusRecord(record, out, sizeof(out));
+	TEST_ASSERT_FALSE(decodeStatusRecord(out, sizeof(out) - 1, record));
+}
+
+void test_version_zero_is_rejected_and_newer_accepted(void) {
+	StatusRecord record = makeRecord();
+	// A newer version appends fields, the known prefix still decodes
+	uint8_t out[STATUS_RECORD_SIZE + 4];
+	memset(out, 0x5A, sizeof(out));
+	encodeStatusRecord(record, out, sizeof(out));
+	out[0] = STATUS_RECORD_VERSION + 1;
+	StatusRecord decoded;
+	TEST_ASSERT_TRUE(decodeStatusRecord(out, sizeof(out), decoded));
+	TEST_ASSERT_EQUAL_UINT32(record.uptime, decoded.uptime);
+	out[0] = 0;
+	TEST_ASSERT_FALSE(decodeStatusRecord(out, sizeof(out), decoded));
+}
+
+void test_legacy_status_is_clamped(void) {
+	StatusRecord record = makeRecord();
+	// Profile of a network is its slot + 1
+	const uint8_t profiles[] = { 0, 1, 2, 3, MAX_NETWORKS };
+	const uint16_t expected[] = { 0, 1, 2, 2, 2 };
+	for (size_t index = 0; index < sizeof(profiles); index++) {
+		record.profile = profiles[index];
+		TEST_ASSERT_EQUAL_UINT16(expected[index], legacyStatusValue(record));
+	}
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_encoded_layout);
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_small_buffers_are_rejected);
+	RUN_TEST(test_version_zero_is_rejected_and_newer_accepted);
+	RUN_TEST(test_legacy_status_is_clamped);
+	return UNITY_END();
+}
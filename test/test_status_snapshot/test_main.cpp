@@ -0,0 +1,133 @@
+/**
+ * Stress test of the sequence locked snapshot
+ *
+ * One writer thread and several reader threads on the host. Every field
+ * of a record is derived from its serial, so a copy mixing two writes is
+ * detected.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "../../src/status_snapshot.h"
+
+#define WRITES 2000000
+#define READERS 3
+
+/** Not a multiple of 4 bytes, so the last word is partly padding */
+struct TestRecord {
+	uint32_t serial;
+	uint32_t squared;
+	uint16_t low;
+	uint8_t check[9];
+};
+
+TestRecord makeRecord(uint32_t serial) {
+	TestRecord record;
+	memset(&record, 0, sizeof(record));
+	record.serial = serial;
+	record.squared = serial * serial;
+	record.low = (uint16_t)~serial;
+	for (uint8_t index = 0; index < sizeof(record.check); index++) {
+		record.check[index] = (uint8_t)(serial + index);
+	}
+	return record;
+}
+
+bool isConsistent(const TestRecord &record) {
+	TestRecord expected = makeRecord(record.serial);
+	return memcmp(&expected, &record, sizeof(record)) == 0;
+}
+
+/** Results of one reader */
+struct ReaderResult {
+	uint32_t reads;
+	uint32_t torn;
+	uint32_t backwards;
+};
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+void test_initial_value_is_zero(void) {
+	Snapshot<TestRecord> snapshot;
+	TestRecord record = snapshot.read();
+	TestRecord zero;
+	memset(&zero, 0, sizeof(zero));
+	TEST_ASSERT_EQUAL_MEMORY(&zero, &record, sizeof(record));
+	TEST_ASSERT_EQUAL_UINT32(0, snapshot.version());
+}
+
+void test_version_counts_writes(void) {
+	Snapshot<TestRecord> snapshot;
+	for (uint32_t serial = 1; serial <= 5; serial++) {
+		snapshot.write(makeRecord(serial));
+		TEST_ASSERT_EQUAL_UINT32(serial, snapshot.version());
+		TEST_ASSERT_EQUAL_UINT32(serial, snapshot.read().serial);
+	}
+}
+
+void test_readers_never_see_torn_record(void) {
+	Snapshot<TestRecord> snapshot;
+	snapshot.write(makeRecord(1));
+	std::atomic<int> started(0);
+	std::atomic<bool> done(false);
+	ReaderResult results[READERS];
+	memset(results, 0, sizeof(results));
+
+	std::vector<std::thread> readers;
+	for (int reader = 0; reader < READERS; reader++) {
+		readers.push_back(std::thread([&snapshot, &started, &done, &results, reader]() {
+			ReaderResult &result = results[reader];
+			uint32_t last = 0;
+			started++;
+			while (!done.load(std::memory_order_acquire)) {
+				TestRecord record = snapshot.read();
+				result.reads++;
+				if (!isConsistent(record)) {
+					result.torn++;
+				}
+				if (record.serial < last) {
+					result.backwards++;
+				}
+				last = record.serial;
+			}
+		}));
+	}
+	std::thread writer([&snapshot, &started, &done]() {
+		// Overlap the writes with the reads
+		while (started.load() < READERS) {
+		}
+		for (uint32_t serial = 2; serial <= WRITES; serial++) {
+			snapshot.write(makeRecord(serial));
+		}
+		done.store(true, std::memory_order_release);
+	});
+	writer.join();
+	for (size_t reader = 0; reader < readers.size(); reader++) {
+		readers[reader].join();
+	}
+
+	for (int reader = 0; reader < READERS; reader++) {
+		TEST_ASSERT_GREATER_THAN(0, results[reader].reads);
+		TEST_ASSERT_EQUAL_UINT32(0, results[reader].torn);
+		TEST_ASSERT_EQUAL_UINT32(0, results[reader].backwards);
+	}
+	TEST_ASSERT_EQUAL_UINT32(WRITES, snapshot.read().serial);
+	TEST_ASSERT_EQUAL_UINT32(WRITES, snapshot.version());
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_initial_value_is_zero);
+	RUN_TEST(test_version_counts_writes);
+	RUN_TEST(test_readers_never_see_torn_record);
+	return UNITY_END();
+}
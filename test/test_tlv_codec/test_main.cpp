@@ -0,0 +1,243 @@
+/**
+ * Unit tests of the binary TLV provisioning format
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/tlv_codec.h"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+/** Credentials with every slot set, the longest values if full */
+void fillCredentials(WiFiCredentials &credentials, bool full) {
+	memset(&credentials, 0, sizeof(credentials));
+	if (full) {
+		memset(credentials.ssidPrim, 'a', CRED_SSID_SIZE - 1);
+		memset(credentials.pwPrim, 'b', CRED_PW_SIZE - 1);
+		memset(credentials.ssidSec, 'c', CRED_SSID_SIZE - 1);
+		memset(credentials.pwSec, 'd', CRED_PW_SIZE - 1);
+	} else {
+		strcpy(credentials.ssidPrim, "home");
+		strcpy(credentials.pwPrim, "secret");
+		strcpy(credentials.ssidSec, "office");
+		strcpy(credentials.pwSec, "secret2");
+	}
+}
+
+void assertSameCredentials(const WiFiCredentials &expected, const WiFiCredentials &actual) {
+	TEST_ASSERT_EQUAL_STRING(expected.ssidPrim, actual.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING(expected.pwPrim, actual.pwPrim);
+	TEST_ASSERT_EQUAL_STRING(expected.ssidSec, actual.ssidSec);
+	TEST_ASSERT_EQUAL_STRING(expected.pwSec, actual.pwSec);
+}
+
+/** Append a field to a frame under construction */
+void appendField(uint8_t *frame, size_t &length, uint8_t tag, const char *value) {
+	frame[length++] = tag;
+	frame[length++] = (uint8_t)strlen(value);
+	memcpy(frame + length, value, strlen(value));
+	length += strlen(value);
+}
+
+void test_credentials_round_trip(void) {
+	for (int full = 0; full < 2; full++) {
+		WiFiCredentials sent;
+		fillCredentials(sent, full);
+		uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+		size_t length = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS, sent);
+		TEST_ASSERT_GREATER_THAN(0, length);
+		TEST_ASSERT_TRUE(isTlvFrame(frame, length));
+
+		WiFiCredentials received;
+		memset(&received, 0, sizeof(received));
+		TEST_ASSERT_EQUAL(CRED_SET, parseTlvCredentials(frame, length, received));
+		assertSameCredentials(sent, received);
+	}
+}
+
+void test_longest_credentials_fill_max_frame(void) {
+	WiFiCredentials credentials;
+	fillCredentials(credentials, true);
+	uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+	TEST_ASSERT_EQUAL(TLV_MAX_CREDENTIALS_FRAME, tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_CREDENTIALS, credentials));
+	TEST_ASSERT_EQUAL(0, tlvEncodeCredentials(frame, sizeof(frame) - 1, TLV_OP_CREDENTIALS, credentials));
+}
+
+void test_set_keeps_fields_missing_from_frame(void) {
+	WiFiCredentials stored;
+	fillCredentials(stored, false);
+	uint8_t frame[64];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	appendField(frame, length, TLV_TAG_PW_SEC, "changed");
+
+	TEST_ASSERT_EQUAL(CRED_SET, parseTlvCredentials(frame, length, stored));
+	TEST_ASSERT_EQUAL_STRING("home", stored.ssidPrim);
+	TEST_ASSERT_EQUAL_STRING("changed", stored.pwSec);
+}
+
+void test_set_without_fields_is_none(void) {
+	WiFiCredentials stored;
+	fillCredentials(stored, false);
+	uint8_t frame[TLV_HEADER_SIZE];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	TEST_ASSERT_EQUAL(CRED_NONE, parseTlvCredentials(frame, length, stored));
+}
+
+void test_commands_round_trip(void) {
+	const TlvOpcode opcodes[] = { TLV_OP_ERASE, TLV_OP_RESET, TLV_OP_ADD_NETWORK, TLV_OP_REMOVE_NETWORK };
+	const CredCommand commands[] = { CRED_ERASE, CRED_RESET, CRED_ADD_NETWORK, CRED_REMOVE_NETWORK };
+	for (size_t index = 0; index < sizeof(opcodes) / sizeof(opcodes[0]); index++) {
+		uint8_t frame[TLV_HEADER_SIZE];
+		size_t length = tlvEncodeCommand(frame, sizeof(frame), opcodes[index]);
+		TEST_ASSERT_EQUAL(TLV_HEADER_SIZE, length);
+		WiFiCredentials credentials;
+		fillCredentials(credentials, false);
+		TEST_ASSERT_EQUAL(commands[index], parseTlvCredentials(frame, length, credentials));
+		// Commands never touch the credentials
+		TEST_ASSERT_EQUAL_STRING("home", credentials.ssidPrim);
+	}
+	uint8_t frame[TLV_HEADER_SIZE];
+	TEST_ASSERT_EQUAL(0, tlvEncodeCommand(frame, TLV_HEADER_SIZE - 1, TLV_OP_ERASE));
+}
+
+void test_network_round_trip(void) {
+	uint8_t frame[128];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_ADD_NETWORK);
+	appendField(frame, length, TLV_TAG_SSID, "warehouse");
+	appendField(frame, length, TLV_TAG_PW, "forklift");
+	frame[length++] = TLV_TAG_PRIORITY;
+	frame[length++] = 1;
+	frame[length++] = 3;
+
+	WiFiCredentials credentials;
+	fillCredentials(credentials, false);
+	TEST_ASSERT_EQUAL(CRED_ADD_NETWORK, parseTlvCredentials(frame, length, credentials));
+	TlvNetwork network;
+	TEST_ASSERT_TRUE(parseTlvNetwork(frame, length, network));
+	TEST_ASSERT_EQUAL_STRING("warehouse", network.ssid);
+	TEST_ASSERT_EQUAL_STRING("forklift", network.pw);
+	TEST_ASSERT_EQUAL_UINT8(3, network.priority);
+}
+
+void test_network_without_ssid_or_bad_priority_is_rejected(void) {
+	uint8_t frame[64];
+	TlvNetwork network;
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_REMOVE_NETWORK);
+	appendField(frame, length, TLV_TAG_PW, "forklift");
+	TEST_ASSERT_FALSE(parseTlvNetwork(frame, length, network));
+
+	length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_ADD_NETWORK);
+	appendField(frame, length, TLV_TAG_SSID, "warehouse");
+	appendField(frame, length, TLV_TAG_PRIORITY, "12");
+	TEST_ASSERT_FALSE(parseTlvNetwork(frame, length, network));
+}
+
+void test_bad_magic_is_invalid(void) {
+	WiFiCredentials credentials;
+	fillCredentials(credentials, false);
+	uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+	size_t length = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS, credentials);
+	frame[0] = '{';
+	TEST_ASSERT_FALSE(isTlvFrame(frame, length));
+	WiFiCredentials received;
+	fillCredentials(received, true);
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, length, received));
+	TEST_ASSERT_EQUAL(CRED_SSID_SIZE - 1, strlen(received.ssidPrim));
+	TEST_ASSERT_FALSE(isTlvFrame(frame, 0));
+}
+
+void test_unsupported_version_is_invalid(void) {
+	uint8_t frame[TLV_HEADER_SIZE];
+	tlvEncodeCommand(frame, sizeof(frame), TLV_OP_ERASE);
+	WiFiCredentials credentials;
+	frame[1] = TLV_VERSION + 1;
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, sizeof(frame), credentials));
+	frame[1] = 0;
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, sizeof(frame), credentials));
+}
+
+void test_every_truncation_is_invalid(void) {
+	WiFiCredentials sent;
+	fillCredentials(sent, false);
+	uint8_t frame[TLV_MAX_CREDENTIALS_FRAME];
+	size_t length = tlvEncodeCredentials(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS, sent);
+	for (size_t cut = 0; cut < length; cut++) {
+		WiFiCredentials received;
+		fillCredentials(received, true);
+		CredCommand command = parseTlvCredentials(frame, cut, received);
+		if (cut == TLV_HEADER_SIZE) {
+			// Header alone is a set without fields
+			TEST_ASSERT_EQUAL(CRED_NONE, command);
+		} else if (command != CRED_INVALID) {
+			// Cut exactly between two fields: a valid frame with the first fields only
+			TEST_ASSERT_EQUAL(CRED_SET, command);
+			TEST_ASSERT_EQUAL_STRING(sent.ssidPrim, received.ssidPrim);
+			continue;
+		}
+		// Rejected frames leave the credentials untouched
+		TEST_ASSERT_EQUAL(CRED_SSID_SIZE - 1, strlen(received.ssidPrim));
+	}
+}
+
+void test_length_past_end_is_invalid(void) {
+	uint8_t frame[64];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	appendField(frame, length, TLV_TAG_SSID_PRIM, "home");
+	frame[length - 5] = 200;
+	WiFiCredentials credentials;
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, length, credentials));
+	TlvNetwork network;
+	TEST_ASSERT_FALSE(parseTlvNetwork(frame, length, network));
+}
+
+void test_overlong_or_embedded_zero_value_is_invalid(void) {
+	char ssid[CRED_SSID_SIZE + 1];
+	memset(ssid, 'x', CRED_SSID_SIZE);
+	ssid[CRED_SSID_SIZE] = 0;
+	uint8_t frame[64];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	appendField(frame, length, TLV_TAG_SSID_PRIM, ssid);
+	WiFiCredentials credentials;
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, length, credentials));
+
+	length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	appendField(frame, length, TLV_TAG_PW_PRIM, "se?ret");
+	frame[length - 4] = 0;
+	TEST_ASSERT_EQUAL(CRED_INVALID, parseTlvCredentials(frame, length, credentials));
+}
+
+void test_unknown_tags_are_skipped(void) {
+	WiFiCredentials credentials;
+	memset(&credentials, 0, sizeof(credentials));
+	uint8_t frame[64];
+	size_t length = tlvEncodeCommand(frame, sizeof(frame), TLV_OP_SET_CREDENTIALS);
+	appendField(frame, length, 0x7E, "field of a newer version");
+	appendField(frame, length, TLV_TAG_SSID_PRIM, "home");
+	TEST_ASSERT_EQUAL(CRED_SET, parseTlvCredentials(frame, length, credentials));
+	TEST_ASSERT_EQUAL_STRING("home", credentials.ssidPrim);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_credentials_round_trip);
+	RUN_TEST(test_longest_credentials_fill_max_frame);
+	RUN_TEST(test_set_keeps_fields_missing_from_frame);
+	RUN_TEST(test_set_without_fields_is_none);
+	RUN_TEST(test_commands_round_trip);
+	RUN_TEST(test_network_round_trip);
+	RUN_TEST(test_network_without_ssid_or_bad_priority_is_rejected);
+	RUN_TEST(test_bad_magic_is_invalid);
+	RUN_TEST(test_unsupported_version_is_invalid);
+	RUN_TEST(test_every_truncation_is_invalid);
+	RUN_TEST(test_length_past_end_is_invalid);
+	RUN_TEST(test_overlong_or_embedded_zero_value_is_invalid);
+	RUN_TEST(test_unknown_tags_are_skipped);
+	return UNITY_END();
+}
@@ -0,0 +1,111 @@
+/**
+ * Unit tests of the WiFi event dispatch table
+ *
+ * Event ids and info are stand-ins for system_event_id_t and
+ * system_event_info_t of the ESP32 core.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <unity.h>
+
+#include "../../src/wifi_events.h"
+
+#define EVENT_DISCONNECTED 5
+#define EVENT_GOT_IP 7
+#define EVENT_SCAN_DONE 1
+#define CYCLES 1000
+
+/** Event data of the test platform */
+struct TestInfo {
+	uint8_t reason;
+};
+
+uint32_t gotIPCalls;
+uint32_t lostCalls;
+uint8_t lastReason;
+
+void gotIP(uint16_t, const TestInfo &) {
+	gotIPCalls++;
+}
+
+void lostCon(uint16_t, const TestInfo &info) {
+	lostCalls++;
+	lastReason = info.reason;
+}
+
+void setUp(void) {
+	gotIPCalls = 0;
+	lostCalls = 0;
+	lastReason = 0;
+}
+
+void tearDown(void) {
+}
+
+void test_each_event_runs_its_handler_once(void) {
+	EventDispatcher<TestInfo> events;
+	TEST_ASSERT_TRUE(events.on(EVENT_GOT_IP, gotIP));
+	TEST_ASSERT_TRUE(events.on(EVENT_DISCONNECTED, lostCon));
+	TestInfo info = { 201 };
+	for (uint32_t cycle = 0; cycle < CYCLES; cycle++) {
+		events.dispatch(EVENT_GOT_IP, info);
+		events.dispatch(EVENT_DISCONNECTED, info);
+	}
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, gotIPCalls);
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, lostCalls);
+	TEST_ASSERT_EQUAL_UINT8(201, lastReason);
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, events.count(EVENT_GOT_IP));
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, events.count(EVENT_DISCONNECTED));
+}
+
+void test_setting_handler_per_connect_does_not_add_calls(void) {
+	EventDispatcher<TestInfo> events;
+	TestInfo info = { 8 };
+	for (uint32_t cycle = 0; cycle < CYCLES; cycle++) {
+		// What connectWiFi() did with WiFi.onEvent() before every connect
+		events.on(EVENT_GOT_IP, gotIP);
+		events.on(EVENT_DISCONNECTED, lostCon);
+		events.dispatch(EVENT_GOT_IP, info);
+		events.dispatch(EVENT_DISCONNECTED, info);
+		TEST_ASSERT_EQUAL_UINT32(cycle + 1, gotIPCalls);
+		TEST_ASSERT_EQUAL_UINT32(cycle + 1, lostCalls);
+	}
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, events.count(EVENT_GOT_IP));
+	TEST_ASSERT_EQUAL_UINT32(CYCLES, events.count(EVENT_DISCONNECTED));
+}
+
+void test_events_without_handler_are_counted(void) {
+	EventDispatcher<TestInfo> events;
+	events.on(EVENT_GOT_IP, gotIP);
+	TestInfo info = { 0 };
+	events.dispatch(EVENT_SCAN_DONE, info);
+	events.dispatch(EVENT_SCAN_DONE, info);
+	TEST_ASSERT_EQUAL_UINT32(2, events.count(EVENT_SCAN_DONE));
+	TEST_ASSERT_EQUAL_UINT32(0, gotIPCalls);
+
+	// A NULL handler unregisters
+	events.on(EVENT_GOT_IP, NULL);
+	events.dispatch(EVENT_GOT_IP, info);
+	TEST_ASSERT_EQUAL_UINT32(0, gotIPCalls);
+	TEST_ASSERT_EQUAL_UINT32(1, events.count(EVENT_GOT_IP));
+}
+
+void test_events_without_slot_are_ignored(void) {
+	EventDispatcher<TestInfo> events;
+	TEST_ASSERT_FALSE(events.on(WIFI_EVENT_SLOTS, gotIP));
+	TestInfo info = { 0 };
+	events.dispatch(WIFI_EVENT_SLOTS, info);
+	events.dispatch(0xFFFF, info);
+	TEST_ASSERT_EQUAL_UINT32(0, gotIPCalls);
+	TEST_ASSERT_EQUAL_UINT32(0, events.count(WIFI_EVENT_SLOTS));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_each_event_runs_its_handler_once);
+	RUN_TEST(test_setting_handler_per_connect_does_not_add_calls);
+	RUN_TEST(test_events_without_handler_are_counted);
+	RUN_TEST(test_events_without_slot_are_ignored);
+	return UNITY_END();
+}
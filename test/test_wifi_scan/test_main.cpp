@@ -0,0 +1,275 @@
+/**
+ * Unit tests of the scan of the scan task
+ *
+ * FakeStation models the WiFi station: the connection manager connects and
+ * disconnects it through ConnActions, the scan task scans through
+ * ScanRadio. The station stays associated through a scan as long as no
+ * channel keeps the radio away from its AP for longer than the beacon
+ * timeout.
+ *
+ * Published under the MIT license, see LICENSE.md
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unity.h>
+
+#include "../../src/native/memory_hal.h"
+#include "../../src/conn_manager.h"
+#include "../../src/provisioning.h"
+#include "../../src/wifi_scan.h"
+
+/** Time in ms away from the AP after which the station loses the link */
+#define STATION_BEACON_TIMEOUT 3000
+/** Neighbour APs, one every second channel */
+#define NEIGHBOURS 7
+
+const uint8_t homeBssid[6] = { 0x24, 0x0A, 0xC4, 0x11, 0x22, 0x33 };
+
+class FakeStation: public ScanRadio, public ConnActions {
+public:
+	FakeStation()
+		: associated(false), channel(6), scans(0), disconnects(0), connects(0), lastFound(0), lastChannel(0),
+		  failChannel(0), storedFoundAfter(0) {
+		memset(bssid, 0, sizeof(bssid));
+		memset(visited, 0, sizeof(visited));
+	}
+
+	int scanChannel(const ScanPolicy &policy, uint8_t scanned) {
+		scans++;
+		if (scanned != 0 && scanned == failChannel) {
+			return -1;
+		}
+		// The radio goes back to the AP between channels, one dwell is the longest time away
+		if (policy.dwellMs > STATION_BEACON_TIMEOUT) {
+			associated = false;
+		}
+		lastChannel = scanned;
+		lastFound = 0;
+		for (uint8_t ch = 1; ch <= SCAN_MAX_CHANNEL; ch++) {
+			if ((scanned == 0 && (policy.channelMask & SCAN_CHANNEL(ch))) || ch == scanned) {
+				visited[ch]++;
+				lastFound += apsOn(ch);
+			}
+		}
+		return lastFound;
+	}
+
+	void copyResults(ScanSnapshot &result, int count) {
+		for (uint8_t ch = 1; ch <= SCAN_MAX_CHANNEL && count > 0; ch++) {
+			if (lastChannel != 0 && ch != lastChannel) {
+				continue;
+			}
+			for (uint8_t index = 0; index < apsOn(ch) && result.count < SCAN_CACHE_MAX_AP; index++, count--) {
+				ScanRecord &ap = result.aps[result.count++];
+				memset(&ap, 0, sizeof(ap));
+				if (ch == channel) {
+					strcpy(ap.ssid, "home");
+					memcpy(ap.bssid, homeBssid, sizeof(ap.bssid));
+				} else {
+					snprintf(ap.ssid, sizeof(ap.ssid), "neighbour-%u", ch);
+				}
+				ap.rssi = -60;
+				ap.channel = ch;
+				ap.authMode = 3;
+			}
+		}
+	}
+
+	bool knownNetworksFound(const ScanSnapshot &result) {
+		return storedFoundAfter != 0 && result.count >= storedFoundAfter;
+	}
+
+	void startScan() {
+	}
+
+	bool selectNetwork() {
+		return true;
+	}
+
+	bool connectCached() {
+		return false;
+	}
+
+	void connect() {
+		connects++;
+		associated = true;
+		memcpy(bssid, homeBssid, sizeof(bssid));
+	}
+
+	void disconnect() {
+		disconnects++;
+		associated = false;
+		memset(bssid, 0, sizeof(bssid));
+	}
+
+	void connected(bool) {
+	}
+
+	void stateChanged(ConnManagerState, uint32_t) {
+	}
+
+	bool associated;
+	uint8_t bssid[6];
+	/** Channel of the home AP */
+	uint8_t channel;
+	uint32_t scans;
+	uint32_t disconnects;
+	uint32_t connects;
+	/** Scans of each channel */
+	uint32_t visited[SCAN_MAX_CHANNEL + 1];
+	int lastFound;
+	uint8_t lastChannel;
+	/** Channel whose scan fails, 0 for none */
+	uint8_t failChannel;
+	/** knownNetworksFound() once this many APs were found, 0 never */
+	uint8_t storedFoundAfter;
+
+private:
+	/** The home AP on its channel, a neighbour on every odd channel */
+	uint8_t apsOn(uint8_t ch) const {
+		return ch == channel ? 1 : ch <= 2 * NEIGHBOURS && ch % 2 == 1 ? 1 : 0;
+	}
+};
+
+FakeStation *station;
+ConnManagerConfig config;
+ConnManager *manager;
+
+void setUp(void) {
+	station = new FakeStation();
+	config.debounceMs = CM_DEBOUNCE_TIME;
+	config.quickRetry = true;
+	config.backoffMinMs = CM_BACKOFF_MIN;
+	config.backoffMaxMs = CM_BACKOFF_MAX;
+	config.jitterPercent = 0;
+	manager = new ConnManager(*station, config);
+}
+
+void tearDown(void) {
+	delete manager;
+	delete station;
+}
+
+void post(uint8_t type, uint32_t now) {
+	ConnEvent event = { type, 0 };
+	manager->handle(event, now);
+}
+
+void test_list_read_while_connected_keeps_the_link(void) {
+	manager->begin(true, 0);
+	post(CM_EVT_SCAN_DONE, 100);
+	post(CM_EVT_GOT_IP, 500);
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+	TEST_ASSERT_TRUE(station->associated);
+	uint32_t connects = station->connects;
+
+	NetworkTable networks;
+	BleCodec codec;
+	codecInit(codec, "ESP32-8C0A2F3B");
+	MemoryStore store;
+	StdLock lock;
+	CountingHooks hooks;
+	Provisioning provisioning(networks, codec, store, lock, hooks);
+	ScanCache scanCache;
+
+	// SSID list reads, the first one finds no scan and asks for one
+	ScanSnapshot scan;
+	MemoryValue value;
+	uint32_t now = 20000;
+	for (int read = 0; read < 3; read++, now += 100) {
+		scanCache.read(scan);
+		if (listNeedsScan(scan, now)) {
+			TEST_ASSERT_EQUAL(NEIGHBOURS + 1, runScan(listScanPolicy, *station, scanCache.back()));
+			scanCache.publish(now);
+			scanCache.read(scan);
+		}
+		provisioning.serveList(scan, now, value);
+	}
+
+	// One scan over every channel, the link and the manager did not notice
+	TEST_ASSERT_EQUAL_UINT32(1, station->scans);
+	for (uint8_t ch = 1; ch <= 13; ch++) {
+		TEST_ASSERT_EQUAL_UINT32(1, station->visited[ch]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(0, station->disconnects);
+	TEST_ASSERT_EQUAL_UINT32(connects, station->connects);
+	TEST_ASSERT_TRUE(station->associated);
+	TEST_ASSERT_EQUAL_MEMORY(homeBssid, station->bssid, sizeof(homeBssid));
+	TEST_ASSERT_EQUAL(CM_CONNECTED, manager->state());
+	TEST_ASSERT_EQUAL_UINT32(CM_NO_TIMEOUT, manager->nextTimeout(now));
+
+	std::string list(value.value.begin(), value.value.end());
+	TEST_ASSERT_TRUE(list.find("\"home\"") != std::string::npos);
+	TEST_ASSERT_TRUE(list.find("\"neighbour-13\"") != std::string::npos);
+}
+
+void test_list_scan_dwell_keeps_the_association(void) {
+	// One channel of the list scan is shorter than the beacon timeout
+	TEST_ASSERT_TRUE(listScanPolicy.dwellMs < STATION_BEACON_TIMEOUT);
+	TEST_ASSERT_TRUE(connectScanPolicy.dwellMs < STATION_BEACON_TIMEOUT);
+	station->connect();
+	ScanPolicy slow = listScanPolicy;
+	slow.dwellMs = STATION_BEACON_TIMEOUT + 1;
+	ScanSnapshot result;
+	runScan(slow, *station, result);
+	TEST_ASSERT_FALSE(station->associated);
+}
+
+void test_list_scan_is_a_single_pass(void) {
+	ScanSnapshot result;
+	TEST_ASSERT_EQUAL(NEIGHBOURS + 1, runScan(listScanPolicy, *station, result));
+	TEST_ASSERT_EQUAL_UINT32(1, station->scans);
+	TEST_ASSERT_FALSE(result.partial);
+}
+
+void test_connect_scan_stops_when_known_found(void) {
+	station->storedFoundAfter = 3;
+	ScanSnapshot result;
+	// Channels 1, 3 and 5 hold the first three APs
+	TEST_ASSERT_EQUAL(3, runScan(connectScanPolicy, *station, result));
+	TEST_ASSERT_EQUAL_UINT32(5, station->scans);
+	TEST_ASSERT_TRUE(result.partial);
+	TEST_ASSERT_EQUAL_UINT32(0, station->visited[6]);
+}
+
+void test_failed_channel_marks_scan_partial(void) {
+	station->failChannel = 3;
+	ScanSnapshot result;
+	TEST_ASSERT_EQUAL(NEIGHBOURS, runScan(connectScanPolicy, *station, result));
+	TEST_ASSERT_EQUAL_UINT32(13, station->scans);
+	TEST_ASSERT_TRUE(result.partial);
+}
+
+void test_all_channels_failed_is_an_error(void) {
+	ScanPolicy single = connectScanPolicy;
+	single.channelMask = SCAN_CHANNEL(4);
+	station->failChannel = 4;
+	ScanSnapshot result;
+	TEST_ASSERT_EQUAL(-1, runScan(single, *station, result));
+}
+
+void test_list_needs_scan(void) {
+	ScanSnapshot scan;
+	memset(&scan, 0, sizeof(scan));
+	TEST_ASSERT_TRUE(listNeedsScan(scan, 0));
+	scan.generation = 1;
+	scan.scanTime = 0xFFFFFF00UL;
+	TEST_ASSERT_FALSE(listNeedsScan(scan, scan.scanTime + SCAN_MAX_AGE));
+	TEST_ASSERT_TRUE(listNeedsScan(scan, scan.scanTime + SCAN_MAX_AGE + 1));
+	scan.partial = true;
+	TEST_ASSERT_TRUE(listNeedsScan(scan, scan.scanTime));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_list_read_while_connected_keeps_the_link);
+	RUN_TEST(test_list_scan_dwell_keeps_the_association);
+	RUN_TEST(test_list_scan_is_a_single_pass);
+	RUN_TEST(test_connect_scan_stops_when_known_found);
+	RUN_TEST(test_failed_channel_marks_scan_partial);
+	RUN_TEST(test_all_channels_failed_is_an_error);
+	RUN_TEST(test_list_needs_scan);
+	return UNITY_END();
+}